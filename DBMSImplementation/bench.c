@@ -0,0 +1,952 @@
+// micro-benchmarks for the buffer manager and relational operators
+// usage: ./bench [case]   runs every case when no case is given
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <assert.h>
+#include <ctype.h>
+#include <sys/stat.h>
+#include "db.h"
+#include "ro.h"
+#include "filter.h"
+#include "sort.h"
+#include "prefetch.h"
+#include "index.h"
+#include "zonemap.h"
+#include "dml.h"
+#include <fcntl.h>
+#include <unistd.h>
+
+#define BENCH_DIR "/tmp/dbms_bench"
+
+extern Slot* buffer;
+
+static double now_sec(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// write an input data file with one table of ntuples random tuples
+static void gen_table(const char* path, UINT oid, const char* name, UINT nattrs, UINT ntuples, INT max_val){
+    FILE* fp = fopen(path, "w");
+    fprintf(fp, "database_meta 1\n");
+    fprintf(fp, "table_meta %u %s %u\n", oid, name, nattrs);
+    for (UINT i = 0; i < ntuples; ++i){
+        for (UINT j = 0; j < nattrs; ++j) fprintf(fp, "%d ", rand() % max_val);
+        fprintf(fp, "\n");
+    }
+    fclose(fp);
+}
+
+// build a database with a single table under BENCH_DIR and start the buffer manager
+static void open_bench_db(UINT page_size, UINT buf_slots, UINT nattrs, UINT ntuples, INT max_val){
+    char input_path[200];
+    mkdir(BENCH_DIR, 0777);
+    sprintf(input_path, "%s/input.txt", BENCH_DIR);
+    gen_table(input_path, 1, "t", nattrs, ntuples, max_val);
+    init_conf(page_size, buf_slots, 4, "CLS");
+    init_db(input_path, BENCH_DIR "/data");
+    init();
+}
+
+static void close_bench_db(){
+    release();
+    free_db();
+    free_conf();
+}
+
+// cost of a buffer hit as the pool grows, against the old linear slot scan
+static void bench_lookup(){
+    const UINT nlookups = 1 << 22;
+    printf("\n# page lookup cost vs buffer size (%u hits)\n", nlookups);
+    printf("%10s %14s %14s\n", "buf_slots", "table ns/hit", "scan ns/hit");
+
+    for (UINT buf_slots = 16; buf_slots <= 16384; buf_slots *= 4){
+        // 1 attribute per tuple, 64 byte pages hold 14 tuples
+        open_bench_db(64, buf_slots, 1, buf_slots * 14, 1000);
+
+        // warm up the buffer so every page is resident
+        for (UINT64 pid = 0; pid < buf_slots; ++pid){
+            get_page(1, pid, 0);
+            release_page(pid, 1);
+        }
+
+        UINT64 seed = 42;
+        double t0 = now_sec();
+        for (UINT n = 0; n < nlookups; ++n){
+            seed = seed * 6364136223846793005ULL + 1;
+            UINT64 pid = (seed >> 33) % buf_slots;
+            request_page(pid, 1);
+            release_page(pid, 1);
+        }
+        double t_table = now_sec() - t0;
+
+        // reference: the linear scan request_page() used before the page table
+        const UINT nscans = nlookups / 64;
+        volatile UINT found = 0;
+        seed = 42;
+        t0 = now_sec();
+        for (UINT n = 0; n < nscans; ++n){
+            seed = seed * 6364136223846793005ULL + 1;
+            UINT64 pid = (seed >> 33) % buf_slots;
+            for (UINT i = 0; i < buf_slots; ++i){
+                if (buffer[i].pid == (INT64)pid && buffer[i].oid == 1){
+                    found = i;
+                    break;
+                }
+            }
+        }
+        double t_scan = now_sec() - t0;
+        (void)found;
+
+        printf("%10u %14.1f %14.1f\n", buf_slots, t_table * 1e9 / nlookups, t_scan * 1e9 / nscans);
+        close_bench_db();
+    }
+}
+
+// tuples/second of the page filter kernels against the per-tuple loop sel() used before
+static void bench_filter(){
+    const UINT page_size = 4096;
+    const size_t total_ints = (size_t)1 << 24;     // 64MB of tuple data
+    const char* isas[] = { "scalar", "sse4.2", "avx2" };
+
+    printf("\n# sel() page filter, %u byte pages, 1%% selectivity, Mtuples/s\n", page_size);
+    printf("%8s %12s %12s %12s %12s\n", "nattrs", "tuple loop", isas[0], isas[1], isas[2]);
+
+    INT* data = malloc(sizeof(INT) * total_ints);
+    for (size_t i = 0; i < total_ints; ++i) data[i] = rand() % 100;
+
+    for (UINT nattrs = 1; nattrs <= 16; nattrs *= 2){
+        UINT ntuples_per_page = (page_size - sizeof(UINT64)) / sizeof(INT) / nattrs;
+        UINT ints_per_page = ntuples_per_page * nattrs;
+        UINT npages = total_ints / ints_per_page;
+        double ntuples = (double)npages * ntuples_per_page;
+        UINT64 match[FILTER_WORDS(ntuples_per_page)];
+        volatile UINT64 nmatches = 0;
+        printf("%8u", nattrs);
+
+        // the loop sel() used before, one compare and branch per tuple
+        double t0 = now_sec();
+        UINT64 n = 0;
+        for (UINT p = 0; p < npages; ++p){
+            const INT* page = data + (size_t)p * ints_per_page;
+            for (UINT j = 0; j < ints_per_page; j += nattrs){
+                if (page[j] == 42) n += j;
+            }
+        }
+        nmatches = n;
+        printf(" %12.1f", ntuples / (now_sec() - t0) / 1e6);
+
+        for (UINT k = 0; k < sizeof(isas) / sizeof(isas[0]); ++k){
+            FilterFn fn = filter_kernel(isas[k]);
+            if (fn == NULL){
+                printf(" %12s", "n/a");
+                continue;
+            }
+            t0 = now_sec();
+            n = 0;
+            for (UINT p = 0; p < npages; ++p){
+                fn(data + (size_t)p * ints_per_page, ntuples_per_page, nattrs, 0, 42, 42, 0, match);
+                for (UINT w = 0; w < FILTER_WORDS(ntuples_per_page); ++w)
+                    for (UINT64 bits = match[w]; bits != 0; bits &= bits - 1) n += w * 64 + __builtin_ctzll(bits);
+            }
+            nmatches = n;
+            printf(" %12.1f", ntuples / (now_sec() - t0) / 1e6);
+        }
+        printf("\n");
+        (void)nmatches;
+    }
+    free(data);
+
+    // end to end: sel() over a generated table that is already buffered
+    const UINT ntuples = 1 << 20;
+    open_bench_db(page_size, 1100, 4, ntuples, 100);
+    free_result(sel(1, OP_EQ, 42, 0, "t"));
+    double t0 = now_sec();
+    for (UINT rep = 0; rep < 5; ++rep) free_result(sel(1, OP_EQ, 42, 0, "t"));
+    printf("sel() on %u buffered tuples (%s kernel): %.1f Mtuples/s\n",
+           ntuples, filter_isa(), 5.0 * ntuples / (now_sec() - t0) / 1e6);
+    close_bench_db();
+}
+
+// reading every page of a table file: fseek + two freads per page as
+// read_page_from_file() did before, against one pread() into the frame
+static void bench_io(){
+    const UINT page_size = 4096;
+    const UINT ntuples = 1 << 20;
+    open_bench_db(page_size, 16, 4, ntuples, 1000);
+    UINT npages = (ntuples + (page_size - 8) / 16 - 1) / ((page_size - 8) / 16);
+    INT8* frame = malloc(page_size);
+    const UINT reps = 10;
+    printf("\n# reading %u pages of %u bytes from the page cache, MB/s\n", npages, page_size);
+
+    char path[200];
+    sprintf(path, "%s/1", BENCH_DIR "/data");
+    FILE* fp = fopen(path, "rb");
+    double t0 = now_sec();
+    for (UINT rep = 0; rep < reps; ++rep){
+        for (UINT p = 0; p < npages; ++p){
+            fseek(fp, (long)p * page_size, SEEK_SET);
+            fread(frame, sizeof(UINT64), 1, fp);
+            fread(frame + 8, sizeof(INT), (page_size - 8) / sizeof(INT), fp);
+        }
+    }
+    double t_stdio = now_sec() - t0;
+    fclose(fp);
+
+    t0 = now_sec();
+    for (UINT rep = 0; rep < reps; ++rep){
+        for (UINT p = 0; p < npages; ++p){
+            read_page_from_file(1, p, 0, &buffer[0]);
+        }
+    }
+    double t_pread = now_sec() - t0;
+
+    double mb = (double)reps * npages * page_size / (1 << 20);
+    printf("fseek + fread: %.0f MB/s, pread: %.0f MB/s\n", mb / t_stdio, mb / t_pread);
+    free(frame);
+    close_bench_db();
+}
+
+// sel() over a table that is not in the page cache, with and without read-ahead
+static void bench_prefetch(){
+    const UINT page_size = 4096;
+    const UINT ntuples = 1 << 21;       // 32MB table, 2x the buffer
+    const UINT buf_slots = 4096;
+    const char* configs[][2] = {
+        { "prefetch=0", "prefetch_io=auto" },
+        { "prefetch=8", "prefetch_io=threads" },
+        { "prefetch=32", "prefetch_io=threads" },
+        { "prefetch=8", "prefetch_io=uring" },
+        { "prefetch=32", "prefetch_io=uring" },
+    };
+    open_bench_db(page_size, buf_slots, 4, ntuples, 1000);
+    free_result(sel(1, OP_EQ, 42, 0, "t"));     // warm up
+    char path[200];
+    sprintf(path, "%s/1", BENCH_DIR "/data");
+
+    printf("\n# cold sel() over %u MB with %u buffer slots, ms\n", ntuples * 16 >> 20, buf_slots);
+    printf("%12s %20s %10s %10s %10s %10s\n", "depth", "backend", "ms", "read_io", "hits", "wasted");
+    for (UINT c = 0; c < sizeof(configs) / sizeof(configs[0]); ++c){
+        release();
+        free_conf();
+        Conf* cf = init_conf(page_size, buf_slots, 4, "CLS");
+        set_option(configs[c][0]);
+        set_option(configs[c][1]);
+        init();
+
+        // drop the table from the page cache
+        INT fd = open(path, O_RDONLY);
+        fdatasync(fd);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+
+        reset_IO();
+        double t0 = now_sec();
+        free_result(sel(1, OP_EQ, 42, 0, "t"));
+        double t = now_sec() - t0;
+        printf("%12s %20s %10.1f %10u %10u %10u\n", configs[c][0] + 9, prefetch_backend(),
+               t * 1e3, cf->read_io, cf->prefetch_hits, cf->prefetch_wasted);
+    }
+    close_bench_db();
+}
+
+// read-heavy work on a table 16x larger than the buffer: storage=pread copies
+// every missed page into a frame, storage=mmap points the slot at the mapping
+static void bench_mmap(){
+    const UINT page_size = 4096;
+    const UINT ntuples = 1 << 22;       // 64MB
+    const UINT buf_slots = 1024;        // 4MB
+    const UINT nrandom = 1 << 20;
+    const char* modes[] = { "storage=pread", "storage=mmap" };
+    open_bench_db(page_size, buf_slots, 4, ntuples, 1000);
+    UINT npages = (ntuples + 254) / 255;
+
+    printf("\n# %u MB table, %u MB buffer, ms\n", ntuples * 16 >> 20, buf_slots * page_size >> 20);
+    printf("%16s %14s %14s %14s\n", "mode", "5 sel() scans", "random pages", "read_io");
+    for (UINT m = 0; m < sizeof(modes) / sizeof(modes[0]); ++m){
+        release();
+        free_conf();
+        Conf* cf = init_conf(page_size, buf_slots, 4, "CLS");
+        set_option(modes[m]);
+        init();
+        free_result(sel(1, OP_EQ, 42, 0, "t"));     // warm up
+
+        reset_IO();
+        double t0 = now_sec();
+        for (UINT rep = 0; rep < 5; ++rep) free_result(sel(1, OP_EQ, 42, 0, "t"));
+        double t_scan = now_sec() - t0;
+
+        UINT64 seed = 7;
+        t0 = now_sec();
+        for (UINT n = 0; n < nrandom; ++n){
+            seed = seed * 6364136223846793005ULL + 1;
+            UINT64 pid = (seed >> 33) % npages;
+            get_page(1, pid, 0);
+            release_page(pid, 1);
+        }
+        double t_random = now_sec() - t0;
+        printf("%16s %14.1f %14.1f %14u\n", modes[m], t_scan * 1e3, t_random * 1e3, cf->read_io);
+    }
+    close_bench_db();
+}
+
+// the comparator sort-merge join used before: global key index, subtraction
+static UINT old_cmp_idx = 0;
+static int old_compare_tuples(const void* a, const void* b){
+    Tuple t1 = *(Tuple*)a;
+    Tuple t2 = *(Tuple*)b;
+    return t1[old_cmp_idx] - t2[old_cmp_idx];
+}
+
+static int compare_keyrefs(const void* a, const void* b){
+    const KeyRef* x = a;
+    const KeyRef* y = b;
+    return x->key < y->key ? -1 : (x->key > y->key);
+}
+
+// sorting heap tuples on one attribute: qsort over tuple pointers as
+// sort-merge join did before, qsort over (key, ref) pairs, and radix_sort()
+static void bench_sort(){
+    const UINT nattrs = 4;
+    printf("\n# sort on one attribute, %u attributes per tuple, ms\n", nattrs);
+    printf("%10s %14s %14s %14s\n", "ntuples", "qsort tuples", "qsort pairs", "radix pairs");
+
+    for (UINT ntuples = 1 << 16; ntuples <= 1 << 22; ntuples <<= 2){
+        Tuple* tuples = malloc(sizeof(Tuple) * ntuples);
+        Tuple* work = malloc(sizeof(Tuple) * ntuples);
+        for (UINT i = 0; i < ntuples; ++i){
+            tuples[i] = malloc(sizeof(INT) * nattrs);
+            // small magnitudes, the old comparator overflows on the full INT range
+            for (UINT j = 0; j < nattrs; ++j) tuples[i][j] = rand() % 2000000 - 1000000;
+        }
+        KeyRef* refs = malloc(sizeof(KeyRef) * ntuples);
+        KeyRef* tmp = malloc(sizeof(KeyRef) * ntuples);
+        printf("%10u", ntuples);
+
+        memcpy(work, tuples, sizeof(Tuple) * ntuples);
+        double t0 = now_sec();
+        old_cmp_idx = 1;
+        qsort(work, ntuples, sizeof(Tuple), old_compare_tuples);
+        printf(" %14.1f", (now_sec() - t0) * 1e3);
+
+        t0 = now_sec();
+        for (UINT i = 0; i < ntuples; ++i){
+            refs[i].key = radix_key(tuples[i][1]);
+            refs[i].ref = i;
+        }
+        qsort(refs, ntuples, sizeof(KeyRef), compare_keyrefs);
+        for (UINT i = 0; i < ntuples; ++i) work[i] = tuples[refs[i].ref];
+        printf(" %14.1f", (now_sec() - t0) * 1e3);
+
+        t0 = now_sec();
+        for (UINT i = 0; i < ntuples; ++i){
+            refs[i].key = radix_key(tuples[i][1]);
+            refs[i].ref = i;
+        }
+        radix_sort(refs, tmp, ntuples);
+        for (UINT i = 0; i < ntuples; ++i) work[i] = tuples[refs[i].ref];
+        printf(" %14.1f\n", (now_sec() - t0) * 1e3);
+
+        for (UINT i = 1; i < ntuples; ++i){
+            if (work[i-1][1] > work[i][1]){
+                printf("radix_sort() output is not sorted\n");
+                exit(1);
+            }
+        }
+
+        for (UINT i = 0; i < ntuples; ++i) free(tuples[i]);
+        free(tuples);
+        free(work);
+        free(refs);
+        free(tmp);
+    }
+}
+
+// building and freeing a result of n tuples: one malloc per tuple plus a
+// growing pointer array as sel() and join() did before, against append_tuple()
+static void bench_results(){
+    const UINT nattrs = 5;
+    INT tup[nattrs];
+    for (UINT j = 0; j < nattrs; ++j) tup[j] = j;
+
+    printf("\n# result of n tuples with %u attributes: allocations and ms to build + free\n", nattrs);
+    printf("%10s %12s %12s %12s %12s\n", "ntuples", "old allocs", "old ms", "chunk allocs", "chunk ms");
+    for (UINT n = 1000; n <= 10000000; n *= 10){
+        double t0 = now_sec();
+        UINT64 nallocs = 0;
+        UINT cap = 0;
+        Tuple* tuples = NULL;
+        for (UINT i = 0; i < n; ++i){
+            if (i == cap){
+                cap = cap ? cap * 2 : 64;
+                tuples = realloc(tuples, sizeof(Tuple) * cap);
+                ++nallocs;
+            }
+            tuples[i] = malloc(sizeof(INT) * nattrs);
+            memcpy(tuples[i], tup, sizeof(tup));
+            ++nallocs;
+        }
+        for (UINT i = 0; i < n; ++i) free(tuples[i]);
+        free(tuples);
+        double t_old = now_sec() - t0;
+
+        t0 = now_sec();
+        _Table* res = new_result(nattrs);
+        for (UINT i = 0; i < n; ++i) memcpy(append_tuple(res), tup, sizeof(tup));
+        UINT nchunks = res->nchunks;
+        free_result(res);
+        double t_chunk = now_sec() - t0;
+
+        printf("%10u %12llu %12.2f %12u %12.2f\n", n, (unsigned long long)nallocs, t_old * 1e3, nchunks + 1, t_chunk * 1e3);
+    }
+
+    // end to end: a hash join with a large result
+    const UINT ntuples = 1 << 16;
+    open_bench_db(4096, 300, 2, ntuples, 1 << 12);
+    get_conf()->join_algo = JOIN_HASH;
+    free_result(join(0, "t", 0, "t"));
+    double t0 = now_sec();
+    _Table* res = join(0, "t", 0, "t");
+    double t_join = now_sec() - t0;
+    printf("hash join() of %u tuples with itself: %u result tuples in %u chunks, %.1f ms\n",
+           ntuples, res->ntuples, res->nchunks, t_join * 1e3);
+    free_result(res);
+    close_bench_db();
+}
+
+// sel() over a table 2x larger than the buffer as the number of workers grows
+static void bench_parallel(){
+    const UINT page_size = 4096;
+    const UINT ntuples = 1 << 22;       // 64MB table
+    const UINT buf_slots = 8192;
+    open_bench_db(page_size, buf_slots, 4, ntuples, 1000);
+    Conf* cf = get_conf();
+    _Table* res = sel(1, OP_LT, 500, 0, "t");   // warm up the page cache
+    UINT expected = res->ntuples;
+    free_result(res);
+
+    printf("\n# sel() of half of %u MB with %u buffer slots on %ld cpus\n", ntuples * 16 >> 20, buf_slots, sysconf(_SC_NPROCESSORS_ONLN));
+    printf("%8s %10s %10s %10s\n", "threads", "ms", "speedup", "read_io");
+    double t1 = 0;
+    for (UINT n = 1; n <= 16; n *= 2){
+        cf->threads = n;
+        reset_IO();
+        double t0 = now_sec();
+        res = sel(1, OP_LT, 500, 0, "t");
+        double t = now_sec() - t0;
+        assert(res->ntuples == expected);
+        free_result(res);
+        if (n == 1) t1 = t;
+        printf("%8u %10.1f %10.2f %10u\n", n, t * 1e3, t1 / t, cf->read_io);
+    }
+    close_bench_db();
+}
+
+// open_file() hits as the number of open files grows, and files reopened by a
+// hot set of tables mixed with one cold table per round
+static void bench_files(){
+    const UINT ntables = 256;
+    const UINT nhits = 1 << 22;
+    char input_path[200];
+    mkdir(BENCH_DIR, 0777);
+    sprintf(input_path, "%s/input.txt", BENCH_DIR);
+    FILE* fp = fopen(input_path, "w");
+    fprintf(fp, "database_meta %u\n", ntables);
+    for (UINT t = 0; t < ntables; ++t) fprintf(fp, "table_meta %u t%u 1\n1\n", t + 1, t);
+    fclose(fp);
+
+    printf("\n# open_file() cost vs open files (%u hits), reopens of a hot set\n", nhits);
+    printf("%10s %14s %10s %10s\n", "file_limit", "ns/hit", "opens", "closes");
+    for (UINT limit = 4; limit <= ntables; limit *= 4){
+        init_conf(64, 4, limit, "CLS");
+        init_db(input_path, BENCH_DIR "/data");
+        init();
+
+        for (UINT t = 0; t < limit; ++t){ open_file(t + 1); unpin_file(t + 1); }
+        double t0 = now_sec();
+        for (UINT i = 0; i < nhits; ++i){
+            UINT oid = (i * 7) % limit + 1;
+            open_file(oid);
+            unpin_file(oid);
+        }
+        double t_hit = now_sec() - t0;
+
+        // limit - 1 hot tables stay open while the cold ones cycle through the last entry
+        reset_IO();
+        for (UINT round = 0; round < 1000; ++round){
+            for (UINT t = 0; t + 1 < limit; ++t){ open_file(t + 1); unpin_file(t + 1); }
+            UINT cold = limit + round % (ntables - limit + 1);
+            if (cold > ntables) cold = limit;
+            open_file(cold);
+            unpin_file(cold);
+        }
+        printf("%10u %14.1f %10u %10u\n", limit, t_hit * 1e9 / nhits, get_conf()->file_opens, get_conf()->file_closes);
+
+        release();
+        free_db();
+        free_conf();
+    }
+}
+
+// key of rank 0..n-1 drawn with probability ~ 1/(rank+1), cdf[] from zipf_cdf()
+static UINT zipf_key(const double* cdf, UINT n){
+    double u = (double)rand() / RAND_MAX;
+    UINT lo = 0, hi = n - 1;
+    while (lo < hi){
+        UINT mid = (lo + hi) / 2;
+        if (cdf[mid] < u) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+static double* zipf_cdf(UINT n){
+    double* cdf = malloc(sizeof(double) * n);
+    double sum = 0;
+    for (UINT i = 0; i < n; ++i) cdf[i] = sum += 1.0 / (i + 1);
+    for (UINT i = 0; i < n; ++i) cdf[i] /= sum;
+    return cdf;
+}
+
+// hash join of a table with unique keys and one 16x larger whose foreign
+// keys are uniform or Zipf distributed, as the number of workers grows
+static void bench_hashjoin(){
+    const UINT page_size = 4096;
+    const UINT nbuild = 1 << 16;
+    const UINT nprobe = 1 << 20;
+    const UINT buf_slots = 1024;
+    char input_path[200];
+    mkdir(BENCH_DIR, 0777);
+    sprintf(input_path, "%s/input.txt", BENCH_DIR);
+    double* cdf = zipf_cdf(nbuild);
+
+    for (UINT zipf = 0; zipf <= 1; ++zipf){
+        FILE* fp = fopen(input_path, "w");
+        fprintf(fp, "database_meta 2\n");
+        fprintf(fp, "table_meta 1 r 2\n");
+        for (UINT i = 0; i < nbuild; ++i) fprintf(fp, "%u %u\n", i, i);
+        fprintf(fp, "table_meta 2 s 2\n");
+        for (UINT i = 0; i < nprobe; ++i) fprintf(fp, "%u %u\n", i, zipf ? zipf_key(cdf, nbuild) : (UINT)rand() % nbuild);
+        fclose(fp);
+        init_conf(page_size, buf_slots, 4, "CLS");
+        init_db(input_path, BENCH_DIR "/data");
+        init();
+        Conf* cf = get_conf();
+        cf->join_algo = JOIN_HASH;
+
+        printf("\n# hash join of %u x %u tuples, %s keys, %u buffer slots on %ld cpus\n", nbuild, nprobe, zipf ? "zipf" : "uniform", buf_slots, sysconf(_SC_NPROCESSORS_ONLN));
+        printf("%8s %10s %10s %10s %10s\n", "threads", "ms", "speedup", "read_io", "write_io");
+        double t1 = 0;
+        for (UINT n = 1; n <= 16; n *= 2){
+            cf->threads = n;
+            reset_IO();
+            double t0 = now_sec();
+            _Table* res = join(0, "r", 1, "s");
+            double t = now_sec() - t0;
+            assert(res->ntuples == nprobe);
+            free_result(res);
+            if (n == 1) t1 = t;
+            printf("%8u %10.1f %10.2f %10u %10u\n", n, t * 1e3, t1 / t, cf->read_io, cf->write_io);
+        }
+        close_bench_db();
+    }
+    free(cdf);
+}
+
+// read_io of one join with the cheapest strategy that needs no index, then
+// with an index nested loop join over a hash index on the larger table
+static void inlj_case(const char* label, UINT idx1, const char* name1, UINT idx2, const char* name2){
+    Conf* cf = get_conf();
+    Table* t1 = find_table(name1);
+    Table* t2 = find_table(name2);
+    cf->join_algo = JOIN_AUTO;
+    reset_IO();
+    _Table* res = join(idx1, name1, idx2, name2);
+    UINT expected = res->ntuples;
+    UINT io_plain = cf->read_io;
+    free_result(res);
+
+    Table* inner = t2->ntuples >= t1->ntuples ? t2 : t1;
+    reset_IO();
+    create_index(inner, inner == t2 ? idx2 : idx1, INDEX_HASH);
+    UINT io_build = cf->read_io + cf->write_io;
+
+    cf->join_algo = JOIN_INDEX;
+    reset_IO();
+    double t0 = now_sec();
+    res = join(idx1, name1, idx2, name2);
+    double t = now_sec() - t0;
+    assert(res->ntuples == expected);
+    free_result(res);
+    cf->join_algo = JOIN_AUTO;
+    printf("%-28s %10u %10u %10u %10.1f\n", label, io_plain, cf->read_io, io_build, t * 1e3);
+}
+
+// read_io of index nested loop joins on the bundled join tests and on a
+// small table joined with a large one. the index run follows the index
+// build, so pages of small tables may still be buffered
+static void bench_inlj(){
+    static const struct { const char* name; const char* data; UINT page_size, buf_slots; const char* joins[3]; } tests[] = {
+        { "test3", "test/test3/data_3.txt", 50, 14, { "3 t1_name 1 t3_name", "2 t2_name 1 t3_name", "3 t1_name 2 t2_name" } },
+        { "test4", "test/test4/data_4.txt", 50, 5, { "3 t1_name 0 t2_name" } },
+        { "test8", "test/test8/data_8.txt", 40, 4, { "0 r_name 0 s_name", "2 s_name 1 r_name" } },
+    };
+    char label[100];
+    printf("\n# join read_io without an index, with an index nested loop join (hash index on the larger table)\n");
+    printf("%-28s %10s %10s %10s %10s\n", "join", "no index", "index", "build I/O", "index ms");
+    for (UINT i = 0; i < sizeof(tests) / sizeof(tests[0]); ++i){
+        if (access(tests[i].data, R_OK) != 0){
+            printf("%s not found, run from DBMSImplementation\n", tests[i].data);
+            continue;
+        }
+        init_conf(tests[i].page_size, tests[i].buf_slots, 4, "CLS");
+        init_db((char*)tests[i].data, BENCH_DIR "/data");
+        init();
+        for (UINT j = 0; j < 3 && tests[i].joins[j] != NULL; ++j){
+            UINT idx1, idx2;
+            char name1[50], name2[50];
+            sscanf(tests[i].joins[j], "%u %s %u %s", &idx1, name1, &idx2, name2);
+            sprintf(label, "%s: %s", tests[i].name, tests[i].joins[j]);
+            inlj_case(label, idx1, name1, idx2, name2);
+        }
+        close_bench_db();
+    }
+
+    // 64 tuples joined with 1M, keys in [0, 1M)
+    const UINT nouter = 1 << 6;
+    const UINT ninner = 1 << 20;
+    char input_path[200];
+    mkdir(BENCH_DIR, 0777);
+    sprintf(input_path, "%s/input.txt", BENCH_DIR);
+    FILE* fp = fopen(input_path, "w");
+    fprintf(fp, "database_meta 2\n");
+    fprintf(fp, "table_meta 1 r 2\n");
+    for (UINT i = 0; i < nouter; ++i) fprintf(fp, "%d %u\n", rand() % ninner, i);
+    fprintf(fp, "table_meta 2 s 2\n");
+    for (UINT i = 0; i < ninner; ++i) fprintf(fp, "%d %u\n", rand() % ninner, i);
+    fclose(fp);
+    init_conf(4096, 256, 4, "CLS");
+    init_db(input_path, BENCH_DIR "/data");
+    init();
+    sprintf(label, "%u x %u tuples", nouter, ninner);
+    inlj_case(label, 0, "r", 0, "s");
+    close_bench_db();
+}
+
+// read_io with zone maps off and on for one sel() or join()
+static void zonemap_case(const char* label, UINT is_join, UINT idx, UINT op, INT val, INT val2){
+    Conf* cf = get_conf();
+    UINT io[2], skipped = 0, ntuples = 0;
+    double ms[2];
+    for (UINT on = 0; on <= 1; ++on){
+        cf->zonemaps = on;
+        reset_IO();
+        double t0 = now_sec();
+        _Table* res = is_join ? join(0, "r", 0, "s") : sel(idx, op, val, val2, "s");
+        ms[on] = (now_sec() - t0) * 1e3;
+        if (on) assert(res->ntuples == ntuples);
+        ntuples = res->ntuples;
+        free_result(res);
+        io[on] = cf->read_io;
+        if (on) skipped = cf->pages_skipped;
+    }
+    cf->zonemaps = 0;
+    printf("%-28s %10u %10u %10u %10.1f %10.1f\n", label, io[0], io[1], skipped, ms[0], ms[1]);
+}
+
+// pages a scan reads with and without zone maps on a table clustered on
+// attribute 0, attribute 1 is random so its zones cover everything
+static void bench_zonemap(){
+    const UINT nouter = 1 << 8;
+    const UINT ntuples = 1 << 20;
+    char input_path[200];
+    char label[100];
+    mkdir(BENCH_DIR, 0777);
+    sprintf(input_path, "%s/input.txt", BENCH_DIR);
+    FILE* fp = fopen(input_path, "w");
+    fprintf(fp, "database_meta 2\n");
+    fprintf(fp, "table_meta 1 r 2\n");
+    for (UINT i = 0; i < nouter; ++i) fprintf(fp, "%u %u\n", ntuples / 2 + rand() % (ntuples / 64), i);
+    fprintf(fp, "table_meta 2 s 2\n");
+    for (UINT i = 0; i < ntuples; ++i) fprintf(fp, "%u %d\n", i, rand() % ntuples);
+    fclose(fp);
+    init_conf(4096, 256, 4, "CLS");
+    init_db(input_path, BENCH_DIR "/data");
+    init();
+    Conf* cf = get_conf();
+
+    printf("\n# zone maps on %u tuples clustered on attribute 0, read_io off and on\n", ntuples);
+    printf("%-28s %10s %10s %10s %10s %10s\n", "query", "off", "on", "skipped", "off ms", "on ms");
+    zonemap_case("sel 0 = key", 0, 0, OP_EQ, ntuples / 3, 0);
+    sprintf(label, "sel 0 between, 1%%");
+    zonemap_case(label, 0, 0, OP_BETWEEN, ntuples / 3, ntuples / 3 + ntuples / 100);
+    zonemap_case("sel 0 < key, 50%", 0, 0, OP_LT, ntuples / 2, 0);
+    zonemap_case("sel 1 = key (random)", 0, 1, OP_EQ, ntuples / 3, 0);
+    sprintf(label, "nl join %u x %u", nouter, ntuples);
+    cf->join_algo = JOIN_NESTED_LOOP;
+    zonemap_case(label, 1, 0, 0, 0, 0);
+    sprintf(label, "hash join %u x %u", nouter, ntuples);
+    cf->join_algo = JOIN_HASH;
+    zonemap_case(label, 1, 0, 0, 0, 0);
+    cf->join_algo = JOIN_AUTO;
+    close_bench_db();
+}
+
+// page I/O and time of each join strategy with and without the Bloom filter
+// semi-join, when few tuples of the larger table have a partner
+static void bench_bloom(){
+    const UINT nbuild = 1 << 13;
+    const UINT nprobe = 1 << 19;
+    const UINT domain = 1 << 22;
+    char input_path[200];
+    mkdir(BENCH_DIR, 0777);
+    sprintf(input_path, "%s/input.txt", BENCH_DIR);
+    FILE* fp = fopen(input_path, "w");
+    fprintf(fp, "database_meta 2\n");
+    fprintf(fp, "table_meta 1 r 2\n");
+    for (UINT i = 0; i < nbuild; ++i) fprintf(fp, "%d %u\n", rand() % domain, i);
+    fprintf(fp, "table_meta 2 s 2\n");
+    for (UINT i = 0; i < nprobe; ++i) fprintf(fp, "%d %u\n", rand() % domain, i);
+    fclose(fp);
+    init_conf(4096, 8, 4, "CLS");
+    init_db(input_path, BENCH_DIR "/data");
+    init();
+    Conf* cf = get_conf();
+
+    static const UINT algos[] = { JOIN_NESTED_LOOP, JOIN_SORT_MERGE, JOIN_HASH };
+    static const char* names[] = { "nested loop", "sort-merge", "hash" };
+    printf("\n# join of %u x %u tuples, keys in [0, %u), 8 buffer slots, Bloom filter off and on\n", nbuild, nprobe, domain);
+    printf("%-12s %10s %10s %10s %10s %10s %10s\n", "join", "read off", "write off", "read on", "write on", "off ms", "on ms");
+    for (UINT a = 0; a < 3; ++a){
+        UINT io[2][2], ntuples = 0;
+        double ms[2];
+        cf->join_algo = algos[a];
+        for (UINT on = 0; on <= 1; ++on){
+            cf->bloom = on;
+            reset_IO();
+            double t0 = now_sec();
+            _Table* res = join(0, "r", 0, "s");
+            ms[on] = (now_sec() - t0) * 1e3;
+            if (on) assert(res->ntuples == ntuples);
+            ntuples = res->ntuples;
+            free_result(res);
+            io[on][0] = cf->read_io;
+            io[on][1] = cf->write_io;
+        }
+        printf("%-12s %10u %10u %10u %10u %10.1f %10.1f\n", names[a], io[0][0], io[0][1], io[1][0], io[1][1], ms[0], ms[1]);
+    }
+    cf->bloom = 0;
+    cf->join_algo = JOIN_AUTO;
+    close_bench_db();
+}
+
+// write path: inserts into the padding and new pages, an update and a delete
+// of 1% of the tuples, with the pages written back when evicted and at release()
+static void bench_write(){
+    const UINT ntuples = 1 << 18;
+    const UINT ninserts = 1 << 16;
+    static const UINT slots[] = { 16, 1024 };
+    printf("\n# write path on %u tuples of 4 attributes, 4096 byte pages\n", ntuples);
+    printf("%-8s %-22s %10s %10s %10s %10s\n", "slots", "operation", "tuples", "read_io", "write_io", "ms");
+    for (UINT b = 0; b < 2; ++b){
+        srand(1);
+        open_bench_db(4096, slots[b], 4, ntuples, 1 << 20);
+        Conf* cf = get_conf();
+        Table* t = find_table("t");
+        INT tup[4];
+        UINT n;
+
+        reset_IO();
+        double t0 = now_sec();
+        for (UINT i = 0; i < ninserts; ++i){
+            for (UINT j = 0; j < 4; ++j) tup[j] = rand() % (1 << 20);
+            insert_tuple(t, tup);
+        }
+        printf("%-8u %-22s %10u %10u %10u %10.1f\n", slots[b], "insert", ninserts, cf->read_io, cf->write_io, (now_sec() - t0) * 1e3);
+
+        reset_IO();
+        t0 = now_sec();
+        n = update_tuples(t, 1, 0, 0, OP_LT, (1 << 20) / 100, 0);
+        printf("%-8u %-22s %10u %10u %10u %10.1f\n", slots[b], "update 1%", n, cf->read_io, cf->write_io, (now_sec() - t0) * 1e3);
+
+        reset_IO();
+        t0 = now_sec();
+        n = delete_tuples(t, 0, OP_GE, (1 << 20) - (1 << 20) / 100, 0);
+        printf("%-8u %-22s %10u %10u %10u %10.1f\n", slots[b], "delete 1%", n, cf->read_io, cf->write_io, (now_sec() - t0) * 1e3);
+
+        // the dirty pages left in the buffer
+        reset_IO();
+        t0 = now_sec();
+        release();
+        printf("%-8u %-22s %10s %10u %10u %10.1f\n", slots[b], "write-back at release", "", cf->read_io, cf->write_io, (now_sec() - t0) * 1e3);
+        free_db();
+        free_conf();
+    }
+}
+
+// the tuple loop init_db() used before: fgets() of 100 chars, strtok() and
+// sscanf() per attribute, one fwrite() per attribute and per padding byte.
+// input with a single table, no zone map
+static void old_load(const char* input_path, const char* table_path, UINT page_size){
+    FILE* in = fopen(input_path, "r");
+    FILE* out = fopen(table_path, "wb");
+    UINT nattrs = 0, ntuples_per_page = 0, nbytes_free = 0, processed = 0;
+    UINT64 page_id = 0;
+    char line[100];
+    while (fgets(line, 100, in)){
+        if (line[0] == 't'){
+            char desc[50], name[50];
+            UINT oid;
+            sscanf(line, "%s %u %s %u", desc, &oid, name, &nattrs);
+            ntuples_per_page = (page_size - sizeof(UINT64)) / sizeof(INT) / nattrs;
+            nbytes_free = (page_size - sizeof(UINT64)) % (sizeof(INT) * nattrs);
+            continue;
+        }
+        if (!isdigit(line[0]) && line[0] != '-') continue;
+        if (processed == 0) fwrite(&page_id, sizeof(UINT64), 1, out), ++page_id;
+        ++processed;
+        INT attr;
+        for (char* token = strtok(line, " "); token != NULL; token = strtok(NULL, " "))
+            if (sscanf(token, "%d", &attr) == 1) fwrite(&attr, sizeof(INT), 1, out);
+        if (processed == ntuples_per_page){
+            INT8 f = 0;
+            for (UINT i = 0; i < nbytes_free; i++) fwrite(&f, sizeof(INT8), 1, out);
+            processed = 0;
+        }
+    }
+    if (processed != 0){
+        INT8 f = 0;
+        UINT left = sizeof(INT) * nattrs * (ntuples_per_page - processed) + nbytes_free;
+        for (UINT i = 0; i < left; i++) fwrite(&f, sizeof(INT8), 1, out);
+    }
+    fclose(out);
+    fclose(in);
+}
+
+// MB/s of loading input data with the old tuple loop and with init_db(),
+// the input file is in the page cache after it is generated. lines of 16
+// attributes are longer than 99 chars, which the old loop splits
+static void bench_load(){
+    const UINT ntuples = 1 << 20;
+    char input_path[200];
+    mkdir(BENCH_DIR, 0777);
+    mkdir(BENCH_DIR "/data", 0777);
+    sprintf(input_path, "%s/input.txt", BENCH_DIR);
+    printf("\n# loading %u tuples, MB/s of input\n", ntuples);
+    printf("%8s %10s %10s %10s %10s %10s\n", "nattrs", "MB", "old ms", "old MB/s", "ms", "MB/s");
+    for (UINT nattrs = 2; nattrs <= 16; nattrs *= 2){
+        gen_table(input_path, 1, "t", nattrs, ntuples, 1 << 30);
+        struct stat st;
+        stat(input_path, &st);
+        double mb = st.st_size / 1e6;
+
+        double t0 = now_sec();
+        old_load(input_path, BENCH_DIR "/data/old", 4096);
+        double t_old = now_sec() - t0;
+
+        init_conf(4096, 16, 4, "CLS");
+        t0 = now_sec();
+        init_db(input_path, BENCH_DIR "/data");
+        double t = now_sec() - t0;
+        assert(get_db()->tables[0].ntuples == ntuples);
+        free_db();
+        free_conf();
+        printf("%8u %10.1f %10.1f %10.1f %10.1f %10.1f\n", nattrs, mb, t_old * 1e3, mb / t_old, t * 1e3, mb / t);
+    }
+    unlink(BENCH_DIR "/data/old");
+
+    // startup of a database of 50 tables, a few of them large
+    const UINT ntables = 50;
+    FILE* fp = fopen(input_path, "w");
+    fprintf(fp, "database_meta %u\n", ntables);
+    for (UINT i = 0; i < ntables; ++i){
+        UINT nattrs = 1 + i % 8;
+        UINT n = i % 10 == 0 ? 1 << 20 : 1 << 14;
+        fprintf(fp, "table_meta %u t%u %u\n", i + 1, i, nattrs);
+        for (UINT k = 0; k < n; ++k){
+            for (UINT j = 0; j < nattrs; ++j) fprintf(fp, "%d ", rand());
+            fprintf(fp, "\n");
+        }
+    }
+    fclose(fp);
+    struct stat st;
+    stat(input_path, &st);
+    double mb = st.st_size / 1e6;
+    printf("\n# loading %u tables, %.1f MB, on %ld cpus\n", ntables, mb, sysconf(_SC_NPROCESSORS_ONLN));
+    printf("%8s %10s %10s %10s\n", "threads", "ms", "MB/s", "speedup");
+    double t1 = 0;
+    for (UINT n = 1; n <= 8; n *= 2){
+        init_conf(4096, 16, 4, "CLS");
+        get_conf()->load_threads = n;
+        double t0 = now_sec();
+        init_db(input_path, BENCH_DIR "/data");
+        double t = now_sec() - t0;
+        assert(get_db()->ntables == ntables);
+        free_db();
+        free_conf();
+        if (n == 1) t1 = t;
+        printf("%8u %10.1f %10.1f %10.2f\n", n, t * 1e3, mb / t, t1 / t);
+    }
+}
+
+// restart time: loading the input with init_db() against opening the
+// database it left with open_db()
+static void bench_open(){
+    const UINT ntables = 50;
+    char input_path[200];
+    mkdir(BENCH_DIR, 0777);
+    sprintf(input_path, "%s/input.txt", BENCH_DIR);
+    FILE* fp = fopen(input_path, "w");
+    fprintf(fp, "database_meta %u\n", ntables);
+    UINT64 ntuples = 0;
+    for (UINT i = 0; i < ntables; ++i){
+        UINT n = i % 10 == 0 ? 1 << 20 : 1 << 12;
+        fprintf(fp, "table_meta %u t%u 4\n", i + 1, i);
+        for (UINT k = 0; k < n; ++k) fprintf(fp, "%d %d %d %d\n", rand(), rand(), rand(), rand());
+        ntuples += n;
+    }
+    fclose(fp);
+
+    printf("\n# restart of a database of %u tables, %llu tuples, ms\n", ntables, (unsigned long long)ntuples);
+    printf("%10s %10s\n", "init_db", "open_db");
+    init_conf(4096, 16, 4, "CLS");
+    double t0 = now_sec();
+    init_db(input_path, BENCH_DIR "/data");
+    double t_load = now_sec() - t0;
+    free_db();
+    t0 = now_sec();
+    Database* d = open_db(input_path, BENCH_DIR "/data", 1);
+    double t_open = now_sec() - t0;
+    assert(d != NULL && d->ntables == ntables);
+    free_db();
+    free_conf();
+    printf("%10.1f %10.3f\n", t_load * 1e3, t_open * 1e3);
+}
+
+int main(int argc, char** argv){
+    const char* which = argc > 1 ? argv[1] : "all";
+    srand(1);
+
+    if (!strcmp(which, "all") || !strcmp(which, "lookup")) bench_lookup();
+    if (!strcmp(which, "all") || !strcmp(which, "filter")) bench_filter();
+    if (!strcmp(which, "all") || !strcmp(which, "io")) bench_io();
+    if (!strcmp(which, "all") || !strcmp(which, "prefetch")) bench_prefetch();
+    if (!strcmp(which, "all") || !strcmp(which, "mmap")) bench_mmap();
+    if (!strcmp(which, "all") || !strcmp(which, "sort")) bench_sort();
+    if (!strcmp(which, "all") || !strcmp(which, "results")) bench_results();
+    if (!strcmp(which, "all") || !strcmp(which, "files")) bench_files();
+    if (!strcmp(which, "all") || !strcmp(which, "parallel")) bench_parallel();
+    if (!strcmp(which, "all") || !strcmp(which, "hashjoin")) bench_hashjoin();
+    if (!strcmp(which, "all") || !strcmp(which, "inlj")) bench_inlj();
+    if (!strcmp(which, "all") || !strcmp(which, "zonemap")) bench_zonemap();
+    if (!strcmp(which, "all") || !strcmp(which, "bloom")) bench_bloom();
+    if (!strcmp(which, "all") || !strcmp(which, "load")) bench_load();
+    if (!strcmp(which, "all") || !strcmp(which, "open")) bench_open();
+    if (!strcmp(which, "all") || !strcmp(which, "write")) bench_write();
+
+    return 0;
+}
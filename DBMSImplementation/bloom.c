@@ -0,0 +1,78 @@
+// blocked Bloom filter for semi-join reduction
+// one 64-bit hash of the key picks the block with its high half and, mixed
+// once more, gives k 9-bit positions inside the block
+
+#include <stdlib.h>
+#include <string.h>
+#include "bloom.h"
+#include "filter.h"
+
+#define BLOOM_BLOCK_BITS (BLOOM_BLOCK_WORDS * 64)
+#define BLOOM_MAX_K 7       // 7 * 9 bits of the second hash
+
+static inline UINT64 bloom_hash(INT key){
+    UINT64 h = (UINT)key;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+static inline UINT64* bloom_block(const Bloom* bf, UINT64 h){
+    return bf->words + ((h >> 32) * bf->nblocks >> 32) * BLOOM_BLOCK_WORDS;
+}
+
+void bloom_init(Bloom* bf, UINT nkeys, UINT max_bytes){
+    UINT64 bits = (UINT64)nkeys * BLOOM_BITS_PER_KEY;
+    if (bits > (UINT64)max_bytes * 8) bits = (UINT64)max_bytes * 8;
+    bf->nblocks = bits / BLOOM_BLOCK_BITS;
+    if (bf->nblocks == 0) bf->nblocks = 1;
+
+    // k = bits per key * ln 2 is best for the room there is
+    double per_key = nkeys > 0 ? (double)bf->nblocks * BLOOM_BLOCK_BITS / nkeys : BLOOM_BITS_PER_KEY;
+    bf->k = (UINT)(per_key * 0.693 + 0.5);
+    if (bf->k < 1) bf->k = 1;
+    if (bf->k > BLOOM_MAX_K) bf->k = BLOOM_MAX_K;
+
+    bf->words = calloc((size_t)bf->nblocks * BLOOM_BLOCK_WORDS, sizeof(UINT64));
+}
+
+void bloom_free(Bloom* bf){
+    free(bf->words);
+    bf->words = NULL;
+}
+
+void bloom_add(Bloom* bf, INT key){
+    UINT64 h = bloom_hash(key);
+    UINT64* block = bloom_block(bf, h);
+    UINT64 g = h * 0x9E3779B97F4A7C15ULL;
+    for (UINT i = 0; i < bf->k; ++i, g >>= 9){
+        UINT bit = g & (BLOOM_BLOCK_BITS - 1);
+        block[bit >> 6] |= 1ULL << (bit & 63);
+    }
+}
+
+UINT bloom_test(const Bloom* bf, INT key){
+    UINT64 h = bloom_hash(key);
+    const UINT64* block = bloom_block(bf, h);
+    UINT64 g = h * 0x9E3779B97F4A7C15ULL;
+    for (UINT i = 0; i < bf->k; ++i, g >>= 9){
+        UINT bit = g & (BLOOM_BLOCK_BITS - 1);
+        if (!(block[bit >> 6] >> (bit & 63) & 1)) return 0;
+    }
+    return 1;
+}
+
+UINT bloom_page(const Bloom* bf, const INT* data, UINT ntuples, UINT nattrs, UINT idx, UINT64* bitmap){
+    memset(bitmap, 0, sizeof(UINT64) * FILTER_WORDS(ntuples));
+    const INT* col = data + idx;
+    UINT n = 0;
+    for (UINT t = 0; t < ntuples; ++t){
+        UINT m = bloom_test(bf, col[(size_t)t * nattrs]);
+        bitmap[t >> 6] |= (UINT64)m << (t & 63);
+        n += m;
+    }
+    return n;
+}
@@ -0,0 +1,30 @@
+#ifndef BLOOM_H
+#define BLOOM_H
+#include "db.h"
+
+// blocked Bloom filter over INT keys
+// a key sets k bits inside one block of BLOOM_BLOCK_WORDS words (a cache
+// line), so adding or testing it touches a single line. it answers "maybe"
+// for every key added and for some others, never "no" for an added key.
+
+#define BLOOM_BLOCK_WORDS 8         // 512 bits
+#define BLOOM_BITS_PER_KEY 10       // about 1% false positives when there is room
+
+typedef struct Bloom {
+    UINT64* words;
+    UINT nblocks;
+    UINT k;                 // bits set per key
+} Bloom;
+
+// filter for nkeys keys in at most max_bytes, at least one block
+void bloom_init(Bloom* bf, UINT nkeys, UINT max_bytes);
+void bloom_free(Bloom* bf);
+
+void bloom_add(Bloom* bf, INT key);
+UINT bloom_test(const Bloom* bf, INT key);
+
+// bit t of bitmap is set when attribute idx of tuple t may be in the filter,
+// as filter_page() for a predicate. returns the number of bits set
+UINT bloom_page(const Bloom* bf, const INT* data, UINT ntuples, UINT nattrs, UINT idx, UINT64* bitmap);
+
+#endif
@@ -5,8 +5,11 @@
 // #include <dirent.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <fcntl.h>
 #include <ctype.h>
+#include <assert.h>
 #include "db.h"
+#include "sched.h"
 
 Conf* cf = NULL;
 Database* db = NULL;
@@ -16,10 +19,98 @@ Conf* init_conf(const UINT page_size, const UINT buf_slots, const UINT file_limi
     cf->page_size = page_size;
     cf->buf_slots = buf_slots;
     cf->file_limit = file_limit;
-    strcpy(cf->buf_policy,buf_policy);
+    strncpy(cf->buf_policy,buf_policy,sizeof(cf->buf_policy)-1);
+    cf->buf_policy[sizeof(cf->buf_policy)-1] = '\0';
+    cf->read_io = 0;
+    cf->write_io = 0;
+    cf->file_opens = 0;
+    cf->file_closes = 0;
+    cf->join_algo = JOIN_AUTO;
+    cf->prefetch_depth = 0;
+    cf->prefetch_io = PREFETCH_AUTO;
+    cf->io_threads = 4;
+    cf->storage = STORAGE_PREAD;
+    cf->threads = 1;
+    cf->sessions = 1;
+    cf->load_threads = 0;
+    cf->startup = STARTUP_LOAD;
+    cf->zonemaps = 0;
+    cf->bloom = 0;
+    cf->prefetch_hits = 0;
+    cf->prefetch_wasted = 0;
+    cf->pages_skipped = 0;
     return cf;
 }
 
+// index of value in names, -1 if it is not there
+static INT choose(const char* value, const char** names, UINT nnames){
+    for (UINT i = 0; i < nnames; i++){
+        if (strcmp(value,names[i]) == 0) return i;
+    }
+    return -1;
+}
+
+INT set_option(const char* arg){
+    char name[50];
+    char value[50];
+    if (sscanf(arg,"%49[^=]=%49s",name,value) != 2) return 0;
+
+    if (strcmp(name,"join") == 0){
+        // join=auto|nl|sm|hash|index
+        static const char* algos[] = { "auto", "nl", "sm", "hash", "index" };
+        INT i = choose(value,algos,sizeof(algos)/sizeof(algos[0]));
+        if (i < 0) return 0;
+        cf->join_algo = i;
+        return 1;
+    }
+    if (strcmp(name,"prefetch") == 0) return sscanf(value,"%u",&cf->prefetch_depth) == 1;
+    if (strcmp(name,"prefetch_io") == 0){
+        // prefetch_io=auto|uring|threads
+        static const char* ios[] = { "auto", "uring", "threads" };
+        INT i = choose(value,ios,sizeof(ios)/sizeof(ios[0]));
+        if (i < 0) return 0;
+        cf->prefetch_io = i;
+        return 1;
+    }
+    if (strcmp(name,"storage") == 0){
+        // storage=pread|mmap
+        static const char* modes[] = { "pread", "mmap" };
+        INT i = choose(value,modes,sizeof(modes)/sizeof(modes[0]));
+        if (i < 0) return 0;
+        cf->storage = i;
+        return 1;
+    }
+    if (strcmp(name,"zonemaps") == 0){
+        // zonemaps=off|on
+        static const char* modes[] = { "off", "on" };
+        INT i = choose(value,modes,sizeof(modes)/sizeof(modes[0]));
+        if (i < 0) return 0;
+        cf->zonemaps = i;
+        return 1;
+    }
+    if (strcmp(name,"bloom") == 0){
+        // bloom=off|on
+        static const char* modes[] = { "off", "on" };
+        INT i = choose(value,modes,sizeof(modes)/sizeof(modes[0]));
+        if (i < 0) return 0;
+        cf->bloom = i;
+        return 1;
+    }
+    if (strcmp(name,"startup") == 0){
+        // startup=load|open|auto
+        static const char* modes[] = { "load", "open", "auto" };
+        INT i = choose(value,modes,sizeof(modes)/sizeof(modes[0]));
+        if (i < 0) return 0;
+        cf->startup = i;
+        return 1;
+    }
+    if (strcmp(name,"sessions") == 0) return sscanf(value,"%u",&cf->sessions) == 1 && cf->sessions > 0;
+    if (strcmp(name,"threads") == 0) return sscanf(value,"%u",&cf->threads) == 1 && cf->threads > 0;
+    if (strcmp(name,"load_threads") == 0) return sscanf(value,"%u",&cf->load_threads) == 1;
+    if (strcmp(name,"io_threads") == 0) return sscanf(value,"%u",&cf->io_threads) == 1 && cf->io_threads > 0;
+    return 0;
+}
+
 void free_conf(){
     free(cf);
 }
@@ -37,7 +128,369 @@ void free_db(){
 }
 
 
+// lines of the input file between two offsets, read LOAD_BLOCK_BYTES at a
+// time with pread(). a line longer than the block grows it
+typedef struct LineReader {
+    INT fd;
+    off_t offset;           // file offset of block[0]
+    off_t end;              // offset to stop at
+    char* block;
+    size_t size;            // capacity of block, one more byte for a '\0'
+    size_t nbytes;          // bytes in block
+    size_t pos;             // start of the next line in block
+} LineReader;
+
+static void reader_open(LineReader* r, INT fd, off_t start, off_t end){
+    r->fd = fd;
+    r->offset = start;
+    r->end = end;
+    r->size = LOAD_BLOCK_BYTES;
+    r->block = malloc(r->size + 1);
+    r->nbytes = 0;
+    r->pos = 0;
+}
+
+// next line in [*line, *line_end), starting at file offset *at. the byte at
+// *line_end may be overwritten. returns 0 after the last line
+static UINT reader_next(LineReader* r, char** line, char** line_end, off_t* at){
+    while (1){
+        char* begin = r->block + r->pos;
+        char* nl = memchr(begin, '\n', r->nbytes - r->pos);
+        if (nl == NULL && r->offset + (off_t)r->nbytes < r->end){
+            // move the partial line to the front, grow the block if the
+            // line fills it, and read more
+            memmove(r->block, begin, r->nbytes - r->pos);
+            r->offset += r->pos;
+            r->nbytes -= r->pos;
+            r->pos = 0;
+            if (r->nbytes == r->size){
+                r->size *= 2;
+                r->block = realloc(r->block, r->size + 1);
+            }
+            size_t want = r->size - r->nbytes;
+            if ((off_t)want > r->end - r->offset - (off_t)r->nbytes) want = r->end - r->offset - r->nbytes;
+            ssize_t n = pread(r->fd, r->block + r->nbytes, want, r->offset + r->nbytes);
+            if (n < 0){
+                perror("Fail to read the input data file");
+                exit(-1);
+            }
+            // the file ends early
+            if (n == 0) r->end = r->offset + r->nbytes;
+            r->nbytes += n;
+            continue;
+        }
+        if (nl == NULL){
+            // the last line may have no newline
+            if (r->pos == r->nbytes) return 0;
+            nl = r->block + r->nbytes;
+        }
+        *line = begin;
+        *line_end = nl;
+        *at = r->offset + r->pos;
+        r->pos = nl - r->block + (nl < r->block + r->nbytes);
+        return 1;
+    }
+}
+
+static void reader_close(LineReader* r){
+    free(r->block);
+}
+
+// pages of a table being loaded from one chunk, assembled in memory and
+// written a batch at a time, with the (min, max) pairs of each page for its
+// zone map. chunks start on a page, so workers never share one
+typedef struct TableWriter {
+    INT fd;
+    INT zone_fd;
+    UINT nattrs;
+    UINT ntuples_per_page;
+    UINT page_size;
+    UINT batch_pages;       // pages per batch
+    UINT nbatch;            // pages started in the batch
+    UINT ntuples;           // tuples on the last page of the batch
+    UINT64 page_id;         // id of the first page of the batch
+    INT8* batch;
+    INT* zones;             // 2 * nattrs INTs per page of the batch
+} TableWriter;
+
+// write n bytes at offset of fd, exits when the disk refuses them
+static void write_all(INT fd, const void* buf, size_t n, off_t offset){
+    const INT8* p = buf;
+    while (n > 0){
+        ssize_t w = pwrite(fd, p, n, offset);
+        if (w < 0){
+            perror("Fail to write the database");
+            exit(-1);
+        }
+        p += w;
+        n -= w;
+        offset += w;
+    }
+}
+
+static void writer_open(TableWriter* w, INT fd, INT zone_fd, const Table* t, UINT64 first_page){
+    w->fd = fd;
+    w->zone_fd = zone_fd;
+    w->nattrs = t->nattrs;
+    w->page_size = cf->page_size;
+    w->ntuples_per_page = (cf->page_size - sizeof(UINT64)) / sizeof(INT) / t->nattrs;
+    w->batch_pages = LOAD_BATCH_BYTES / cf->page_size;
+    if (w->batch_pages == 0) w->batch_pages = 1;
+    w->nbatch = 0;
+    w->ntuples = 0;
+    w->page_id = first_page;
+    w->batch = malloc((size_t)w->batch_pages * w->page_size);
+    w->zones = malloc(sizeof(INT) * 2 * t->nattrs * w->batch_pages);
+}
+
+// write the pages of the batch at their place in the files
+static void writer_flush(TableWriter* w){
+    if (w->nbatch == 0) return;
+    size_t zone_bytes = sizeof(INT) * 2 * w->nattrs;
+    write_all(w->fd, w->batch, (size_t)w->nbatch * w->page_size, (off_t)w->page_id * w->page_size);
+    write_all(w->zone_fd, w->zones, zone_bytes * w->nbatch, (off_t)w->page_id * zone_bytes);
+    w->page_id += w->nbatch;
+    w->nbatch = 0;
+}
+
+// append a tuple, the first tuple of a page sets its (min, max) pairs
+static void writer_tuple(TableWriter* w, const INT* tuple){
+    if (w->nbatch == 0 || w->ntuples == w->ntuples_per_page){
+        if (w->nbatch == w->batch_pages) writer_flush(w);
+        INT8* page = w->batch + (size_t)w->nbatch * w->page_size;
+        UINT64 pid = w->page_id + w->nbatch;
+        memset(page, 0, w->page_size);
+        memcpy(page, &pid, sizeof(UINT64));
+        ++w->nbatch;
+        w->ntuples = 0;
+    }
+    INT8* page = w->batch + (size_t)(w->nbatch - 1) * w->page_size;
+    memcpy(page + sizeof(UINT64) + sizeof(INT) * w->nattrs * w->ntuples, tuple, sizeof(INT) * w->nattrs);
+    INT* zone = w->zones + 2 * w->nattrs * (w->nbatch - 1);
+    for (UINT j = 0; j < w->nattrs; ++j){
+        if (w->ntuples == 0 || tuple[j] < zone[2*j]) zone[2*j] = tuple[j];
+        if (w->ntuples == 0 || tuple[j] > zone[2*j+1]) zone[2*j+1] = tuple[j];
+    }
+    ++w->ntuples;
+}
+
+static void writer_close(TableWriter* w){
+    writer_flush(w);
+    free(w->batch);
+    free(w->zones);
+}
+
+// parse the attributes of a tuple line [p, end) into tuple, at most nattrs of
+// them, missing ones are 0. tokens that are not numbers are skipped
+static void parse_tuple(const char* p, const char* end, INT* tuple, UINT nattrs){
+    UINT j = 0;
+    while (p < end && j < nattrs){
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) ++p;
+        if (p == end) break;
+        UINT neg = *p == '-';
+        const char* digits = p + neg;
+        const char* q = digits;
+        UINT64 v = 0;
+        while (q < end && (UINT)(*q - '0') < 10) v = v * 10 + (*q++ - '0');
+        if (q > digits && (q == end || *q == ' ' || *q == '\t' || *q == '\r')) tuple[j++] = neg ? (INT)-v : (INT)v;
+        else while (q < end && *q != ' ' && *q != '\t' && *q != '\r') ++q;
+        p = q;
+    }
+    for (; j < nattrs; ++j) tuple[j] = 0;
+}
+
+// lines of the input file with pages first_page.. of a table
+typedef struct LoadChunk {
+    UINT table;             // index in db->tables
+    UINT64 first_page;
+    UINT ntuples;
+    off_t start;            // file offset of the first tuple line
+    off_t end;              // file offset past the last one
+} LoadChunk;
+
+typedef struct LoadJob {
+    INT input_fd;
+    LoadChunk* chunks;
+    INT* fds;               // table and zone map file of each table
+} LoadJob;
+
+static void load_chunk(void* arg, UINT c, UINT worker){
+    (void)worker;
+    LoadJob* job = arg;
+    const LoadChunk* chunk = &job->chunks[c];
+    const Table* t = &db->tables[chunk->table];
+    INT tuple[t->nattrs];
+    TableWriter w;
+    writer_open(&w, job->fds[2*chunk->table], job->fds[2*chunk->table+1], t, chunk->first_page);
+
+    LineReader r;
+    reader_open(&r, job->input_fd, chunk->start, chunk->end);
+    char* line;
+    char* end;
+    off_t at;
+    UINT ntuples = 0;
+    while (reader_next(&r, &line, &end, &at)){
+        // the chunk only holds tuples, comments and empty lines
+        if (!isdigit(line[0]) && line[0] != '-') continue;
+        parse_tuple(line, end, tuple, t->nattrs);
+        writer_tuple(&w, tuple);
+        ++ntuples;
+    }
+    reader_close(&r);
+    writer_close(&w);
+    assert(ntuples == chunk->ntuples);
+}
+
+// catalog file
+// a header, then one entry per table. written to "catalog.tmp", synced and
+// renamed, then the folder is synced, so a crash during the write leaves the
+// old catalog or none. a table's first page id is not kept, the readers
+// take it from the table file
+typedef struct CatalogHeader {
+    char magic[8];          // CATALOG_MAGIC
+    UINT version;
+    UINT page_size;
+    UINT ntables;
+    UINT pad;
+    UINT64 input_size;      // the input data file the tables were loaded from
+    UINT64 input_mtime;
+    char input_path[200];
+} CatalogHeader;
+
+typedef struct CatalogEntry {
+    UINT oid;
+    UINT nattrs;
+    UINT ntuples;
+    char name[16];
+} CatalogEntry;
+
+// input stamp of the catalog, kept to write it again after changes
+static CatalogHeader catalog;
+
+void save_catalog(){
+    catalog.ntables = db->ntables;
+    char path[200], tmp_path[200];
+    sprintf(path, "%s/catalog", db->path);
+    sprintf(tmp_path, "%s/catalog.tmp", db->path);
+    FILE* fp = fopen(tmp_path, "wb");
+    if (fp == NULL){
+        perror("Fail to write the catalog");
+        exit(-1);
+    }
+    fwrite(&catalog, sizeof(catalog), 1, fp);
+    for (UINT i = 0; i < db->ntables; ++i){
+        const Table* t = &db->tables[i];
+        CatalogEntry e;
+        memset(&e, 0, sizeof(e));
+        e.oid = t->oid;
+        e.nattrs = t->nattrs;
+        e.ntuples = t->ntuples;
+        strncpy(e.name, t->name, sizeof(e.name) - 1);
+        fwrite(&e, sizeof(e), 1, fp);
+    }
+    if (fflush(fp) != 0 || fsync(fileno(fp)) != 0){
+        perror("Fail to write the catalog");
+        exit(-1);
+    }
+    fclose(fp);
+    if (rename(tmp_path, path) != 0){
+        perror("Fail to write the catalog");
+        exit(-1);
+    }
+    // the rename is only durable once the folder is synced
+    INT dir = open(db->path, O_RDONLY | O_DIRECTORY);
+    if (dir < 0 || fsync(dir) != 0){
+        perror("Fail to write the catalog");
+        exit(-1);
+    }
+    close(dir);
+}
+
+static void write_catalog(const char* input_data_path, const struct stat* input){
+    memset(&catalog, 0, sizeof(catalog));
+    memcpy(catalog.magic, CATALOG_MAGIC, sizeof(catalog.magic));
+    catalog.version = CATALOG_VERSION;
+    catalog.page_size = cf->page_size;
+    catalog.input_size = input->st_size;
+    catalog.input_mtime = input->st_mtime;
+    strncpy(catalog.input_path, input_data_path, sizeof(catalog.input_path) - 1);
+    save_catalog();
+}
+
+Database* open_db(char* input_data_path, char* data_path, UINT check_input){
+    char path[200];
+    sprintf(path, "%s/catalog", data_path);
+    FILE* fp = fopen(path, "rb");
+    if (fp == NULL){
+        printf("No catalog in %s.\n", data_path);
+        return NULL;
+    }
+
+    CatalogHeader h;
+    if (fread(&h, sizeof(h), 1, fp) != 1 || memcmp(h.magic, CATALOG_MAGIC, sizeof(h.magic)) != 0 || h.version != CATALOG_VERSION){
+        printf("%s is not a catalog of this version.\n", path);
+        fclose(fp);
+        return NULL;
+    }
+    if (h.page_size != cf->page_size){
+        printf("The catalog is for %u byte pages.\n", h.page_size);
+        fclose(fp);
+        return NULL;
+    }
+    if (check_input){
+        struct stat st;
+        h.input_path[sizeof(h.input_path) - 1] = '\0';
+        if (stat(input_data_path, &st) != 0 || strcmp(h.input_path, input_data_path) != 0
+            || (UINT64)st.st_size != h.input_size || (UINT64)st.st_mtime != h.input_mtime){
+            printf("The catalog was written from another input.\n");
+            fclose(fp);
+            return NULL;
+        }
+    }
+
+    Database* d = malloc(sizeof(Database) + h.ntables * sizeof(Table));
+    d->ntables = h.ntables;
+    strcpy(d->path, data_path);
+    for (UINT i = 0; i < h.ntables; ++i){
+        CatalogEntry e;
+        Table* t = &d->tables[i];
+        if (fread(&e, sizeof(e), 1, fp) != 1){
+            printf("The catalog is truncated.\n");
+            free(d);
+            fclose(fp);
+            return NULL;
+        }
+        t->oid = e.oid;
+        t->nattrs = e.nattrs;
+        t->ntuples = e.ntuples;
+        memcpy(t->name, e.name, sizeof(t->name));
+        t->name[sizeof(t->name) - 1] = '\0';
+
+        // the table file must hold the pages of the tuples
+        UINT ntuples_per_page = (cf->page_size - sizeof(UINT64)) / sizeof(INT) / t->nattrs;
+        UINT64 npages = (t->ntuples + ntuples_per_page - 1) / ntuples_per_page;
+        struct stat st;
+        sprintf(path, "%s/%u", data_path, t->oid);
+        if (stat(path, &st) != 0 || (UINT64)st.st_size != npages * cf->page_size){
+            printf("Table file %s does not match the catalog.\n", path);
+            free(d);
+            fclose(fp);
+            return NULL;
+        }
+    }
+    fclose(fp);
+
+    catalog = h;
+    db = d;
+    printf("Opened %s from its catalog, %u tables.\n", data_path, db->ntables);
+    return db;
+}
+
 // build database
+// the first pass reads the input once, parses the meta lines and cuts the
+// tuple lines of each table into chunks of whole pages. the second pass
+// parses the chunks on a work-stealing pool, each worker writing the pages
+// of its chunk at their place in the table file
 Database* init_db(char* input_data_path, char* data_path){
     
     
@@ -53,36 +506,54 @@ Database* init_db(char* input_data_path, char* data_path){
 
     
     // open the input data file
-    FILE* input_fp = fopen(input_data_path,"r");
+    INT input_fd = open(input_data_path,O_RDONLY);
     printf("Input data path:%s\n",input_data_path);
-    if (input_fp == NULL){
+    if (input_fd < 0 || fstat(input_fd, &st) != 0){
         perror("Fail to open the input data file.\n");
         exit(-1);
     }
 
-
-
-    // file pointer to write tuples 
-    FILE* table_fp = NULL;
-
-    
-    
-    
+    LoadChunk* chunks = NULL;
+    UINT nchunks = 0, chunks_size = 0;
+    UINT ntuples_per_page = 0;      // of the current table
+    UINT chunk_tuples = 0;          // tuples per chunk of the current table, whole pages
     INT table_idx = -1;
-    INT ntuples_per_page = 0;
-    INT nbytes_free = 0;
-
-    INT processed_ntuples = 0;
-
-    UINT64 page_id = 0;
-    Table t;
-    
-    char line[100];
-    while(fgets(line,100,input_fp)){
+    Table* t = NULL;
+
+    LineReader r;
+    reader_open(&r, input_fd, 0, st.st_size);
+    char* line;
+    char* end;
+    off_t at;
+    while (reader_next(&r, &line, &end, &at)){
         
         // lines to write comments
         if(line[0] == '#') continue;
+
+        // tuples may start with a negative value
+        if(isdigit(line[0]) || line[0] == '-'){
+            if (t == NULL) continue;
+            if (t->ntuples % chunk_tuples == 0){
+                // a new chunk starts on a page boundary
+                if (nchunks > 0 && chunks[nchunks-1].table == (UINT)table_idx) chunks[nchunks-1].end = at;
+                if (nchunks == chunks_size){
+                    chunks_size = chunks_size ? 2 * chunks_size : 16;
+                    chunks = realloc(chunks, sizeof(LoadChunk) * chunks_size);
+                }
+                LoadChunk* c = &chunks[nchunks++];
+                c->table = table_idx;
+                c->first_page = t->ntuples / ntuples_per_page;
+                c->ntuples = 0;
+                c->start = at;
+            }
+            ++chunks[nchunks-1].ntuples;
+            ++t->ntuples;
+            continue;
+        }
         
+        // meta lines are short, parse them as strings
+        *end = '\0';
+
         // line for database meta info
         if(line[0] == 'd'){
             UINT ntables;
@@ -91,148 +562,142 @@ Database* init_db(char* input_data_path, char* data_path){
             // get number of tables
             sscanf(line,"%s %d",desc,&ntables);
 
-            
-            
             // initialize Database instance
             db = malloc(sizeof(Database)+ntables*sizeof(Table));
             db->ntables = ntables;
             strcpy(db->path,data_path);
-
-            // printf("data path: %s\n",db->path);
-            
-            
             continue;
         }
 
         // line for table meta info
         if(line[0] == 't'){
 
-            ++table_idx;
-
-            // close the old one if exists
-            if(table_idx > 0){
-                // the current table is not the first
-
-                if(processed_ntuples != 0){
-                    // the last page is not full
-                    // add 0 to the end
-                    INT8 f = 0;
-                    UINT left_space = sizeof(INT)*t.nattrs*(ntuples_per_page-processed_ntuples)+nbytes_free;
-                    
-                    for (UINT i = 0; i < left_space; i++) fwrite(&f,sizeof(INT8),1,table_fp);
-                
-
-                    processed_ntuples = 0;
-                }
-                
-                fclose(table_fp);
-
-            }
-
-
+            // the last chunk of the previous table ends here
+            if (nchunks > 0 && chunks[nchunks-1].table == (UINT)table_idx) chunks[nchunks-1].end = at;
 
+            ++table_idx;
+            assert(db != NULL && table_idx < (INT)db->ntables);
             char desc[50];
 
-            // initialzie a table instance
-            // Table t;
-            sscanf(line,"%s %u %s %u",desc,&t.oid,t.name,&t.nattrs);
-            t.ntuples = 0;
-            
-            
-            // add the table pointer to the DB instance
-            db->tables[table_idx] = t;
-
-
-            
-            // produce table file path
-            char table_path[200];
-            sprintf(table_path,"%s/%u",db->path,t.oid);
-            // open file pointer for the table
-            table_fp = fopen(table_path,"wb");
-            
+            // initialize a table instance
+            t = &db->tables[table_idx];
+            sscanf(line,"%s %u %s %u",desc,&t->oid,t->name,&t->nattrs);
+            t->ntuples = 0;
 
-            // reset page id
-            page_id = 0;
-            
-            
-            // calculate number of tuples per page
-            ntuples_per_page = (cf->page_size-sizeof(UINT64))/sizeof(INT)/t.nattrs;
-            nbytes_free = (cf->page_size-sizeof(UINT64)) % (sizeof(INT)*t.nattrs);
-            // printf("ntuples = %u, free bytes = %u\n",ntuples_per_page,nbytes_free);
-
-            processed_ntuples = 0;
-            
+            ntuples_per_page = (cf->page_size - sizeof(UINT64)) / sizeof(INT) / t->nattrs;
+            assert(ntuples_per_page > 0);
+            UINT chunk_pages = LOAD_CHUNK_BYTES / cf->page_size;
+            if (chunk_pages == 0) chunk_pages = 1;
+            chunk_tuples = chunk_pages * ntuples_per_page;
             continue;
         }
         // skip empty lines
-        if(!isdigit(line[0])) continue;
-
-        // we are processing the first tuple for a page
-        if(processed_ntuples == 0){
-            // write a page id to the file
-            fwrite(&page_id,sizeof(UINT64),1,table_fp);
-            ++page_id;
+    }
+    if (nchunks > 0 && chunks[nchunks-1].table == (UINT)table_idx) chunks[nchunks-1].end = st.st_size;
+    reader_close(&r);
+    // tables the input names but does not describe stay empty
+    if (db != NULL) db->ntables = table_idx + 1;
+
+    // the table file and its zone map, empty tables get empty ones
+    UINT ntables = db != NULL ? db->ntables : 0;
+    INT* fds = malloc(sizeof(INT) * 2 * (ntables + 1));
+    for (UINT i = 0; i < ntables; ++i){
+        char path[200];
+        sprintf(path, "%s/%u", db->path, db->tables[i].oid);
+        fds[2*i] = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        sprintf(path, "%s/%u.zm", db->path, db->tables[i].oid);
+        fds[2*i+1] = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if (fds[2*i] < 0 || fds[2*i+1] < 0){
+            perror("Fail to create a table file");
+            exit(-1);
         }
-        ++processed_ntuples;
-        ++db->tables[table_idx].ntuples;
-        // printf("processed tuples = %u, tuples per page = %u\n",processed_ntuples,ntuples_per_page);
+    }
 
+    UINT nworkers = cf->load_threads;
+    if (nworkers == 0) nworkers = sysconf(_SC_NPROCESSORS_ONLN);
+    LoadJob job = { input_fd, chunks, fds };
+    parallel_for(nworkers, nchunks, load_chunk, &job);
 
-        // write tuple to file
-        // assume each table has only one file
-        
-        char* token = strtok(line," ");
-        
-        INT attr;
-        while(token != NULL){
-            
-            // read each attribute and write it to the hard drive
-            sscanf(token,"%d",&attr);
-            
-            fwrite(&attr,sizeof(INT),1,table_fp);
-            
-            token = strtok(NULL," ");
-        }
+    for (UINT i = 0; i < 2 * ntables; ++i) close(fds[i]);
+    free(fds);
+    free(chunks);
+    close(input_fd);
 
-        
-        
-        // when the derived number of tuples reaches the maximum number of tuples per page
-        // we add 0 to the end if necessary
-        if(processed_ntuples == ntuples_per_page){
-            INT8 f = 0;
-            for (UINT i = 0; i < nbytes_free; i++) fwrite(&f,sizeof(INT8),1,table_fp);
-            processed_ntuples = 0;
+    if (db != NULL) write_catalog(input_data_path, &st);
+    return db;
+}
 
-        }
-        
+_Table* new_result(UINT nattrs){
+    _Table* t = malloc(sizeof(_Table));
+    t->nattrs = nattrs;
+    t->ntuples = 0;
+    t->nchunks = 0;
+    t->head = NULL;
+    t->tail = NULL;
+    return t;
+}
 
+INT* append_tuple(_Table* t){
+    TupleChunk* c = t->tail;
+    if (c == NULL || c->ntuples == c->cap){
+        // each chunk is twice the previous one until CHUNK_MAX_BYTES
+        UINT max_cap = CHUNK_MAX_BYTES / sizeof(INT) / (t->nattrs ? t->nattrs : 1);
+        UINT cap = c == NULL ? CHUNK_MIN_TUPLES : c->cap * 2;
+        if (cap > max_cap) cap = max_cap;
+        if (cap == 0) cap = 1;
+
+        TupleChunk* chunk = malloc(sizeof(TupleChunk) + sizeof(INT) * (size_t)cap * t->nattrs);
+        chunk->next = NULL;
+        chunk->ntuples = 0;
+        chunk->cap = cap;
+        if (c == NULL) t->head = chunk;
+        else c->next = chunk;
+        t->tail = chunk;
+        ++t->nchunks;
+        c = chunk;
     }
+    ++t->ntuples;
+    return c->data + (size_t)c->ntuples++ * t->nattrs;
+}
 
-    if(processed_ntuples != 0){
-        // the last page is not full
-        // add 0 to the end
-        INT8 f = 0;
-        UINT left_space = sizeof(INT)*t.nattrs*(ntuples_per_page-processed_ntuples)+nbytes_free;
-        for (UINT i = 0; i < left_space; i++) fwrite(&f,sizeof(INT8),1,table_fp);
-        processed_ntuples = 0;
+void concat_result(_Table* t, _Table* src){
+    assert(t->nattrs == src->nattrs);
+    if (src->head != NULL){
+        if (t->tail == NULL) t->head = src->head;
+        else t->tail->next = src->head;
+        t->tail = src->tail;
+        t->ntuples += src->ntuples;
+        t->nchunks += src->nchunks;
     }
-    
-    fclose(table_fp);
-    fclose(input_fp);
+    free(src);
+}
 
-    return db;
+void free_result(_Table* t){
+    if (t == NULL) return;
+    TupleChunk* c = t->head;
+    while (c != NULL){
+        TupleChunk* next = c->next;
+        free(c);
+        c = next;
+    }
+    free(t);
 }
 
 void reset_IO(){
     cf->read_io = 0;
     cf->write_io = 0;
+    cf->file_opens = 0;
+    cf->file_closes = 0;
+    cf->prefetch_hits = 0;
+    cf->prefetch_wasted = 0;
+    cf->pages_skipped = 0;
 }
 
 void log_read_page(UINT64 pid){
     // the following print info is for testing
     // comment it out to avoid too much output in terminal when developing
     // printf("Read page %llu\n",pid);
-    cf->read_io ++;
+    __atomic_add_fetch(&cf->read_io, 1, __ATOMIC_RELAXED);    // pages are read by concurrent sessions
 }
 void log_release_page(UINT64 pid){
     // the following print info is for testing
@@ -241,13 +706,22 @@ void log_release_page(UINT64 pid){
 
 }
 
+void log_write_page(UINT64 pid){
+    // the following print info is for testing
+    // comment it out to avoid too much output in terminal when developing
+    // printf("Write page %llu\n",pid);
+    __atomic_add_fetch(&cf->write_io, 1, __ATOMIC_RELAXED);
+}
+
 void log_open_file(UINT oid){
     // the following print info is for testing
     // comment it out to avoid too much output in terminal when developing
     // printf("Open file %u\n",oid);
+    cf->file_opens ++;
 }
 void log_close_file(UINT oid){
     // the following print info is for testing
     // comment it out to avoid too much output in terminal when developing
     // printf("Close file %u\n",oid);
+    cf->file_closes ++;
 }
\ No newline at end of file
@@ -12,11 +12,30 @@
 
 #define Tuple INT*
 
+#define CHUNK_MIN_TUPLES 64         // capacity of the first chunk of a result
+#define CHUNK_MAX_BYTES (1 << 20)   // chunks double in size up to this
+#define LOAD_BLOCK_BYTES (1 << 20)  // init_db() reads the input in blocks of this size
+#define LOAD_BATCH_BYTES (1 << 20)  // and writes the pages of a table in batches of this size
+#define LOAD_CHUNK_BYTES (1 << 22)  // pages of a table loaded by one worker
+
+// a batch of result tuples stored row-major, attribute j of tuple i
+// is data[i*nattrs+j]
+typedef struct TupleChunk{
+    struct TupleChunk* next;
+    UINT ntuples;
+    UINT cap;
+    INT data[];
+} TupleChunk;
+
 // returned data type by relational operators
+// the tuples live in a chain of chunks, walk them with
+//     for (TupleChunk* c = t->head; c != NULL; c = c->next)
 typedef struct _Table{
     UINT nattrs;
     UINT ntuples;
-    Tuple tuples[];
+    UINT nchunks;
+    TupleChunk* head;
+    TupleChunk* tail;
 } _Table;
 
 // internal table meta information
@@ -34,6 +53,30 @@ typedef struct Database {
     Table tables[];
 } Database;
 
+// join strategies for Conf.join_algo
+#define JOIN_AUTO 0         // cheapest by estimated page I/O
+#define JOIN_NESTED_LOOP 1
+#define JOIN_SORT_MERGE 2
+#define JOIN_HASH 3
+#define JOIN_INDEX 4        // index nested loop, needs an index on a join attribute
+
+// read-ahead backends for Conf.prefetch_io
+#define PREFETCH_AUTO 0     // io_uring if the kernel allows it, else threads
+#define PREFETCH_URING 1
+#define PREFETCH_THREADS 2
+
+// table file access for Conf.storage
+#define STORAGE_PREAD 0     // pages are read into the buffer frames
+#define STORAGE_MMAP 1      // table pages are used in place in a read-only mapping
+
+// how main() gets the database for Conf.startup
+#define STARTUP_LOAD 0      // load the input data
+#define STARTUP_OPEN 1      // open the database folder from its catalog
+#define STARTUP_AUTO 2      // open it if the catalog was written from the same input, else load
+
+#define CATALOG_MAGIC "DBMSCAT1"
+#define CATALOG_VERSION 2
+
 // system configuration
 typedef struct Conf{
     UINT read_io;
@@ -41,7 +84,25 @@ typedef struct Conf{
     UINT page_size;
     UINT buf_slots;
     UINT file_limit;
-    char buf_policy[4];
+    char buf_policy[8];
+    // options given as name=value after the positional arguments
+    UINT join_algo;
+    UINT prefetch_depth;    // pages read ahead of a sequential scan, 0 for none
+    UINT prefetch_io;
+    UINT io_threads;        // workers of the thread pool backend
+    UINT storage;
+    UINT threads;           // workers of a parallel sel()
+    UINT sessions;          // queries run concurrently by run()
+    UINT load_threads;      // workers of init_db(), 0 for one per cpu
+    UINT startup;
+    UINT zonemaps;          // skip pages by their per-page min/max
+    UINT bloom;             // semi-join reduction of join() inputs
+    UINT file_opens;        // files opened and closed since reset_IO()
+    UINT file_closes;
+    // read-ahead counters, reset with read_io
+    UINT prefetch_hits;     // prefetched pages requested afterwards
+    UINT prefetch_wasted;   // prefetched pages evicted before any request
+    UINT pages_skipped;     // pages ruled out by zone maps, reset with read_io
 } Conf;
 
 
@@ -51,18 +112,39 @@ typedef struct Conf{
 Conf* init_conf(const UINT page_size, const UINT buf_slots, const UINT file_limit, const char* buf_policy);
 void free_conf();
 Conf* get_conf();
+// set an option from a "name=value" argument, returns 0 if it is unknown or invalid
+INT set_option(const char* arg);
 
+// load the input data into one page file per table, with a zone map sidecar.
+// the table boundaries are indexed first, then chunks of LOAD_CHUNK_BYTES
+// of pages are parsed and written by Conf.load_threads workers. the
+// catalog of the loaded tables is written to "<data_path>/catalog"
 Database* init_db(char* input_data_path, char* data_path);
+// open the database in data_path from its catalog without reading the input.
+// with check_input, only a catalog written from this input file (same path,
+// size and modification time) is used. returns NULL, and prints why, when
+// the catalog is missing, for another page size or its files do not fit it
+Database* open_db(char* input_data_path, char* data_path, UINT check_input);
+// write the catalog again with the current tuple counts, after the tables
+// were changed. the input it names stays the one they were loaded from
+void save_catalog();
 Database* get_db();
 void free_db();
 
+// result tables
+_Table* new_result(UINT nattrs);
+// space for one more tuple at the end of t
+INT* append_tuple(_Table* t);
+// move the tuples of src to the end of t and free src
+void concat_result(_Table* t, _Table* src);
+void free_result(_Table* t);
+
 void reset_IO();
 void log_read_page(UINT64 pid);
 void log_release_page(UINT64 pid);
 void log_open_file(UINT oid);
 void log_close_file(UINT oid);
-
-// void log_write_page(UINT64 pid);
+void log_write_page(UINT64 pid);
 
 
 #endif
\ No newline at end of file
@@ -0,0 +1,206 @@
+// insert, delete and update through the buffer pool
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <limits.h>
+#include "dml.h"
+#include "filter.h"
+#include "index.h"
+#include "zonemap.h"
+
+static UINT* changed = NULL;    // changed[i] if table i of the database was changed
+
+// release() has work to do for t
+static void table_changed(const Table* t){
+    Database* db = get_db();
+    if (changed == NULL) changed = calloc(db->ntables, sizeof(UINT));
+    changed[t - db->tables] = 1;
+}
+
+// zero the page after its first ntuples tuples, as init_db() leaves the
+// last page of a table, then update its zone map pairs and release it
+static void finish_page(const Rel* rel, UINT i, Page* page, UINT ntuples){
+    Conf* cf = get_conf();
+    UINT nints = (cf->page_size - sizeof(UINT64)) / sizeof(INT);
+    memset(page->data + ntuples * rel->nattrs, 0, sizeof(INT) * (nints - ntuples * rel->nattrs));
+    zone_map_update(rel->oid, i, page->data, ntuples);
+    release_page(page->pid, rel->oid);
+}
+
+UINT insert_tuple(Table* t, const INT* tup){
+    Rel rel = open_rel(t);
+    UINT i = t->ntuples / rel.ntuples_per_page;
+    UINT pos = t->ntuples % rel.ntuples_per_page;
+    UINT64 pid = rel.page_id_init + i;
+
+    // fill the padding of the last page, or start a new one when it is full
+    Page* page;
+    if (pos > 0){
+        page = get_page(t->oid, pid, rel.page_id_init);
+        mark_dirty(pid, t->oid);
+    } else {
+        page = new_page(t->oid, pid, rel.page_id_init);
+    }
+    memcpy(page->data + pos * t->nattrs, tup, sizeof(INT) * t->nattrs);
+    zone_map_update(t->oid, i, page->data, pos + 1);
+    release_page(pid, t->oid);
+
+    index_insert(t, tup, t->ntuples);
+    ++t->ntuples;
+    table_changed(t);
+    return i;
+}
+
+UINT delete_tuples(Table* t, UINT idx, UINT op, INT val, INT val2){
+    Conf* cf = get_conf();
+    assert(idx < t->nattrs);
+    Rel rel = open_rel(t);
+    UINT nattrs = rel.nattrs;
+    UINT per_page = rel.ntuples_per_page;
+    const ZoneMap* zm = zone_map(t->oid);
+
+    UINT64 match[FILTER_WORDS(per_page)];
+    UINT out = 0;           // tuples kept, the next kept one becomes tuple out
+    Page* dst = NULL;       // pinned dirty page of tuple out once tuples move
+    UINT dst_page = 0;
+    UINT skipped = 0;
+
+    for (UINT i = 0; i < rel.npages; ++i){
+        UINT n = rel_page_ntuples(&rel, i);
+        // until the first match nothing moves, so a page the zone map
+        // rules out stays as it is
+        if (out == i * per_page && !zone_match(zm, i, idx, op, val, val2)){
+            out += n;
+            ++skipped;
+            continue;
+        }
+
+        UINT64 pid = rel.page_id_init + i;
+        Page* src = get_page(t->oid, pid, rel.page_id_init);
+        filter_page(src->data, n, nattrs, idx, op, val, val2, match);
+        for (UINT k = 0; k < n; ++k){
+            if (match[k / 64] >> (k % 64) & 1) continue;
+            if (out == i * per_page + k){
+                // nothing deleted before it
+                ++out;
+                continue;
+            }
+            if (dst == NULL || out / per_page != dst_page){
+                if (dst != NULL) finish_page(&rel, dst_page, dst, per_page);
+                dst_page = out / per_page;
+                dst = get_page(t->oid, rel.page_id_init + dst_page, rel.page_id_init);
+                mark_dirty(dst->pid, t->oid);
+            }
+            // src is dst when the tuple moves within its page
+            memmove(dst->data + (out % per_page) * nattrs, src->data + k * nattrs, sizeof(INT) * nattrs);
+            ++out;
+        }
+        release_page(pid, t->oid);
+    }
+
+    UINT ndeleted = rel.ntuples - out;
+    if (ndeleted > 0){
+        // the tuples after the last kept one in its page were deleted
+        // without any kept tuple moving there
+        if (dst == NULL && out % per_page != 0){
+            dst_page = out / per_page;
+            dst = get_page(t->oid, rel.page_id_init + dst_page, rel.page_id_init);
+            mark_dirty(dst->pid, t->oid);
+        }
+        if (dst != NULL) finish_page(&rel, dst_page, dst, out - dst_page * per_page);
+
+        t->ntuples = out;
+        zone_map_truncate(t->oid, (out + per_page - 1) / per_page);
+        // tuple numbers moved
+        rebuild_indexes(t, UINT_MAX);
+        table_changed(t);
+    }
+    zone_skipped(skipped);
+    printf("delete from %s: %u tuples, %u pages left, read_io %u, write_io %u\n",
+           t->name, ndeleted, (out + per_page - 1) / per_page, cf->read_io, cf->write_io);
+    return ndeleted;
+}
+
+UINT update_tuples(Table* t, UINT set_idx, INT set_val, UINT idx, UINT op, INT val, INT val2){
+    Conf* cf = get_conf();
+    assert(set_idx < t->nattrs && idx < t->nattrs);
+    Rel rel = open_rel(t);
+    UINT nattrs = rel.nattrs;
+    const ZoneMap* zm = zone_map(t->oid);
+
+    UINT64 match[FILTER_WORDS(rel.ntuples_per_page)];
+    // positions and old values of the tuples changed in a page
+    UINT changed_pos[rel.ntuples_per_page];
+    INT old_val[rel.ntuples_per_page];
+    UINT nmatched = 0;
+    UINT ndirty = 0;
+    UINT skipped = 0;
+
+    for (UINT i = 0; i < rel.npages; ++i){
+        if (!zone_match(zm, i, idx, op, val, val2)){
+            ++skipped;
+            continue;
+        }
+        UINT n = rel_page_ntuples(&rel, i);
+        UINT64 pid = rel.page_id_init + i;
+        Page* page = get_page(t->oid, pid, rel.page_id_init);
+        filter_page(page->data, n, nattrs, idx, op, val, val2, match);
+
+        // a page whose matches already hold set_val stays clean
+        UINT dirty = 0;
+        UINT nchanged = 0;
+        for (UINT j = 0; j < FILTER_WORDS(n); ++j){
+            for (UINT64 w = match[j]; w != 0; w &= w - 1){
+                UINT k = j * 64 + __builtin_ctzll(w);
+                ++nmatched;
+                if (page->data[k * nattrs + set_idx] == set_val) continue;
+                if (!dirty) mark_dirty(pid, t->oid);
+                dirty = 1;
+                changed_pos[nchanged] = k;
+                old_val[nchanged++] = page->data[k * nattrs + set_idx];
+                page->data[k * nattrs + set_idx] = set_val;
+            }
+        }
+        if (dirty){
+            zone_map_update(t->oid, i, page->data, n);
+            ++ndirty;
+        }
+        release_page(pid, t->oid);
+
+        // tuple numbers do not move, so each changed tuple only moves its
+        // entries in the indexes on set_idx
+        for (UINT j = 0; j < nchanged; ++j)
+            index_update(t, set_idx, old_val[j], set_val, i * rel.ntuples_per_page + changed_pos[j]);
+    }
+
+    if (ndirty > 0) table_changed(t);
+    zone_skipped(skipped);
+    printf("update %s: %u tuples, %u pages dirtied, read_io %u, write_io %u\n",
+           t->name, nmatched, ndirty, cf->read_io, cf->write_io);
+    return nmatched;
+}
+
+void finish_writes(){
+    if (changed == NULL) return;
+    Conf* cf = get_conf();
+    Database* db = get_db();
+
+    // cut the pages a delete left past the end of a table
+    for (UINT i = 0; i < db->ntables; ++i){
+        if (!changed[i]) continue;
+        const Table* t = &db->tables[i];
+        UINT per_page = (cf->page_size - sizeof(UINT64)) / sizeof(INT) / t->nattrs;
+        UINT npages = (t->ntuples + per_page - 1) / per_page;
+        char path[200];
+        sprintf(path, "%s/%u", db->path, t->oid);
+        if (truncate(path, (off_t)npages * cf->page_size) != 0) perror("Fail to truncate a table file");
+    }
+    save_zone_maps();
+    save_catalog();
+
+    free(changed);
+    changed = NULL;
+}
@@ -0,0 +1,38 @@
+#ifndef DML_H
+#define DML_H
+#include "ro.h"
+
+// insert, delete and update on table files
+// tuples are changed in their pages through the buffer pool. a changed page
+// is marked dirty and written back when it is evicted or at release(), and
+// the write counts in write_io. the pages of a table stay full up to the
+// last one, so the tuple layout is the one init_db() writes:
+//     insert fills the zero padding after the last tuple of the last page
+//            and starts a new page when it is full
+//     delete moves the tuples after the deleted ones forward and zeroes
+//            the padding it leaves in the new last page
+//     update changes the matching tuples in place
+// insert adds the tuple to the table's indexes, update moves the entries of
+// the tuples it changes in the ones on the attribute it sets, and delete
+// builds all of them again, since tuples move. zone map pairs are kept up to
+// date.
+// pages past the end of a shrunken table stay in its file until release()
+// truncates it, then the zone maps and the catalog are written again.
+// not safe to run concurrently with queries on the same table
+
+// append tup, nattrs values, to t, returns the page it went to
+UINT insert_tuple(Table* t, const INT* tup);
+
+// remove the tuples of t with attribute idx <op> val (val2 for OP_BETWEEN),
+// returns how many were removed
+UINT delete_tuples(Table* t, UINT idx, UINT op, INT val, INT val2);
+
+// set attribute set_idx to set_val in the tuples of t with attribute
+// idx <op> val, returns how many matched
+UINT update_tuples(Table* t, UINT set_idx, INT set_val, UINT idx, UINT op, INT val, INT val2);
+
+// truncate the changed table files and save their zone maps and the
+// catalog, called by release() after the dirty pages are written back
+void finish_writes();
+
+#endif
@@ -0,0 +1,151 @@
+// vectorized predicate evaluation for page scans
+// the kernels compare one attribute of every tuple of a page (a strided
+// access over row-major tuples) and produce a match bitmap, sel() then
+// only materializes the tuples whose bit is set
+
+#include <string.h>
+#include <pthread.h>
+#include "filter.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FILTER_X86
+#endif
+
+static void filter_scalar(const INT* data, UINT ntuples, UINT nattrs, UINT idx, INT lo, INT hi, UINT negate, UINT64* bitmap){
+    memset(bitmap, 0, sizeof(UINT64) * FILTER_WORDS(ntuples));
+    const INT* col = data + idx;
+    for (UINT t = 0; t < ntuples; ++t){
+        INT x = col[(size_t)t * nattrs];
+        bitmap[t >> 6] |= (UINT64)((x >= lo && x <= hi) ^ negate) << (t & 63);
+    }
+}
+
+#ifdef FILTER_X86
+
+// in range unless x < lo or x > hi
+__attribute__((target("sse4.2")))
+static void filter_sse42(const INT* data, UINT ntuples, UINT nattrs, UINT idx, INT lo, INT hi, UINT negate, UINT64* bitmap){
+    memset(bitmap, 0, sizeof(UINT64) * FILTER_WORDS(ntuples));
+    const INT* col = data + idx;
+    const __m128i vlo = _mm_set1_epi32(lo);
+    const __m128i vhi = _mm_set1_epi32(hi);
+    const UINT64 flip = negate ? 0xf : 0;
+    UINT t = 0;
+
+    for (; t + 4 <= ntuples; t += 4){
+        const INT* p = col + (size_t)t * nattrs;
+        __m128i x = nattrs == 1 ? _mm_loadu_si128((const __m128i*)p)
+                                : _mm_set_epi32(p[3*nattrs], p[2*nattrs], p[nattrs], p[0]);
+        __m128i out = _mm_or_si128(_mm_cmpgt_epi32(vlo, x), _mm_cmpgt_epi32(x, vhi));
+        UINT64 mask = (UINT64)_mm_movemask_ps(_mm_castsi128_ps(out)) ^ 0xf ^ flip;
+        bitmap[t >> 6] |= mask << (t & 63);
+    }
+    for (; t < ntuples; ++t){
+        INT x = col[(size_t)t * nattrs];
+        bitmap[t >> 6] |= (UINT64)((x >= lo && x <= hi) ^ negate) << (t & 63);
+    }
+}
+
+__attribute__((target("avx2")))
+static void filter_avx2(const INT* data, UINT ntuples, UINT nattrs, UINT idx, INT lo, INT hi, UINT negate, UINT64* bitmap){
+    memset(bitmap, 0, sizeof(UINT64) * FILTER_WORDS(ntuples));
+    const INT* col = data + idx;
+    const __m256i vlo = _mm256_set1_epi32(lo);
+    const __m256i vhi = _mm256_set1_epi32(hi);
+    const __m256i stride = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(nattrs));
+    const UINT64 flip = negate ? 0xff : 0;
+    UINT t = 0;
+
+    for (; t + 8 <= ntuples; t += 8){
+        const INT* p = col + (size_t)t * nattrs;
+        __m256i x = nattrs == 1 ? _mm256_loadu_si256((const __m256i*)p)
+                                : _mm256_i32gather_epi32((const int*)p, stride, 4);
+        __m256i out = _mm256_or_si256(_mm256_cmpgt_epi32(vlo, x), _mm256_cmpgt_epi32(x, vhi));
+        UINT64 mask = (UINT64)_mm256_movemask_ps(_mm256_castsi256_ps(out)) ^ 0xff ^ flip;
+        bitmap[t >> 6] |= mask << (t & 63);
+    }
+    for (; t < ntuples; ++t){
+        INT x = col[(size_t)t * nattrs];
+        bitmap[t >> 6] |= (UINT64)((x >= lo && x <= hi) ^ negate) << (t & 63);
+    }
+}
+
+#endif
+
+FilterFn filter_kernel(const char* isa){
+    if (strcmp(isa, "scalar") == 0) return filter_scalar;
+#ifdef FILTER_X86
+    __builtin_cpu_init();
+    if (strcmp(isa, "sse4.2") == 0 && __builtin_cpu_supports("sse4.2")) return filter_sse42;
+    if (strcmp(isa, "avx2") == 0 && __builtin_cpu_supports("avx2")) return filter_avx2;
+#endif
+    return NULL;
+}
+
+// picked once, by the first of the threads scanning pages
+static FilterFn best = NULL;
+static const char* best_isa = NULL;
+static pthread_once_t picked = PTHREAD_ONCE_INIT;
+
+static void pick_kernel(){
+    static const char* isas[] = { "avx2", "sse4.2", "scalar" };
+    for (UINT i = 0; i < sizeof(isas) / sizeof(isas[0]); ++i){
+        FilterFn fn = filter_kernel(isas[i]);
+        if (fn != NULL){
+            best_isa = isas[i];
+            best = fn;
+            return;
+        }
+    }
+}
+
+UINT filter_range(UINT op, INT val, INT val2, INT* lo, INT* hi, UINT* negate){
+    *lo = INT32_MIN;
+    *hi = INT32_MAX;
+    *negate = 0;
+    switch (op){
+        case OP_EQ: *lo = val; *hi = val; break;
+        case OP_NE: *lo = val; *hi = val; *negate = 1; break;
+        case OP_LT: if (val == INT32_MIN) return 0; *hi = val - 1; break;
+        case OP_LE: *hi = val; break;
+        case OP_GT: if (val == INT32_MAX) return 0; *lo = val + 1; break;
+        case OP_GE: *lo = val; break;
+        case OP_BETWEEN: if (val > val2) return 0; *lo = val; *hi = val2; break;
+        default: return 0;
+    }
+    return 1;
+}
+
+void filter_page(const INT* data, UINT ntuples, UINT nattrs, UINT idx, UINT op, INT val, INT val2, UINT64* bitmap){
+    INT lo, hi;
+    UINT negate;
+    if (!filter_range(op, val, val2, &lo, &hi, &negate)){
+        memset(bitmap, 0, sizeof(UINT64) * FILTER_WORDS(ntuples));
+        return;
+    }
+    pthread_once(&picked, pick_kernel);
+    best(data, ntuples, nattrs, idx, lo, hi, negate, bitmap);
+}
+
+UINT filter_match(INT x, UINT op, INT val, INT val2){
+    INT lo, hi;
+    UINT negate;
+    if (!filter_range(op, val, val2, &lo, &hi, &negate)) return 0;
+    return (x >= lo && x <= hi) ^ negate;
+}
+
+INT filter_op(const char* name){
+    static const char* names[] = { "=", "!=", "<", "<=", ">", ">=", "BETWEEN" };
+    if (strcmp(name, "==") == 0) return OP_EQ;
+    if (strcmp(name, "between") == 0) return OP_BETWEEN;
+    for (UINT i = 0; i < sizeof(names) / sizeof(names[0]); ++i){
+        if (strcmp(name, names[i]) == 0) return i;
+    }
+    return -1;
+}
+
+const char* filter_isa(){
+    pthread_once(&picked, pick_kernel);
+    return best_isa;
+}
@@ -0,0 +1,43 @@
+#ifndef FILTER_H
+#define FILTER_H
+#include "db.h"
+
+// predicate evaluation over the row-major tuples of a page
+// bit t of the bitmap is set when tuple t satisfies the predicate,
+// the bitmap needs FILTER_WORDS(ntuples) words
+
+#define FILTER_WORDS(n) (((n) + 63) / 64)
+
+// comparison operators of sel()
+#define OP_EQ 0
+#define OP_NE 1
+#define OP_LT 2
+#define OP_LE 3
+#define OP_GT 4
+#define OP_GE 5
+#define OP_BETWEEN 6    // val <= x <= val2
+
+// kernels test lo <= x <= hi, or the opposite when negate is set
+typedef void (*FilterFn)(const INT* data, UINT ntuples, UINT nattrs, UINT idx, INT lo, INT hi, UINT negate, UINT64* bitmap);
+
+// data[t*nattrs+idx] <op> val (val2 is only used by OP_BETWEEN),
+// using the best kernel the cpu supports
+void filter_page(const INT* data, UINT ntuples, UINT nattrs, UINT idx, UINT op, INT val, INT val2, UINT64* bitmap);
+
+// the same predicate on a single value
+UINT filter_match(INT x, UINT op, INT val, INT val2);
+
+// every operator is a closed range [lo, hi] over INT, != is the negated [val, val]
+// returns 0 when the range is empty
+UINT filter_range(UINT op, INT val, INT val2, INT* lo, INT* hi, UINT* negate);
+
+// operator for "=", "!=", "<", "<=", ">", ">=" or "BETWEEN", -1 if unknown
+INT filter_op(const char* name);
+
+// kernel for "scalar", "sse4.2" or "avx2", NULL if the cpu lacks it
+FilterFn filter_kernel(const char* isa);
+
+// name of the kernel filter_page() dispatches to
+const char* filter_isa();
+
+#endif
@@ -0,0 +1,926 @@
+// B+-tree and linear hash indexes through the buffer pool
+// index pages are pinned one at a time while building and searching, so an
+// index works with any buffer that can run external_sort()
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include "index.h"
+
+static Conf* cf = NULL;
+// built by the index command, which runs before concurrent sessions start,
+// so sel() reads the list without a lock
+static Index* indexes = NULL;
+static UINT nindexes = 0;
+static UINT nindex_files = 0;
+
+static UINT64 div_ceil(UINT64 a, UINT64 b){
+    return (a + b - 1) / b;
+}
+
+// ints in a page after its page id
+static UINT page_ints(){
+    return (cf->page_size - sizeof(UINT64)) / sizeof(INT);
+}
+
+// (key, value) pairs in a node
+static UINT node_cap(){
+    return (page_ints() - NODE_HDR) / 2;
+}
+
+static UINT bucket_cap(){
+    return (page_ints() - BUCKET_HDR) / 2;
+}
+
+// stored in the index, so it must not change
+static UINT index_hash(INT key){
+    return (UINT)(((UINT64)(UINT)key * 0x9E3779B97F4A7C15ULL) >> 32);
+}
+
+static UINT bucket_of(const Index* ix, INT key){
+    UINT h = index_hash(key);
+    UINT b = h & ((1u << ix->level) - 1);
+    if (b < ix->split) b = h & ((2u << ix->level) - 1);
+    return b;
+}
+
+static void index_path(char* path, UINT oid){
+    sprintf(path, "%s/%u", get_db()->path, oid);
+}
+
+static UINT create_index_file(){
+    UINT oid = INDEX_OID_BASE + nindex_files++;
+    char path[200];
+    index_path(path, oid);
+    INT fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    assert(fd >= 0);
+    close(fd);
+    return oid;
+}
+
+static void drop_index_file(UINT oid){
+    discard_pages(oid);
+    close_file(oid);
+    char path[200];
+    index_path(path, oid);
+    unlink(path);
+}
+
+const Index* find_index(UINT table_oid, UINT idx, UINT type){
+    for (UINT i = 0; i < nindexes; ++i){
+        if (indexes[i].table_oid == table_oid && indexes[i].idx == idx && indexes[i].type == type) return &indexes[i];
+    }
+    return NULL;
+}
+
+const char* index_name(const Index* ix){
+    return ix->type == INDEX_HASH ? "hash" : "B+-tree";
+}
+
+static void write_btree_meta(const Index* ix, Page* meta){
+    meta->data[0] = ix->table_oid;
+    meta->data[1] = ix->idx;
+    meta->data[2] = ix->root;
+    meta->data[3] = ix->height;
+    meta->data[4] = ix->nleaves;
+    meta->data[5] = ix->ndistinct;
+    meta->data[6] = ix->min_key;
+    meta->data[7] = ix->max_key;
+    meta->data[8] = ix->npages;
+}
+
+// one level of nodes over n children, returns the number of nodes written.
+// pages[] and keys[] are replaced by the pages and smallest keys of the nodes
+static UINT build_level(UINT oid, UINT level, UINT* pages, INT* keys, UINT n, UINT* next_pid){
+    UINT cap = node_cap();
+    UINT nnodes = 0;
+    for (UINT first = 0; first < n; first += cap){
+        UINT k = n - first < cap ? n - first : cap;
+        UINT pid = (*next_pid)++;
+        Page* page = new_page(oid, pid, 0);
+        page->data[NODE_LEVEL] = level;
+        page->data[NODE_N] = k;
+        page->data[NODE_NEXT] = 0;
+        for (UINT j = 0; j < k; ++j){
+            page->data[NODE_HDR + 2 * j] = keys[first + j];
+            page->data[NODE_HDR + 2 * j + 1] = pages[first + j];
+        }
+        release_page(pid, oid);
+        keys[nnodes] = keys[first];
+        pages[nnodes] = pid;
+        ++nnodes;
+    }
+    return nnodes;
+}
+
+// (key, tuple number) of every tuple of t sorted by key, or for a hash
+// index (bucket, key, tuple number) sorted by bucket. external_sort() keeps
+// equal keys in input order, so they stay in tuple order
+static Rel sorted_entries(const Table* t, UINT idx, const Index* hash){
+    Rel rel = open_rel(t);
+    Rel entries = create_temp_rel(hash != NULL ? 3 : 2);
+    RelCursor c;
+    UINT tupno = 0;
+    for (cursor_open(&c, &rel, 0, 0); cursor_tuple(&c) != NULL; cursor_next(&c)){
+        INT key = cursor_tuple(&c)[idx];
+        INT* e = rel_append(&entries);
+        if (hash != NULL) *e++ = bucket_of(hash, key);
+        e[0] = key;
+        e[1] = tupno++;
+    }
+    cursor_close(&c);
+    rel_finish(&entries);
+    Rel sorted = external_sort(&entries, 0);
+    drop_rel(&entries);
+    return sorted;
+}
+
+static void build_btree(Index* ix, Rel* sorted){
+    // leaves from page 1 on, page 0 is written last
+    UINT cap = node_cap();
+    UINT nleaves_max = sorted->ntuples == 0 ? 1 : div_ceil(sorted->ntuples, cap);
+    UINT* pages = malloc(sizeof(UINT) * nleaves_max);
+    INT* keys = malloc(sizeof(INT) * nleaves_max);
+    UINT next_pid = 1;
+    UINT nleaves = 0;
+    RelCursor c;
+    cursor_open(&c, sorted, 0, 0);
+    do {
+        // the only leaf of an empty table stays empty
+        const INT* pair = cursor_tuple(&c);
+        Page* leaf = new_page(ix->oid, next_pid, 0);
+        leaf->data[NODE_LEVEL] = 0;
+        leaf->data[NODE_N] = 0;
+        pages[nleaves] = next_pid++;
+        keys[nleaves] = pair == NULL ? 0 : pair[0];
+        ++nleaves;
+        for (; pair != NULL && leaf->data[NODE_N] < (INT)cap; pair = cursor_tuple(&c)){
+            INT n = leaf->data[NODE_N]++;
+            leaf->data[NODE_HDR + 2 * n] = pair[0];
+            leaf->data[NODE_HDR + 2 * n + 1] = pair[1];
+            if (ix->ndistinct == 0 || pair[0] != ix->max_key) ++ix->ndistinct;
+            if (ix->ndistinct == 1) ix->min_key = pair[0];
+            ix->max_key = pair[0];
+            cursor_next(&c);
+        }
+        leaf->data[NODE_NEXT] = pair == NULL ? 0 : next_pid;
+        release_page(leaf->pid, ix->oid);
+    } while (cursor_tuple(&c) != NULL);
+    cursor_close(&c);
+
+    ix->nleaves = nleaves;
+    ix->height = 1;
+    UINT n = nleaves;
+    while (n > 1){
+        n = build_level(ix->oid, ix->height, pages, keys, n, &next_pid);
+        ++ix->height;
+    }
+    ix->root = pages[0];
+    ix->npages = next_pid;
+    free(pages);
+    free(keys);
+
+    Page* meta = new_page(ix->oid, 0, 0);
+    write_btree_meta(ix, meta);
+    release_page(0, ix->oid);
+}
+
+// first position in node page with key > k, searched from pair first on
+static UINT upper_bound(const INT* data, UINT first, INT k){
+    UINT last = data[NODE_N];
+    while (first < last){
+        UINT mid = (first + last) / 2;
+        if (data[NODE_HDR + 2 * mid] <= k) first = mid + 1;
+        else last = mid;
+    }
+    return first;
+}
+
+// first position in node page with key >= lo, searched from pair first on
+static UINT lower_bound(const INT* data, UINT first, INT lo){
+    UINT last = data[NODE_N];
+    while (first < last){
+        UINT mid = (first + last) / 2;
+        if (data[NODE_HDR + 2 * mid] < lo) first = mid + 1;
+        else last = mid;
+    }
+    return first;
+}
+
+// put (key, value) at pos of node pid, which may be full. a full node is
+// split in halves into itself and a new node, the first key and the page
+// of that one are returned in *key and *value, 0 if there was room
+static UINT node_insert(Index* ix, UINT pid, UINT pos, INT* key, INT* value){
+    UINT cap = node_cap();
+    Page* page = get_page(ix->oid, pid, 0);
+    mark_dirty(pid, ix->oid);
+    INT* data = page->data;
+    UINT n = data[NODE_N];
+    if (n < cap){
+        memmove(data + NODE_HDR + 2 * (pos + 1), data + NODE_HDR + 2 * pos, sizeof(INT) * 2 * (n - pos));
+        data[NODE_HDR + 2 * pos] = *key;
+        data[NODE_HDR + 2 * pos + 1] = *value;
+        ++data[NODE_N];
+        release_page(pid, ix->oid);
+        return 0;
+    }
+
+    // the cap + 1 pairs in order, the node keeps the first half
+    INT pairs[2 * (cap + 1)];
+    memcpy(pairs, data + NODE_HDR, sizeof(INT) * 2 * pos);
+    pairs[2 * pos] = *key;
+    pairs[2 * pos + 1] = *value;
+    memcpy(pairs + 2 * (pos + 1), data + NODE_HDR + 2 * pos, sizeof(INT) * 2 * (n - pos));
+    UINT left = (cap + 1) / 2;
+    UINT added = ix->npages++;
+    INT level = data[NODE_LEVEL];
+    INT next = data[NODE_NEXT];
+    memcpy(data + NODE_HDR, pairs, sizeof(INT) * 2 * left);
+    data[NODE_N] = left;
+    if (level == 0) data[NODE_NEXT] = added;
+    release_page(pid, ix->oid);
+
+    page = new_page(ix->oid, added, 0);
+    page->data[NODE_LEVEL] = level;
+    page->data[NODE_N] = cap + 1 - left;
+    page->data[NODE_NEXT] = level == 0 ? next : 0;
+    memcpy(page->data + NODE_HDR, pairs + 2 * left, sizeof(INT) * 2 * (cap + 1 - left));
+    release_page(added, ix->oid);
+    if (level == 0) ++ix->nleaves;
+    *key = pairs[2 * left];
+    *value = added;
+    return 1;
+}
+
+// whether pair j of node data goes before (key, tupno): entries are sorted
+// by key, equal keys by tuple number
+static UINT pair_before(const INT* data, UINT j, INT key, UINT tupno){
+    INT k = data[NODE_HDR + 2 * j];
+    return k < key || (k == key && (UINT)data[NODE_HDR + 2 * j + 1] < tupno);
+}
+
+// first position in leaf data whose pair does not go before (key, tupno)
+static UINT leaf_position(const INT* data, INT key, UINT tupno){
+    UINT first = 0;
+    UINT last = data[NODE_N];
+    while (first < last){
+        UINT mid = (first + last) / 2;
+        if (pair_before(data, mid, key, tupno)) first = mid + 1;
+        else last = mid;
+    }
+    return first;
+}
+
+// whether the first entry at or after the subtree of node pid goes before
+// (key, tupno), 0 if there is none. leaves emptied by removals are skipped
+static UINT subtree_before(const Index* ix, UINT pid, INT key, UINT tupno){
+    while (1){
+        Page* page = get_page(ix->oid, pid, 0);
+        UINT level = page->data[NODE_LEVEL];
+        UINT n = page->data[NODE_N];
+        UINT next = level > 0 ? (UINT)page->data[NODE_HDR + 1] : (UINT)page->data[NODE_NEXT];
+        UINT before = level == 0 && n > 0 && pair_before(page->data, 0, key, tupno);
+        release_page(pid, ix->oid);
+        if (before || (level == 0 && n > 0) || next == 0) return before;
+        pid = next;
+    }
+}
+
+// add (key, tupno) after the entries with smaller keys, or equal keys of
+// earlier tuples, splitting nodes up to the root
+static void btree_insert(Index* ix, INT key, UINT tupno){
+    // the last child whose first entry goes before (key, tupno). children
+    // whose smallest key is below key always do, only those starting at
+    // key are looked into. the child position taken at each level is kept
+    UINT path[ix->height];
+    UINT child_pos[ix->height];
+    UINT pid = ix->root;
+    for (UINT level = ix->height - 1; level > 0; --level){
+        UINT c = UINT_MAX;
+        UINT child;
+        while (1){
+            Page* page = get_page(ix->oid, pid, 0);
+            if (c == UINT_MAX) c = upper_bound(page->data, 1, key) - 1;
+            INT sep = page->data[NODE_HDR + 2 * c];
+            child = page->data[NODE_HDR + 2 * c + 1];
+            release_page(pid, ix->oid);
+            if (c == 0 || sep != key || subtree_before(ix, child, key, tupno)) break;
+            --c;
+        }
+        path[level] = pid;
+        child_pos[level] = c;
+        pid = child;
+    }
+
+    Page* leaf = get_page(ix->oid, pid, 0);
+    UINT pos = leaf_position(leaf->data, key, tupno);
+    UINT n = leaf->data[NODE_N];
+    UINT found = (pos > 0 && leaf->data[NODE_HDR + 2 * (pos - 1)] == key) ||
+                 (pos < n && leaf->data[NODE_HDR + 2 * pos] == key);
+    release_page(pid, ix->oid);
+    if (!found && ix->ndistinct++ == 0) ix->min_key = ix->max_key = key;
+    if (key < ix->min_key) ix->min_key = key;
+    if (key > ix->max_key) ix->max_key = key;
+
+    INT k = key;
+    INT v = tupno;
+    UINT level = 0;
+    while (node_insert(ix, pid, pos, &k, &v)){
+        if (++level == ix->height){
+            // a new root over the old one and the node split off it, the
+            // first key of a node is never compared
+            UINT root = ix->npages++;
+            Page* page = new_page(ix->oid, root, 0);
+            page->data[NODE_LEVEL] = level;
+            page->data[NODE_N] = 2;
+            page->data[NODE_NEXT] = 0;
+            page->data[NODE_HDR] = ix->min_key;
+            page->data[NODE_HDR + 1] = ix->root;
+            page->data[NODE_HDR + 2] = k;
+            page->data[NODE_HDR + 3] = v;
+            release_page(root, ix->oid);
+            ix->root = root;
+            ++ix->height;
+            break;
+        }
+        pid = path[level];
+        pos = child_pos[level] + 1;
+    }
+
+    Page* meta = get_page(ix->oid, 0, 0);
+    mark_dirty(0, ix->oid);
+    write_btree_meta(ix, meta);
+    release_page(0, ix->oid);
+}
+
+// take (key, tupno) out of its leaf. nodes are not merged, a leaf may be
+// left empty
+static void btree_remove(Index* ix, INT key, UINT tupno){
+    UINT pid = ix->root;
+    for (UINT level = ix->height - 1; level > 0; --level){
+        Page* page = get_page(ix->oid, pid, 0);
+        UINT c = lower_bound(page->data, 1, key) - 1;
+        UINT child = page->data[NODE_HDR + 2 * c + 1];
+        release_page(pid, ix->oid);
+        pid = child;
+    }
+
+    while (1){
+        Page* leaf = get_page(ix->oid, pid, 0);
+        INT* data = leaf->data;
+        UINT n = data[NODE_N];
+        UINT pos = leaf_position(data, key, tupno);
+        if (pos < n){
+            assert(data[NODE_HDR + 2 * pos] == key && (UINT)data[NODE_HDR + 2 * pos + 1] == tupno);
+            mark_dirty(pid, ix->oid);
+            memmove(data + NODE_HDR + 2 * pos, data + NODE_HDR + 2 * (pos + 1), sizeof(INT) * 2 * (n - pos - 1));
+            --data[NODE_N];
+            UINT found = (pos > 0 && data[NODE_HDR + 2 * (pos - 1)] == key) ||
+                         (pos + 1 < n && data[NODE_HDR + 2 * pos] == key);
+            if (!found && ix->ndistinct > 0) --ix->ndistinct;
+            release_page(pid, ix->oid);
+            break;
+        }
+        UINT next = data[NODE_NEXT];
+        release_page(pid, ix->oid);
+        assert(next != 0);
+        pid = next;
+    }
+
+    Page* meta = get_page(ix->oid, 0, 0);
+    mark_dirty(0, ix->oid);
+    write_btree_meta(ix, meta);
+    release_page(0, ix->oid);
+}
+
+static void write_hash_meta(const Index* ix, Page* meta){
+    meta->data[0] = ix->table_oid;
+    meta->data[1] = ix->idx;
+    meta->data[2] = ix->ndistinct;
+    meta->data[3] = ix->level;
+    meta->data[4] = ix->split;
+    meta->data[5] = ix->noverflow;
+    meta->data[6] = ix->min_key;
+    meta->data[7] = ix->max_key;
+    meta->data[8] = ix->nentries;
+    meta->data[9] = ix->free_overflow;
+}
+
+// every bucket is written in turn from the entries sorted by bucket,
+// its overflow pages are appended to the overflow file
+static void build_hash(Index* ix, Rel* sorted){
+    UINT cap = bucket_cap();
+    UINT overflow_oid = ix->oid + 1;
+    KeyRef* keys = NULL;    // keys of a bucket, to count the distinct ones
+    KeyRef* tmp = NULL;
+    UINT size = 0;
+    RelCursor c;
+    cursor_open(&c, sorted, 0, 0);
+    for (UINT b = 0; b < ix->nbuckets; ++b){
+        UINT oid = ix->oid;
+        UINT pid = 1 + b;
+        Page* page = new_page(oid, pid, 0);
+        page->data[BUCKET_N] = 0;
+        page->data[BUCKET_NEXT] = 0;
+        UINT nkeys = 0;
+        for (const INT* e = cursor_tuple(&c); e != NULL && (UINT)e[0] == b; e = cursor_tuple(&c)){
+            if (page->data[BUCKET_N] == (INT)cap){
+                UINT next = ++ix->noverflow;
+                page->data[BUCKET_NEXT] = next;
+                release_page(pid, oid);
+                oid = overflow_oid;
+                pid = next;
+                page = new_page(oid, pid, 0);
+                page->data[BUCKET_N] = 0;
+                page->data[BUCKET_NEXT] = 0;
+            }
+            INT n = page->data[BUCKET_N]++;
+            page->data[BUCKET_HDR + 2 * n] = e[1];
+            page->data[BUCKET_HDR + 2 * n + 1] = e[2];
+
+            if (nkeys == size){
+                size = size ? 2 * size : 64;
+                keys = realloc(keys, sizeof(KeyRef) * size);
+                tmp = realloc(tmp, sizeof(KeyRef) * size);
+            }
+            keys[nkeys].key = radix_key(e[1]);
+            keys[nkeys].ref = 0;
+            ++nkeys;
+            if (ix->nentries++ == 0) ix->min_key = ix->max_key = e[1];
+            if (e[1] < ix->min_key) ix->min_key = e[1];
+            if (e[1] > ix->max_key) ix->max_key = e[1];
+            cursor_next(&c);
+        }
+        release_page(pid, oid);
+
+        radix_sort(keys, tmp, nkeys);
+        for (UINT k = 0; k < nkeys; ++k){
+            if (k == 0 || keys[k].key != keys[k-1].key) ++ix->ndistinct;
+        }
+    }
+    cursor_close(&c);
+    free(keys);
+    free(tmp);
+
+    Page* meta = new_page(ix->oid, 0, 0);
+    write_hash_meta(ix, meta);
+    release_page(0, ix->oid);
+}
+
+typedef struct BucketWriter {   // appends pairs to the chain of a bucket
+    Index* ix;
+    UINT oid;
+    UINT pid;
+    Page* page;                 // last page of the chain, pinned and dirty
+    UINT* spare;                // overflow pages to reuse first
+    UINT nspare;
+} BucketWriter;
+
+// link another page to the chain of w: a spare one, one from the free
+// list, or a new one at the end of the overflow file
+static void bucket_grow(BucketWriter* w){
+    Index* ix = w->ix;
+    UINT oid = ix->oid + 1;
+    UINT pid;
+    UINT reused = 1;
+    if (w->nspare > 0) pid = w->spare[--w->nspare];
+    else if (ix->free_overflow != 0) pid = ix->free_overflow;
+    else {
+        pid = ++ix->noverflow;
+        reused = 0;
+    }
+    w->page->data[BUCKET_NEXT] = pid;
+    release_page(w->pid, w->oid);
+
+    Page* page;
+    if (reused){
+        page = get_page(oid, pid, 0);
+        mark_dirty(pid, oid);
+        if (pid == ix->free_overflow) ix->free_overflow = page->data[BUCKET_NEXT];
+    } else {
+        page = new_page(oid, pid, 0);
+    }
+    page->data[BUCKET_N] = 0;
+    page->data[BUCKET_NEXT] = 0;
+    w->oid = oid;
+    w->pid = pid;
+    w->page = page;
+}
+
+static void bucket_append(BucketWriter* w, INT key, INT tupno){
+    if (w->page->data[BUCKET_N] == (INT)bucket_cap()) bucket_grow(w);
+    INT n = w->page->data[BUCKET_N]++;
+    w->page->data[BUCKET_HDR + 2 * n] = key;
+    w->page->data[BUCKET_HDR + 2 * n + 1] = tupno;
+}
+
+// split bucket ix->split into itself and bucket split + 2^level, the new
+// last one. the pairs keep their order, so equal keys stay in tuple order,
+// and overflow pages left over go to the free list
+static void split_bucket(Index* ix){
+    UINT old = ix->split;
+    INT* pairs = NULL;
+    UINT npairs = 0;
+    UINT* spare = NULL;
+    UINT nspare = 0;
+
+    // read the chain, one page pinned at a time
+    UINT oid = ix->oid;
+    UINT pid = 1 + old;
+    while (1){
+        Page* page = get_page(oid, pid, 0);
+        UINT n = page->data[BUCKET_N];
+        pairs = realloc(pairs, sizeof(INT) * 2 * (npairs + n + 1));
+        memcpy(pairs + 2 * npairs, page->data + BUCKET_HDR, sizeof(INT) * 2 * n);
+        npairs += n;
+        UINT next = page->data[BUCKET_NEXT];
+        release_page(pid, oid);
+        if (next == 0) break;
+        oid = ix->oid + 1;
+        pid = next;
+        spare = realloc(spare, sizeof(UINT) * (nspare + 1));
+        spare[nspare++] = next;
+    }
+    // spare pages are taken from the end, reuse them in chain order
+    for (UINT i = 0; i < nspare / 2; ++i){
+        UINT tmp = spare[i];
+        spare[i] = spare[nspare - 1 - i];
+        spare[nspare - 1 - i] = tmp;
+    }
+
+    if (++ix->split == 1u << ix->level){
+        ++ix->level;
+        ix->split = 0;
+    }
+    UINT added = ix->nbuckets++;
+
+    for (UINT b = old; ; b = added){
+        BucketWriter w = { ix, ix->oid, 1 + b, NULL, spare, nspare };
+        if (b == old){
+            w.page = get_page(w.oid, w.pid, 0);
+            mark_dirty(w.pid, w.oid);
+        } else {
+            w.page = new_page(w.oid, w.pid, 0);
+        }
+        w.page->data[BUCKET_N] = 0;
+        w.page->data[BUCKET_NEXT] = 0;
+        for (UINT j = 0; j < npairs; ++j){
+            if (bucket_of(ix, pairs[2 * j]) == b) bucket_append(&w, pairs[2 * j], pairs[2 * j + 1]);
+        }
+        release_page(w.pid, w.oid);
+        nspare = w.nspare;
+        if (b == added) break;
+    }
+
+    // the halves together need no more overflow pages than the old chain
+    for (UINT i = 0; i < nspare; ++i){
+        UINT oid = ix->oid + 1;
+        Page* page = get_page(oid, spare[i], 0);
+        mark_dirty(spare[i], oid);
+        page->data[BUCKET_N] = 0;
+        page->data[BUCKET_NEXT] = ix->free_overflow;
+        ix->free_overflow = spare[i];
+        release_page(spare[i], oid);
+    }
+    free(pairs);
+    free(spare);
+}
+
+// add (key, tupno) before the first entry of an equal key and a later
+// tuple, or at the end of its bucket, then split the next bucket while the
+// table is over BUCKET_FILL. a full page passes its last pair on to the
+// front of the next one
+static void hash_insert(Index* ix, INT key, UINT tupno){
+    BucketWriter w = { ix, ix->oid, 1 + bucket_of(ix, key), NULL, NULL, 0 };
+    UINT found = 0;
+    UINT pos = UINT_MAX;
+    while (1){
+        w.page = get_page(w.oid, w.pid, 0);
+        UINT n = w.page->data[BUCKET_N];
+        for (UINT j = 0; j < n && pos == UINT_MAX; ++j){
+            if (w.page->data[BUCKET_HDR + 2 * j] != key) continue;
+            found = 1;
+            if ((UINT)w.page->data[BUCKET_HDR + 2 * j + 1] > tupno) pos = j;
+        }
+        UINT next = w.page->data[BUCKET_NEXT];
+        if (next == 0 || pos != UINT_MAX) break;
+        release_page(w.pid, w.oid);
+        w.oid = ix->oid + 1;
+        w.pid = next;
+    }
+    mark_dirty(w.pid, w.oid);
+    INT k = key;
+    INT v = tupno;
+    UINT placed = 0;
+    while (pos != UINT_MAX){
+        INT* data = w.page->data;
+        UINT n = data[BUCKET_N];
+        INT last_k = data[BUCKET_HDR + 2 * (n - 1)];
+        INT last_v = data[BUCKET_HDR + 2 * (n - 1) + 1];
+        memmove(data + BUCKET_HDR + 2 * (pos + 1), data + BUCKET_HDR + 2 * pos, sizeof(INT) * 2 * (n - 1 - pos));
+        data[BUCKET_HDR + 2 * pos] = k;
+        data[BUCKET_HDR + 2 * pos + 1] = v;
+        if (n < bucket_cap()){
+            data[BUCKET_HDR + 2 * n] = last_k;
+            data[BUCKET_HDR + 2 * n + 1] = last_v;
+            ++data[BUCKET_N];
+            placed = 1;
+            break;
+        }
+        k = last_k;
+        v = last_v;
+        UINT next = data[BUCKET_NEXT];
+        if (next == 0) break;
+        release_page(w.pid, w.oid);
+        w.oid = ix->oid + 1;
+        w.pid = next;
+        w.page = get_page(w.oid, w.pid, 0);
+        mark_dirty(w.pid, w.oid);
+        pos = w.page->data[BUCKET_N] > 0 ? 0 : UINT_MAX;
+    }
+    if (!placed) bucket_append(&w, k, v);
+    release_page(w.pid, w.oid);
+
+    if (!found) ++ix->ndistinct;
+    if (ix->nentries++ == 0) ix->min_key = ix->max_key = key;
+    if (key < ix->min_key) ix->min_key = key;
+    if (key > ix->max_key) ix->max_key = key;
+    while (ix->nentries > (UINT)(bucket_cap() * BUCKET_FILL) * ix->nbuckets) split_bucket(ix);
+
+    Page* meta = get_page(ix->oid, 0, 0);
+    mark_dirty(0, ix->oid);
+    write_hash_meta(ix, meta);
+    release_page(0, ix->oid);
+}
+
+// take (key, tupno) out of its bucket. pages left empty stay in the chain
+static void hash_remove(Index* ix, INT key, UINT tupno){
+    UINT oid = ix->oid;
+    UINT pid = 1 + bucket_of(ix, key);
+    UINT removed = 0;
+    UINT found = 0;
+    while (1){
+        Page* page = get_page(oid, pid, 0);
+        INT* data = page->data;
+        UINT n = data[BUCKET_N];
+        for (UINT j = 0; j < n; ++j){
+            if (data[BUCKET_HDR + 2 * j] != key) continue;
+            if (removed || (UINT)data[BUCKET_HDR + 2 * j + 1] != tupno){
+                found = 1;
+                continue;
+            }
+            mark_dirty(pid, oid);
+            memmove(data + BUCKET_HDR + 2 * j, data + BUCKET_HDR + 2 * (j + 1), sizeof(INT) * 2 * (n - j - 1));
+            --data[BUCKET_N];
+            --n;
+            --j;
+            removed = 1;
+        }
+        UINT next = data[BUCKET_NEXT];
+        release_page(pid, oid);
+        if (next == 0) break;
+        oid = ix->oid + 1;
+        pid = next;
+    }
+    assert(removed);
+    if (!found) --ix->ndistinct;
+    --ix->nentries;
+
+    Page* meta = get_page(ix->oid, 0, 0);
+    mark_dirty(0, ix->oid);
+    write_hash_meta(ix, meta);
+    release_page(0, ix->oid);
+}
+
+const Index* create_index(const Table* t, UINT idx, UINT type){
+    cf = get_conf();
+    assert(idx < t->nattrs);
+    if (page_ints() < (type == INDEX_HASH ? HASH_META_INTS : INDEX_META_INTS) || node_cap() < 2){
+        printf("Pages of %u bytes are too small for an index.\n", cf->page_size);
+        return NULL;
+    }
+
+    // replace an index that exists
+    Index* ix = (Index*)find_index(t->oid, idx, type);
+    if (ix != NULL){
+        drop_index_file(ix->oid);
+        if (type == INDEX_HASH) drop_index_file(ix->oid + 1);
+    } else {
+        indexes = realloc(indexes, sizeof(Index) * (nindexes + 1));
+        ix = &indexes[nindexes++];
+    }
+    memset(ix, 0, sizeof(Index));
+    ix->type = type;
+    ix->table_oid = t->oid;
+    ix->idx = idx;
+    ix->oid = create_index_file();
+
+    if (type == INDEX_HASH){
+        // enough buckets for the table at BUCKET_FILL, a power of two
+        create_index_file();    // overflow pages, oid + 1
+        UINT target = div_ceil(t->ntuples, (UINT)(bucket_cap() * BUCKET_FILL));
+        while ((1u << ix->level) < target) ++ix->level;
+        ix->nbuckets = 1u << ix->level;
+        Rel sorted = sorted_entries(t, idx, ix);
+        build_hash(ix, &sorted);
+        drop_rel(&sorted);
+        printf("hash index on %s attribute %u: %u keys, %u buckets, %u overflow pages, read_io %u, write_io %u\n",
+               t->name, idx, ix->ndistinct, ix->nbuckets, ix->noverflow, cf->read_io, cf->write_io);
+    } else {
+        Rel sorted = sorted_entries(t, idx, NULL);
+        build_btree(ix, &sorted);
+        drop_rel(&sorted);
+        printf("B+-tree index on %s attribute %u: %u keys, %u leaves, height %u, read_io %u, write_io %u\n",
+               t->name, idx, ix->ndistinct, ix->nleaves, ix->height, cf->read_io, cf->write_io);
+    }
+    return ix;
+}
+
+// append tuple number tupno to *refs
+static void add_ref(KeyRef** refs, UINT* size, UINT n, UINT tupno){
+    if (n == *size){
+        *size = *size ? 2 * *size : 64;
+        *refs = realloc(*refs, sizeof(KeyRef) * *size);
+    }
+    (*refs)[n].key = tupno;
+    (*refs)[n].ref = 0;
+}
+
+static UINT btree_lookup(const Index* ix, INT lo, INT hi, KeyRef** refs, UINT* size){
+    UINT n = 0;
+
+    // the leftmost child whose smallest key is below lo may still end with lo
+    UINT pid = ix->root;
+    for (UINT level = ix->height - 1; level > 0; --level){
+        Page* page = get_page(ix->oid, pid, 0);
+        assert(page->data[NODE_LEVEL] == (INT)level);
+        UINT c = lower_bound(page->data, 1, lo) - 1;
+        UINT child = page->data[NODE_HDR + 2 * c + 1];
+        release_page(pid, ix->oid);
+        pid = child;
+    }
+
+    Page* leaf = get_page(ix->oid, pid, 0);
+    UINT pos = lower_bound(leaf->data, 0, lo);
+    while (1){
+        UINT nleaf = leaf->data[NODE_N];
+        for (; pos < nleaf && leaf->data[NODE_HDR + 2 * pos] <= hi; ++pos)
+            add_ref(refs, size, n++, leaf->data[NODE_HDR + 2 * pos + 1]);
+        UINT next = leaf->data[NODE_NEXT];
+        release_page(pid, ix->oid);
+        if (pos < nleaf || next == 0) break;
+        pid = next;
+        leaf = get_page(ix->oid, pid, 0);
+        pos = 0;
+    }
+    return n;
+}
+
+static UINT hash_lookup(const Index* ix, INT key, KeyRef** refs, UINT* size){
+    UINT n = 0;
+    UINT oid = ix->oid;
+    UINT pid = 1 + bucket_of(ix, key);
+    while (1){
+        Page* page = get_page(oid, pid, 0);
+        UINT npairs = page->data[BUCKET_N];
+        for (UINT j = 0; j < npairs; ++j){
+            if (page->data[BUCKET_HDR + 2 * j] == key)
+                add_ref(refs, size, n++, page->data[BUCKET_HDR + 2 * j + 1]);
+        }
+        UINT next = page->data[BUCKET_NEXT];
+        release_page(pid, oid);
+        if (next == 0) break;
+        oid = ix->oid + 1;
+        pid = next;
+    }
+    return n;
+}
+
+UINT index_lookup(const Index* ix, INT lo, INT hi, KeyRef** refs, UINT* size){
+    if (ix->type == INDEX_HASH){
+        assert(lo == hi);
+        return hash_lookup(ix, lo, refs, size);
+    }
+    return btree_lookup(ix, lo, hi, refs, size);
+}
+
+double index_probe_cost(const Index* ix, double matches){
+    if (ix->type == INDEX_HASH) return 1 + (double)ix->noverflow / ix->nbuckets;
+    // descend, then walk the leaves
+    return ix->height + matches / node_cap();
+}
+
+// entries with keys in [lo, hi] if the keys were spread evenly over [min, max]
+static double estimate_matches(const Index* ix, UINT ntuples, INT lo, INT hi){
+    if (lo > ix->max_key || hi < ix->min_key || ix->ndistinct == 0) return 0;
+    if (lo == hi) return (double)ntuples / ix->ndistinct;
+    INT64 l = lo > ix->min_key ? lo : ix->min_key;
+    INT64 h = hi < ix->max_key ? hi : ix->max_key;
+    return (double)ntuples * (h - l + 1) / ((INT64)ix->max_key - ix->min_key + 1);
+}
+
+_Table* index_sel(const Table* t, UINT idx, UINT op, INT val, INT val2){
+    cf = get_conf();
+    INT lo, hi;
+    UINT negate;
+    UINT nonempty = filter_range(op, val, val2, &lo, &hi, &negate);
+    if (negate) return NULL;
+
+    // the index reading the fewest pages: probe, then each table page
+    // with a match once. a hash index only finds single keys
+    UINT ntuples_per_page = (cf->page_size - sizeof(UINT64)) / sizeof(INT) / t->nattrs;
+    UINT npages = div_ceil(t->ntuples, ntuples_per_page);
+    const Index* ix = NULL;
+    UINT64 cost = 0;
+    for (UINT type = INDEX_BTREE; type <= INDEX_HASH; ++type){
+        const Index* cand = find_index(t->oid, idx, type);
+        if (cand == NULL || (type == INDEX_HASH && lo != hi)) continue;
+        double matches = nonempty ? estimate_matches(cand, t->ntuples, lo, hi) : 0;
+        UINT64 c = (UINT64)index_probe_cost(cand, matches);
+        c += matches < npages ? (UINT64)(matches + 0.5) : npages;
+        if (ix == NULL || c < cost){
+            ix = cand;
+            cost = c;
+        }
+    }
+    if (ix == NULL) return NULL;
+    if (cost >= npages){
+        printf("sel() scans, the %s index on attribute %u is estimated at %llu page I/O.\n", index_name(ix), idx, (unsigned long long)cost);
+        return NULL;
+    }
+    printf("sel() uses the %s index on attribute %u, estimated page I/O %llu.\n", index_name(ix), idx, (unsigned long long)cost);
+
+    _Table* result = new_result(t->nattrs);
+    if (!nonempty) return result;
+
+    // fetch the matches in tuple order, so they come out as a scan finds them
+    KeyRef* refs = NULL;
+    UINT size = 0;
+    UINT n = index_lookup(ix, lo, hi, &refs, &size);
+    KeyRef* tmp = malloc(sizeof(KeyRef) * (n + 1));
+    radix_sort(refs, tmp, n);
+    free(tmp);
+
+    UINT64 page_id_init = n > 0 ? read_first_pid(t->oid) : 0;
+    for (UINT i = 0; i < n; ){
+        UINT p = refs[i].key / ntuples_per_page;
+        Page* page = get_page(t->oid, page_id_init + p, page_id_init);
+        for (; i < n && refs[i].key / ntuples_per_page == p; ++i){
+            UINT pos = refs[i].key % ntuples_per_page;
+            memcpy(append_tuple(result), page->data + pos * t->nattrs, sizeof(INT) * t->nattrs);
+        }
+        release_page(page_id_init + p, t->oid);
+    }
+    free(refs);
+    return result;
+}
+
+void index_insert(const Table* t, const INT* tup, UINT tupno){
+    cf = get_conf();
+    for (UINT i = 0; i < nindexes; ++i){
+        Index* ix = &indexes[i];
+        if (ix->table_oid != t->oid) continue;
+        if (ix->type == INDEX_HASH) hash_insert(ix, tup[ix->idx], tupno);
+        else btree_insert(ix, tup[ix->idx], tupno);
+    }
+}
+
+void index_update(const Table* t, UINT idx, INT old_key, INT new_key, UINT tupno){
+    cf = get_conf();
+    for (UINT i = 0; i < nindexes; ++i){
+        Index* ix = &indexes[i];
+        if (ix->table_oid != t->oid || ix->idx != idx) continue;
+        if (ix->type == INDEX_HASH){
+            hash_remove(ix, old_key, tupno);
+            hash_insert(ix, new_key, tupno);
+        } else {
+            btree_remove(ix, old_key, tupno);
+            btree_insert(ix, new_key, tupno);
+        }
+    }
+}
+
+void rebuild_indexes(const Table* t, UINT idx){
+    // create_index() replaces an index in place, so the list does not move
+    for (UINT i = 0; i < nindexes; ++i){
+        if (indexes[i].table_oid == t->oid && (idx == UINT_MAX || indexes[i].idx == idx))
+            create_index(t, indexes[i].idx, indexes[i].type);
+    }
+}
+
+void free_indexes(){
+    // indexes are not in the catalog, so their files would only be left
+    // behind, their dirty pages are dropped unwritten
+    for (UINT i = 0; i < nindexes; ++i){
+        drop_index_file(indexes[i].oid);
+        if (indexes[i].type == INDEX_HASH) drop_index_file(indexes[i].oid + 1);
+    }
+    free(indexes);
+    indexes = NULL;
+    nindexes = 0;
+    nindex_files = 0;
+}
@@ -0,0 +1,125 @@
+#ifndef INDEX_H
+#define INDEX_H
+#include "sort.h"
+
+// secondary indexes, B+-trees and linear hash tables
+// an index on attribute idx of a table lives in page files of its own under
+// the database folder, oids from INDEX_OID_BASE, and is read through the
+// buffer pool like any table. both map a key to tuple numbers in the table
+// (page * tuples per page + position), equal keys in tuple order.
+//
+// B+-tree: page 0 holds the meta data (INDEX_META_INTS values, table oid,
+// idx, root, height, nleaves, ndistinct, min_key, max_key, pages), the nodes
+// follow.
+// a node is
+//     level, n, next leaf, then n (key, value) pairs sorted by key
+// leaves are level 0 and their values are tuple numbers. an inner node's
+// values are child pages and its keys the smallest key under each child.
+// the tree is bulk loaded from the sorted (key, tuple number) pairs, so every
+// node but the last of a level is full. an insert goes to the last leaf
+// whose first entry comes before it, looking into the subtrees whose
+// smallest key equals its key, since equal keys stay in tuple order. a full
+// node is split in halves, the second half to a new page at the end of the
+// file, and its first key and page are inserted into the parent, up to a
+// new root.
+//
+// linear hash: page 0 holds the meta data (table oid, idx, ndistinct, level,
+// split, noverflow, min_key, max_key) and page 1 + b the first page of
+// bucket b. key k is in bucket h & (2^level - 1), or h & (2^(level+1) - 1)
+// when that is below split, with h = index_hash(k). a bucket page is
+//     n, next page, then n (key, tuple number) pairs
+// and the next pages of a bucket are in the file oid + 1, numbered from 1.
+// the buckets are sized for the table at BUCKET_FILL and bulk loaded. an
+// insert appends to the chain of its bucket, and while there are more than
+// BUCKET_FILL pairs per bucket page the table grows by one bucket: bucket
+// split is split into itself and split + 2^level, then split advances and
+// level with it when it reaches 2^level. the meta data also holds the
+// pairs and the first page of a list of the overflow pages splits freed,
+// linked through their next page.
+//
+// an entry is removed from its leaf or bucket page, and an update inserts
+// the new key of its tuple after the equal keys of earlier tuples, in a hash
+// bucket by shifting the later pairs down the chain. nodes are not merged
+// and emptied pages stay linked.
+//
+// dml.c inserts into the indexes of the table it appends to and moves the
+// entries of the tuples an update changes. a delete, which moves tuples,
+// rebuilds all of them. ndistinct, min_key and max_key are estimates,
+// min_key and max_key only widen.
+
+#define INDEX_META_INTS 9
+#define HASH_META_INTS 10
+#define NODE_LEVEL 0
+#define NODE_N 1
+#define NODE_NEXT 2         // next leaf, 0 for the last one
+#define NODE_HDR 3          // ints before the first pair
+#define BUCKET_N 0
+#define BUCKET_NEXT 1       // next page of the bucket, 0 for the last one
+#define BUCKET_HDR 2
+#define BUCKET_FILL 0.75    // pairs per bucket page when loaded and at most after inserts
+
+// index types
+#define INDEX_BTREE 0
+#define INDEX_HASH 1
+
+typedef struct Index {
+    UINT type;
+    UINT table_oid;
+    UINT idx;
+    UINT oid;               // page file, the B+-tree or the first bucket pages
+    UINT ndistinct;         // distinct keys
+    INT min_key;
+    INT max_key;
+    // B+-tree
+    UINT root;              // page of the root node
+    UINT height;            // levels, 1 when the root is a leaf
+    UINT nleaves;
+    UINT npages;            // pages in the file, the meta page included
+    // linear hash
+    UINT level;
+    UINT split;             // next bucket to split
+    UINT nbuckets;          // 2^level + split, not stored
+    UINT noverflow;         // pages in the overflow file
+    UINT nentries;          // (key, tuple number) pairs
+    UINT free_overflow;     // first page of the free list, 0 when empty
+} Index;
+
+// build an index of type on attribute idx of t, replacing one that exists
+// returns NULL if the pages are too small for index nodes
+const Index* create_index(const Table* t, UINT idx, UINT type);
+
+// index of type on attribute idx of table oid, NULL if there is none
+const Index* find_index(UINT table_oid, UINT idx, UINT type);
+
+// "B+-tree" or "hash"
+const char* index_name(const Index* ix);
+
+// estimated index pages read to find matches entries of keys in one range,
+// table pages not included
+double index_probe_cost(const Index* ix, double matches);
+
+// tuple numbers of the entries with keys in [lo, hi], in key order. a hash
+// index only answers lo == hi. *refs is grown with realloc() as needed,
+// *size is its capacity, both may start as NULL and 0
+UINT index_lookup(const Index* ix, INT lo, INT hi, KeyRef** refs, UINT* size);
+
+// tuples of t with attribute idx <op> val (val2 for OP_BETWEEN) in page
+// order, found through an index on idx. NULL if there is no index that
+// answers op or a scan is estimated to read fewer pages
+_Table* index_sel(const Table* t, UINT idx, UINT op, INT val, INT val2);
+
+// tup was appended to table t as tuple number tupno, add it to the indexes
+void index_insert(const Table* t, const INT* tup, UINT tupno);
+
+// attribute idx of tuple number tupno of t was set from old_key to new_key,
+// move its entry in the indexes on idx
+void index_update(const Table* t, UINT idx, INT old_key, INT new_key, UINT tupno);
+
+// build the indexes of t on attribute idx again, of every attribute if idx
+// is UINT_MAX
+void rebuild_indexes(const Table* t, UINT idx);
+
+// forget the indexes and delete their files from the database folder
+void free_indexes();
+
+#endif
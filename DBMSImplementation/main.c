@@ -10,13 +10,21 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <ctype.h>
+#include <time.h>
+#include <pthread.h>
 #include "db.h"
 #include "ro.h"
+#include "prefetch.h"
+#include "index.h"
+#include "dml.h"
 
 
 void run(char* ra_path, char* log_path);
+void run_sessions(char* ra_path, char* log_path);
+_Table* exec_query(const char* line);
 void freeT(_Table* t);
 void logT(_Table* t, FILE* log_fp);
+void report_io();
 
 int main(int argc, char **argv){
     // argv[1] int: page size
@@ -27,6 +35,19 @@ int main(int argc, char **argv){
     // argv[6] string: path for data file
     // argv[7] string: path for test cases
     // argv[8] string: path for output log
+    // argv[9...] options as name=value
+    //      join=auto|nl|sm|hash|index  join strategy, auto picks the cheapest
+    //      prefetch=N              read N pages ahead of sequential scans
+    //      prefetch_io=auto|uring|threads  read-ahead backend
+    //      io_threads=N            workers of the threads backend
+    //      storage=pread|mmap      read table pages into the buffer or use them in place
+    //      threads=N               workers of a parallel sel()
+    //      sessions=K              run the query file in K concurrent sessions
+    //      load_threads=N          workers loading the input, 0 for one per cpu
+    //      startup=load|open|auto  load the input, open the database folder from its catalog,
+    //                              or open it when the catalog was written from the same input
+    //      zonemaps=off|on         skip pages by their per-page min/max
+    //      bloom=off|on            drop join tuples that cannot match before joining
 
     if (argc < 8) {
         printf("Insufficient arguments\n");
@@ -39,11 +60,20 @@ int main(int argc, char **argv){
     sscanf(argv[2],"%u",&buf_slots);
     sscanf(argv[3],"%u",&file_limit);
     Conf* cf = init_conf(page_size,buf_slots,file_limit,argv[4]);
+    for (int i = 9; i < argc; i++){
+        if (!set_option(argv[i])){
+            printf("Invalid option %s\n",argv[i]);
+            return -1;
+        }
+    }
 
     printf("Page size: %u, buffer slots: %u, limit of opened files: %u, buffer replacement policy: %s\n",cf->page_size, cf->buf_slots, cf->file_limit, cf->buf_policy);
 
-    // load data and write database files
-    init_db(argv[6],argv[5]);
+    // open the database from its catalog, or load data and write database files
+    if (cf->startup == STARTUP_LOAD || open_db(argv[6],argv[5],cf->startup == STARTUP_AUTO) == NULL){
+        if (cf->startup == STARTUP_OPEN) return -1;
+        init_db(argv[6],argv[5]);
+    }
     
     
     // implement your initialization function.
@@ -67,82 +97,265 @@ int main(int argc, char **argv){
 
 
 
-// load test cases and test sel and join
-void run(char* ra_path, char* log_path){
+// execute one query line, NULL for comments and invalid queries
+_Table* exec_query(const char* line){
 
-    
+    // lines to write comments
+    if(line[0] == '#') return NULL;
 
-    FILE* query_fp = fopen(ra_path,"r");
-    char line[100];
+    // process selection operator
+    if(line[0] == 's'){
+        char ra[20];
+        UINT idx = 0;
+        INT val = 0;
+        INT val2 = 0;
+        char operator[10];
+        char table_name[50];
 
+        // ra is "sel"
+        // operator is one of =, !=, <, <=, >, >=, BETWEEN
+        // BETWEEN takes the upper bound after the table name
+        INT nargs = sscanf(line,"%s %u %d %s %s %d",ra,&idx,&val,operator,table_name,&val2);
+        INT op = filter_op(operator);
+        if (nargs < 5 || op < 0 || (op == OP_BETWEEN && nargs < 6)){
+            printf("Invalid selection: %s",line);
+            return NULL;
+        }
 
-    // replace the old log file if exists
-    FILE* log_fp = fopen(log_path,"w");
+        return sel(idx,op,val,val2,table_name);
+    }
 
-    while(fgets(line,100,query_fp)){
+    // process join operator
+    if(line[0] == 'j'){
+        char ra[20];
+        UINT idx1 = 0;
+        UINT idx2 = 0;
 
-        // lines to write comments
-        if(line[0] == '#') continue;
+        char table1_name[50];
+        char table2_name[50];
 
-        // process selection operator
-        if(line[0] == 's'){
-            char ra[20];
-            UINT idx = 0;
-            INT val = 0;
-            char operator[10];
-            char table_name[50];
+        // ra is "join"
 
-            // ra is "sel"
-            // operator is not used for now, i.e., only consider "=="
-            // we assume operator is = for simplicity
-            sscanf(line,"%s %u %d %s %s",ra,&idx,&val,operator,table_name);
+        // we assume operator is = for simplicity
+        sscanf(line,"%s %u %s %u %s",ra,&idx1,table1_name,&idx2,table2_name);
 
-            reset_IO();
+        // execute join
+        return join(idx1,table1_name,idx2,table2_name);
+    }
 
-            _Table* result = sel(idx,val,table_name);
-            
+    // build an index, there is no result to log
+    if(strncmp(line,"index",5) == 0){
+        char ra[20];
+        UINT idx = 0;
+        char table_name[50];
+        char type[20] = "btree";
+
+        // ra is "index", the type is btree (default) or hash
+        INT nargs = sscanf(line,"%s %u %s %s",ra,&idx,table_name,type);
+        Table* t = nargs >= 3 ? find_table(table_name) : NULL;
+        if (t == NULL || idx >= t->nattrs || (strcmp(type,"btree") != 0 && strcmp(type,"hash") != 0)){
+            printf("Invalid index: %s",line);
+            return NULL;
+        }
+        create_index(t,idx,strcmp(type,"hash") == 0 ? INDEX_HASH : INDEX_BTREE);
+        return NULL;
+    }
 
-            // write the result to log file
-            logT(result, log_fp);
-            
-            // release the result table
-            freeT(result);
-            
-            continue;
+    // writes change the table files through the buffer, there is no result to log
+    // insert table_name value ... (one value per attribute)
+    if(strncmp(line,"insert",6) == 0){
+        char ra[20];
+        char table_name[50];
+        INT n = 0;
+        sscanf(line,"%s %s %n",ra,table_name,&n);
+        Table* t = n > 0 ? find_table(table_name) : NULL;
+        INT tup[t != NULL ? t->nattrs : 1];
+        UINT nvalues = 0;
+        const char* p = line + n;
+        INT len = 0;
+        while (t != NULL && nvalues < t->nattrs && sscanf(p,"%d%n",&tup[nvalues],&len) == 1){
+            p += len;
+            ++nvalues;
         }
+        if (t == NULL || nvalues < t->nattrs){
+            printf("Invalid insert: %s",line);
+            return NULL;
+        }
+        UINT page = insert_tuple(t,tup);
+        Conf* cf = get_conf();
+        printf("insert into %s: page %u, read_io %u, write_io %u\n",t->name,page,cf->read_io,cf->write_io);
+        return NULL;
+    }
 
-        // process join operator
-        if(line[0] == 'j'){
-            char ra[20];
-            UINT idx1 = 0;
-            UINT idx2 = 0;
+    // delete attribute_index compared_value operator table_name [upper_value]
+    // update set_index new_value attribute_index compared_value operator table_name [upper_value]
+    // the condition is the one of sel
+    if(line[0] == 'd' || line[0] == 'u'){
+        char ra[20];
+        UINT set_idx = 0;
+        INT set_val = 0;
+        UINT idx = 0;
+        INT val = 0;
+        INT val2 = 0;
+        char operator[10];
+        char table_name[50];
+        INT nargs;
+        if (line[0] == 'd'){
+            nargs = sscanf(line,"%s %u %d %s %s %d",ra,&idx,&val,operator,table_name,&val2) + 2;
+        } else {
+            nargs = sscanf(line,"%s %u %d %u %d %s %s %d",ra,&set_idx,&set_val,&idx,&val,operator,table_name,&val2);
+        }
+        INT op = nargs >= 6 ? filter_op(operator) : -1;
+        Table* t = nargs >= 7 ? find_table(table_name) : NULL;
+        if (t == NULL || op < 0 || (op == OP_BETWEEN && nargs < 8) || idx >= t->nattrs || set_idx >= t->nattrs){
+            printf("Invalid %s: %s",line[0] == 'd' ? "delete" : "update",line);
+            return NULL;
+        }
+        if (line[0] == 'd') delete_tuples(t,idx,op,val,val2);
+        else update_tuples(t,set_idx,set_val,idx,op,val,val2);
+        return NULL;
+    }
 
-            char table1_name[50];
-            char table2_name[50];
+    // other operators...
 
-            // ra is "join"
+    return NULL;
+}
 
-            // we assume operator is = for simplicity
-            sscanf(line,"%s %u %s %u %s",ra,&idx1,table1_name,&idx2,table2_name);
+// load test cases and test sel and join
+void run(char* ra_path, char* log_path){
 
-            reset_IO();
-            // execute join
-            _Table* result = join(idx1,table1_name,idx2,table2_name);
+    if (get_conf()->sessions > 1){
+        run_sessions(ra_path, log_path);
+        return;
+    }
 
-            logT(result, log_fp);
+    FILE* query_fp = fopen(ra_path,"r");
+    // getline() grows the buffer, an insert into a wide table is a long line
+    char* line = NULL;
+    size_t line_size = 0;
 
-            freeT(result);
-            
-            continue;
-        }
 
-        // other operators...
+    // replace the old log file if exists
+    FILE* log_fp = fopen(log_path,"w");
+
+    while(getline(&line,&line_size,query_fp) != -1){
 
+        reset_IO();
+        _Table* result = exec_query(line);
+        if (result == NULL) continue;
+
+        // write the result to log file
+        logT(result, log_fp);
+        report_io();
+
+        // release the result table
+        freeT(result);
     }
+    free(line);
     fclose(log_fp);
     fclose(query_fp);
 }
 
+typedef struct Session {   // one client running the query file
+    char** queries;
+    UINT nqueries;
+    UINT first;             // index of the query it starts with
+    FILE* log_fp;           // NULL for all sessions but the first
+    double* latency;        // seconds per query, in the order run
+    UINT ndone;
+} Session;
+
+static double now_sec(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void* run_session(void* arg){
+    Session* s = arg;
+    for (UINT q = 0; q < s->nqueries; ++q){
+        double t0 = now_sec();
+        _Table* result = exec_query(s->queries[(s->first + q) % s->nqueries]);
+        if (result == NULL) continue;
+        s->latency[s->ndone++] = now_sec() - t0;
+        if (s->log_fp != NULL) logT(result, s->log_fp);
+        freeT(result);
+    }
+    return NULL;
+}
+
+static int cmp_double(const void* a, const void* b){
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+// every session runs the whole query file, each starting at another query.
+// the first session starts at the top and writes the log, its read_io
+// counts the reads of all sessions
+void run_sessions(char* ra_path, char* log_path){
+    Conf* cf = get_conf();
+    UINT nsessions = cf->sessions;
+    if (work_slots() < 3){
+        printf("%u buffer slots are too few for %u sessions\n", cf->buf_slots, nsessions);
+        exit(-1);
+    }
+
+    FILE* query_fp = fopen(ra_path,"r");
+    char* line = NULL;
+    size_t line_size = 0;
+    char** queries = NULL;
+    UINT nqueries = 0;
+    while(getline(&line,&line_size,query_fp) != -1){
+        // indexes are built and writes applied before the sessions start
+        if (line[0] == 'i' || line[0] == 'd' || line[0] == 'u'){
+            exec_query(line);
+            continue;
+        }
+        if (line[0] != 's' && line[0] != 'j') continue;
+        queries = realloc(queries, sizeof(char*) * (nqueries + 1));
+        queries[nqueries++] = strdup(line);
+    }
+    free(line);
+    fclose(query_fp);
+
+    FILE* log_fp = fopen(log_path,"w");
+    Session sessions[nsessions];
+    pthread_t threads[nsessions];
+    double* latency = malloc(sizeof(double) * (nqueries * nsessions + 1));
+    reset_IO();
+
+    double t0 = now_sec();
+    for (UINT i = 0; i < nsessions; ++i){
+        sessions[i].queries = queries;
+        sessions[i].nqueries = nqueries;
+        sessions[i].first = nqueries * i / nsessions;
+        sessions[i].log_fp = i == 0 ? log_fp : NULL;
+        sessions[i].latency = latency + nqueries * i;
+        sessions[i].ndone = 0;
+        pthread_create(&threads[i], NULL, run_session, &sessions[i]);
+    }
+    for (UINT i = 0; i < nsessions; ++i) pthread_join(threads[i], NULL);
+    double elapsed = now_sec() - t0;
+
+    // latencies of all sessions, packed and sorted
+    UINT n = 0;
+    for (UINT i = 0; i < nsessions; ++i){
+        memmove(latency + n, sessions[i].latency, sizeof(double) * sessions[i].ndone);
+        n += sessions[i].ndone;
+    }
+    qsort(latency, n, sizeof(double), cmp_double);
+    double p50 = n > 0 ? latency[(n - 1) / 2] : 0;
+    double p99 = n > 0 ? latency[(UINT)((n - 1) * 0.99)] : 0;
+    printf("%u sessions: %u queries in %.3f s, %.1f queries/s, latency p50 %.3f ms, p99 %.3f ms\n",
+           nsessions, n, elapsed, elapsed > 0 ? n / elapsed : 0, p50 * 1e3, p99 * 1e3);
+    report_io();
+
+    free(latency);
+    for (UINT i = 0; i < nqueries; ++i) free(queries[i]);
+    free(queries);
+    fclose(log_fp);
+}
+
 // write a _Table to the log file
 void logT(_Table* t, FILE* log_fp){
     // output to log
@@ -155,27 +368,34 @@ void logT(_Table* t, FILE* log_fp){
     fprintf(log_fp,"%u %u %u\n\n",t->nattrs,t->ntuples,cf->read_io);
 
 
-    for (UINT i = 0; i < t->ntuples; i++){
-        // write each tuple, separate attributes by space
-        for (UINT j = 0; j < t->nattrs; j++){
-                fprintf(log_fp,"%d ", t->tuples[i][j]);
+    for (TupleChunk* c = t->head; c != NULL; c = c->next){
+        const INT* tup = c->data;
+        for (UINT i = 0; i < c->ntuples; i++, tup += t->nattrs){
+            // write each tuple, separate attributes by space
+            for (UINT j = 0; j < t->nattrs; j++){
+                    fprintf(log_fp,"%d ", tup[j]);
+            }
+            // add '\n' to the end of each tuple
+            fprintf(log_fp,"\n");
         }
-        // add '\n' to the end of each tuple
-        fprintf(log_fp,"\n");
     }
     
 }
 
+// print the I/O counters of the last query that the log does not keep
+void report_io(){
+    Conf* cf = get_conf();
+    printf("read_io %u, write_io %u, files opened %u, closed %u\n", cf->read_io, cf->write_io, cf->file_opens, cf->file_closes);
+    if (cf->prefetch_depth > 0)
+        printf("prefetch (%s): %u hits, %u wasted\n", prefetch_backend(), cf->prefetch_hits, cf->prefetch_wasted);
+    if (cf->zonemaps)
+        printf("zone maps: %u pages skipped, %u read\n", cf->pages_skipped, cf->read_io);
+}
+
 // free the space of _Table
 void freeT(_Table* t){
-    if(t == NULL) return;
-
-    // release memory for each tuple
-    for (UINT i = 0; i < t->ntuples; i++){
-        free(t->tuples[i]);
-    }
-    // release the whole table
-    free(t);
+    // release the chunks of tuples and the table
+    free_result(t);
 }
 
 
@@ -0,0 +1,394 @@
+// buffer replacement policies
+// each policy only decides which slot to reuse, request_page() does the rest
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ro.h"
+#include "db.h"
+
+extern Slot* buffer;
+extern UINT nvb;
+
+static Conf* cf = NULL;
+
+static UINT64 ticks = 0;    // logical time for LRU-K
+static UINT nused = 0;      // slots handed out since init, used before evicting anything
+static UINT* free_slots = NULL;     // slots emptied by drop, reused first
+static UINT nfree = 0;
+
+// doubly linked lists of slots, most recent at the head
+typedef struct SlotList {
+    UINT head;
+    UINT tail;
+    UINT size;
+} SlotList;
+
+static SlotList lru;        // LRU / MRU order, 2Q Am queue
+static SlotList a1in;       // 2Q FIFO queue for pages seen once
+
+// 2Q A1out: ring of page ids recently evicted from A1in
+typedef struct Ghost {
+    INT oid;
+    INT64 pid;
+} Ghost;
+
+static Ghost* a1out = NULL;
+static UINT a1out_head = 0;
+static UINT a1out_size = 0;
+static UINT kin = 0;    // 2Q: A1in target size
+static UINT kout = 0;   // 2Q: A1out capacity
+static UINT* ghosts = NULL;     // 2Q: (oid, pid) -> A1out entry, linear probing, NO_SLOT if empty
+static UINT ghost_mask = 0;
+
+static UINT* heap = NULL;       // LRU-K: binary heap of the unpinned slots, the victim first
+static UINT heap_size = 0;
+
+#define Q_NONE 0
+#define Q_A1IN 1
+#define Q_AM 2
+
+static void list_init(SlotList* l){
+    l->head = NO_SLOT;
+    l->tail = NO_SLOT;
+    l->size = 0;
+}
+
+static void list_push_head(SlotList* l, UINT i){
+    buffer[i].prev = NO_SLOT;
+    buffer[i].next = l->head;
+    if (l->head != NO_SLOT) buffer[l->head].prev = i;
+    l->head = i;
+    if (l->tail == NO_SLOT) l->tail = i;
+    ++l->size;
+}
+
+static void list_remove(SlotList* l, UINT i){
+    if (buffer[i].prev != NO_SLOT) buffer[buffer[i].prev].next = buffer[i].next;
+    else l->head = buffer[i].next;
+    if (buffer[i].next != NO_SLOT) buffer[buffer[i].next].prev = buffer[i].prev;
+    else l->tail = buffer[i].prev;
+    buffer[i].prev = NO_SLOT;
+    buffer[i].next = NO_SLOT;
+    --l->size;
+}
+
+// first unpinned slot walking from the tail (from_tail) or from the head
+static UINT list_find_unpinned(SlotList* l, UINT from_tail){
+    UINT i = from_tail ? l->tail : l->head;
+    while (i != NO_SLOT){
+        if (buffer[i].pin == 0) return i;
+        i = from_tail ? buffer[i].prev : buffer[i].next;
+    }
+    return NO_SLOT;
+}
+
+// hand out emptied and never used slots first, the latter in index order
+static UINT take_unused_slot(){
+    if (nfree > 0) return free_slots[--nfree];
+    if (nused < cf->buf_slots) return nused++;
+    return NO_SLOT;
+}
+
+// take an emptied slot out of its list, list based policies only
+static void list_drop(UINT i){
+    if (buffer[i].queue == Q_A1IN) list_remove(&a1in, i);
+    else if (buffer[i].queue == Q_AM) list_remove(&lru, i);
+    buffer[i].queue = Q_NONE;
+    memset(buffer[i].hist, 0, sizeof(buffer[i].hist));
+    free_slots[nfree++] = i;
+}
+
+
+//// CLS: clock sweep with usage counts
+
+// hits run outside the latch, the evictor under it is the only one to
+// decrement usage, so it never underflows
+static void cls_hit(UINT i){
+    __atomic_add_fetch(&buffer[i].usage, 1, __ATOMIC_RELAXED);
+}
+
+static void cls_miss(UINT i){
+    buffer[i].usage = 1;
+}
+
+static void cls_drop(UINT i){
+    buffer[i].usage = 0;
+}
+
+// advance the clock hand, returns the slot it pointed at
+static UINT cls_tick(){
+    UINT cur = __atomic_load_n(&nvb, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&nvb, &cur, (cur + 1) % cf->buf_slots, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    return cur;
+}
+
+static UINT cls_evict(){
+    while (1){  // deadlock may exist
+        UINT i = cls_tick();
+        UINT64 usage = __atomic_load_n(&buffer[i].usage, __ATOMIC_RELAXED);
+        if (__atomic_load_n(&buffer[i].pin, __ATOMIC_ACQUIRE) == 0 && usage == 0) return i;
+        if (usage > 0) __atomic_sub_fetch(&buffer[i].usage, 1, __ATOMIC_RELAXED);
+    }
+}
+
+
+//// LRU / MRU: recency is the time a page was last released
+
+static void list_drop_victim(UINT i){
+    list_remove(&lru, i);
+    buffer[i].queue = Q_NONE;
+}
+
+static void lru_miss(UINT i){
+    buffer[i].queue = Q_AM;
+    list_push_head(&lru, i);
+}
+
+static void lru_unpin(UINT i){
+    list_remove(&lru, i);
+    list_push_head(&lru, i);
+}
+
+static UINT lru_evict(){
+    UINT i = take_unused_slot();
+    if (i != NO_SLOT) return i;
+    i = list_find_unpinned(&lru, 1);
+    if (i != NO_SLOT) list_drop_victim(i);
+    return i;
+}
+
+static UINT mru_evict(){
+    UINT i = take_unused_slot();
+    if (i != NO_SLOT) return i;
+    i = list_find_unpinned(&lru, 0);
+    if (i != NO_SLOT) list_drop_victim(i);
+    return i;
+}
+
+
+//// LRU-K: evict the page with the oldest K-th most recent reference
+// pages referenced fewer than K times go first, oldest last reference first
+// history is only kept while a page is resident
+
+// the heap holds the unpinned slots of the policy, ring slots stay out.
+// a slot leaves it when a hit pins it and comes back when it is unpinned
+
+// slot i is evicted before slot j
+static UINT lruk_before(UINT i, UINT j){
+    UINT64 kth = buffer[i].hist[LRU_K-1], j_kth = buffer[j].hist[LRU_K-1];
+    return kth < j_kth || (kth == j_kth && buffer[i].hist[0] < buffer[j].hist[0]);
+}
+
+static void heap_set(UINT pos, UINT i){
+    heap[pos] = i;
+    buffer[i].heap = pos;
+}
+
+static void heap_up(UINT pos){
+    UINT i = heap[pos];
+    while (pos > 0 && lruk_before(i, heap[(pos - 1) / 2])){
+        heap_set(pos, heap[(pos - 1) / 2]);
+        pos = (pos - 1) / 2;
+    }
+    heap_set(pos, i);
+}
+
+static void heap_down(UINT pos){
+    UINT i = heap[pos];
+    while (2 * pos + 1 < heap_size){
+        UINT c = 2 * pos + 1;
+        if (c + 1 < heap_size && lruk_before(heap[c + 1], heap[c])) ++c;
+        if (!lruk_before(heap[c], i)) break;
+        heap_set(pos, heap[c]);
+        pos = c;
+    }
+    heap_set(pos, i);
+}
+
+static void heap_push(UINT i){
+    heap_set(heap_size, i);
+    heap_up(heap_size++);
+}
+
+static void heap_remove(UINT i){
+    UINT pos = buffer[i].heap;
+    UINT last = heap[--heap_size];
+    buffer[i].heap = NO_SLOT;
+    if (last == i) return;
+    heap_set(pos, last);
+    heap_up(pos);
+    heap_down(buffer[last].heap);
+}
+
+static void lruk_hit(UINT i){
+    for (UINT k = LRU_K - 1; k > 0; --k) buffer[i].hist[k] = buffer[i].hist[k-1];
+    buffer[i].hist[0] = ++ticks;
+    if (buffer[i].heap != NO_SLOT) heap_remove(i);
+}
+
+// also called for unpinned slots a ring hands back
+static void lruk_miss(UINT i){
+    memset(buffer[i].hist, 0, sizeof(buffer[i].hist));
+    buffer[i].hist[0] = ++ticks;
+    if (buffer[i].heap != NO_SLOT) heap_remove(i);
+    if (buffer[i].pin == 0) heap_push(i);
+}
+
+static void lruk_unpin(UINT i){
+    if (buffer[i].pin == 0 && buffer[i].heap == NO_SLOT) heap_push(i);
+}
+
+static UINT lruk_evict(){
+    UINT i = take_unused_slot();
+    if (i != NO_SLOT) return i;
+    if (heap_size == 0) return NO_SLOT;
+    i = heap[0];
+    heap_remove(i);
+    return i;
+}
+
+static void lruk_drop(UINT i){
+    if (buffer[i].heap != NO_SLOT) heap_remove(i);
+    list_drop(i);
+}
+
+
+//// 2Q: new pages enter the A1in FIFO, pages referenced again after
+//// falling out of A1in are promoted to the Am LRU queue
+
+static UINT ghost_hash(INT oid, INT64 pid){
+    UINT64 h = ((UINT64)(UINT)oid << 32 ^ (UINT64)pid) * 0x9E3779B97F4A7C15ULL;
+    return (UINT)(h >> 32) & ghost_mask;
+}
+
+// position of the page's entry in ghosts, NO_SLOT if it is not in A1out
+static UINT ghost_find(INT oid, INT64 pid){
+    for (UINT p = ghost_hash(oid, pid); ghosts[p] != NO_SLOT; p = (p + 1) & ghost_mask){
+        const Ghost* g = &a1out[ghosts[p]];
+        if (g->oid == oid && g->pid == pid) return p;
+    }
+    return NO_SLOT;
+}
+
+// empty position p, moving back the entries after it that probed past it
+static void ghost_unlink(UINT p){
+    UINT hole = p;
+    for (UINT q = (p + 1) & ghost_mask; ghosts[q] != NO_SLOT; q = (q + 1) & ghost_mask){
+        const Ghost* g = &a1out[ghosts[q]];
+        UINT home = ghost_hash(g->oid, g->pid);
+        if (((q - home) & ghost_mask) >= ((q - hole) & ghost_mask)){
+            ghosts[hole] = ghosts[q];
+            hole = q;
+        }
+    }
+    ghosts[hole] = NO_SLOT;
+}
+
+static void ghost_add(INT oid, INT64 pid){
+    // the oldest entry is overwritten once the ring is full
+    if (ghost_find(oid, pid) != NO_SLOT) return;
+    Ghost* g = &a1out[a1out_head];
+    if (a1out_size == kout && g->oid != -1) ghost_unlink(ghost_find(g->oid, g->pid));
+    g->oid = oid;
+    g->pid = pid;
+    UINT p = ghost_hash(oid, pid);
+    while (ghosts[p] != NO_SLOT) p = (p + 1) & ghost_mask;
+    ghosts[p] = a1out_head;
+    a1out_head = (a1out_head + 1) % kout;
+    if (a1out_size < kout) ++a1out_size;
+}
+
+static void twoq_miss(UINT i){
+    UINT p = ghost_find(buffer[i].oid, buffer[i].pid);
+    if (p != NO_SLOT){
+        UINT g = ghosts[p];
+        ghost_unlink(p);
+        a1out[g].oid = -1;
+        a1out[g].pid = -1;
+        buffer[i].queue = Q_AM;
+        list_push_head(&lru, i);
+    } else {
+        buffer[i].queue = Q_A1IN;
+        list_push_head(&a1in, i);
+    }
+}
+
+static void twoq_unpin(UINT i){
+    if (buffer[i].queue != Q_AM) return;
+    list_remove(&lru, i);
+    list_push_head(&lru, i);
+}
+
+static UINT twoq_evict(){
+    UINT i = take_unused_slot();
+    if (i != NO_SLOT) return i;
+
+    UINT from_a1in = a1in.size > kin || lru.size == 0;
+    i = list_find_unpinned(from_a1in ? &a1in : &lru, 1);
+    if (i == NO_SLOT){
+        from_a1in = !from_a1in;
+        i = list_find_unpinned(from_a1in ? &a1in : &lru, 1);
+    }
+    if (i == NO_SLOT) return NO_SLOT;
+
+    if (from_a1in){
+        list_remove(&a1in, i);
+        ghost_add(buffer[i].oid, buffer[i].pid);
+    } else {
+        list_remove(&lru, i);
+    }
+    buffer[i].queue = Q_NONE;
+    return i;
+}
+
+
+static const Policy policies[] = {
+    { "CLS",  cls_hit,   cls_miss,   cls_evict,   NULL,        cls_drop,   1 },
+    { "LRU",  NULL,      lru_miss,   lru_evict,   lru_unpin,   list_drop,  0 },
+    { "MRU",  NULL,      lru_miss,   mru_evict,   lru_unpin,   list_drop,  0 },
+    { "LRUK", lruk_hit,  lruk_miss,  lruk_evict,  lruk_unpin,  lruk_drop,  0 },
+    { "2Q",   NULL,      twoq_miss,  twoq_evict,  twoq_unpin,  list_drop,  0 },
+};
+
+const Policy* init_policy(const char* name){
+    cf = get_conf();
+    ticks = 0;
+    nused = 0;
+    list_init(&lru);
+    list_init(&a1in);
+
+    kin = cf->buf_slots / 4;
+    if (kin == 0) kin = 1;
+    kout = cf->buf_slots / 2;
+    if (kout == 0) kout = 1;
+    a1out = malloc(sizeof(Ghost) * kout);
+    a1out_head = 0;
+    a1out_size = 0;
+    // at most half full, so probe sequences stay short
+    UINT nghosts = 2;
+    while (nghosts < 2 * kout) nghosts <<= 1;
+    ghosts = malloc(sizeof(UINT) * nghosts);
+    for (UINT i = 0; i < nghosts; ++i) ghosts[i] = NO_SLOT;
+    ghost_mask = nghosts - 1;
+    heap = malloc(sizeof(UINT) * cf->buf_slots);
+    heap_size = 0;
+    free_slots = malloc(sizeof(UINT) * cf->buf_slots);
+    nfree = 0;
+
+    for (UINT i = 0; i < sizeof(policies) / sizeof(policies[0]); ++i){
+        if (strcmp(policies[i].name, name) == 0) return &policies[i];
+    }
+    return NULL;
+}
+
+void free_policy(){
+    if (a1out != NULL) free(a1out);
+    a1out = NULL;
+    free(ghosts);
+    ghosts = NULL;
+    free(heap);
+    heap = NULL;
+    if (free_slots != NULL) free(free_slots);
+    free_slots = NULL;
+}
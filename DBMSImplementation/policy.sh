@@ -0,0 +1,52 @@
+# compare buffer replacement policies on the same query files
+# usage: ./policy.sh [policy ...]    default CLS LRU MRU LRUK 2Q
+# prints read_io of every query under each policy; a '*' marks a result
+# whose tuples differ from the expected log (read_io is not compared)
+
+make -s main
+
+test_folder='test'
+policies=${@:-CLS LRU MRU LRUK 2Q}
+
+# the runs are the ./main lines of run.sh, so both cover the same tests with
+# the same page_size buffer_slots max_opened_files and options
+mapfile -t runs < <(grep '^\./main ' run.sh)
+
+# print the read_io column of a log, one query per line, marking results
+# that do not match the expected tuples. the tuples are compared in any
+# order, since concurrent sessions may join in another one
+read_ios(){
+    awk 'FNR == 1 { f++ }
+         /^######/ { q[f]++; getline; split($0, h, " "); io[f, q[f]] = h[3]; hdr[f, q[f]] = h[1] " " h[2]; next }
+         NF > 0 { count[q[f], $0] += f == 1 ? 1 : -1 }
+         END {
+             for (k in count) if (count[k] != 0){ split(k, p, SUBSEP); bad[p[1]] = 1 }
+             for (i = 1; i <= q[1]; i++)
+                 print io[1, i] ((hdr[1, i] != hdr[2, i] || i in bad) ? "*" : "")
+         }' "$1" "$2"
+}
+
+# run every line under each policy, each policy in a database folder of its
+# own, which a startup=open run finds as the run before it left it
+for p in $policies; do
+    db=/tmp/policy_db_$p
+    for r in "${!runs[@]}"; do
+        set -- $(echo "${runs[$r]}" | sed "s/\$policy/$p/; s/\$test_folder/$test_folder/g")
+        case " ${*:10} " in *" startup=open "*) ;; *) rm -rf $db; mkdir -p $db ;; esac
+        log=/tmp/policy_${p}_$r.txt
+        ./main $2 $3 $4 $p $db $7 $8 $log "${@:10}" > /dev/null
+        # a run without an expected log of its own has the tuples of its test's
+        expected=$(dirname $9)/expected_$(basename $9)
+        [ -f $expected ] || expected=$(dirname $9)/expected_log_$(basename $(dirname $9) | sed 's/^test//').txt
+        read_ios $log $expected > $log.io
+    done
+done
+
+for r in "${!runs[@]}"; do
+    set -- $(echo "${runs[$r]}" | sed "s/\$test_folder/$test_folder/g")
+    echo "$(basename $9 .txt) (page_size buffer_slots file_limit: $2 $3 $4${10:+, ${*:10}})"
+    cols=()
+    for p in $policies; do cols+=(/tmp/policy_${p}_$r.txt.io); done
+    (echo $policies | tr ' ' '\t'; paste "${cols[@]}") | sed 's/^/    /'
+    echo
+done
@@ -0,0 +1,413 @@
+// read-ahead backends: io_uring through the raw syscalls (liburing is not
+// required) and a pthread pool of pread() workers as the fallback
+// reads are issued and completed under the buffer manager latch, by
+// whichever session holds it, so the state here needs no lock of its own.
+// the backends just fill frames. read-ahead is skipped when no file entry
+// or no slot can be had without waiting
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "prefetch.h"
+
+#if defined(__linux__) && defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+#define HAVE_URING
+#endif
+
+#define NSTREAMS 8      // files tracked for sequential access at a time
+
+extern Slot* buffer;
+extern UINT npinned;
+
+static Conf* cf = NULL;
+static UINT backend = 0;    // PREFETCH_URING or PREFETCH_THREADS, 0 when off
+static UINT npending = 0;   // reads in flight
+static UINT max_pending = 0;
+
+typedef struct Stream {     // sequential access to one file
+    INT64 oid;
+    UINT64 last_pid;        // last page requested
+    UINT64 ahead;           // last page prefetched
+    UINT64 used;            // tick of the last access, for replacement
+} Stream;
+
+static Stream streams[NSTREAMS];
+static UINT64 ticks = 0;
+
+// the read of slot finished with res bytes (negative errno on failure)
+static void complete(UINT slot, INT res){
+    Slot* s = &buffer[slot];
+    assert(s->io);
+    assert(res >= (INT)sizeof(UINT64));
+    if (res < (INT)cf->page_size) memset(s->frame + res, 0, cf->page_size - res);
+    memcpy(&s->page.pid, s->frame, sizeof(UINT64));
+    s->page.data = (INT*)(s->frame + sizeof(UINT64));
+    s->mapped = 0;
+    s->page_ptr = &s->page;
+    s->dirty = 0;
+    s->io = 0;
+    --npending;
+    // drop the pins taken when the read was issued
+    unpin_file(s->oid);
+    release_page(s->pid, s->oid);
+}
+
+
+//// io_uring
+
+#ifdef HAVE_URING
+
+static INT ring_fd = -1;
+static void* sq_map = NULL;
+static void* cq_map = NULL;
+static size_t sq_map_size = 0;
+static size_t cq_map_size = 0;
+static struct io_uring_sqe* sqes = NULL;
+static size_t sqes_size = 0;
+static unsigned *sq_tail, *sq_mask, *sq_array;
+static unsigned *cq_head, *cq_tail, *cq_mask;
+static struct io_uring_cqe* cqes = NULL;
+static UINT unsubmitted = 0;    // queued in the sq ring, not entered yet
+
+static UINT uring_init(UINT entries){
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    ring_fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (ring_fd < 0) return 0;
+
+    sq_map_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_map_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP){
+        if (cq_map_size > sq_map_size) sq_map_size = cq_map_size;
+        cq_map_size = sq_map_size;
+    }
+    sq_map = mmap(NULL, sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) cq_map = sq_map;
+    else cq_map = mmap(NULL, cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+    sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    sqes = mmap(NULL, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+    if (sq_map == MAP_FAILED || cq_map == MAP_FAILED || sqes == MAP_FAILED){
+        close(ring_fd);
+        ring_fd = -1;
+        return 0;
+    }
+
+    sq_tail = (unsigned*)((char*)sq_map + p.sq_off.tail);
+    sq_mask = (unsigned*)((char*)sq_map + p.sq_off.ring_mask);
+    sq_array = (unsigned*)((char*)sq_map + p.sq_off.array);
+    cq_head = (unsigned*)((char*)cq_map + p.cq_off.head);
+    cq_tail = (unsigned*)((char*)cq_map + p.cq_off.tail);
+    cq_mask = (unsigned*)((char*)cq_map + p.cq_off.ring_mask);
+    cqes = (struct io_uring_cqe*)((char*)cq_map + p.cq_off.cqes);
+    max_pending = p.sq_entries;
+    return 1;
+}
+
+static void uring_submit(UINT slot, INT fd, off_t offset){
+    unsigned tail = *sq_tail;
+    unsigned idx = tail & *sq_mask;
+    struct io_uring_sqe* sqe = &sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = (UINT64)(uintptr_t)buffer[slot].frame;
+    sqe->len = cf->page_size;
+    sqe->off = offset;
+    sqe->user_data = slot;
+    sq_array[idx] = idx;
+    __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ++unsubmitted;
+}
+
+// hand the queued reads to the kernel with one io_uring_enter()
+static void uring_flush(){
+    if (unsubmitted == 0) return;
+    INT n = syscall(__NR_io_uring_enter, ring_fd, unsubmitted, 0, 0, NULL, 0);
+    assert(n == (INT)unsubmitted);
+    unsubmitted = 0;
+}
+
+// complete finished reads, wait for one first if block is set
+static void uring_poll(UINT block){
+    uring_flush();
+    unsigned head = *cq_head;
+    if (block && head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE))
+        syscall(__NR_io_uring_enter, ring_fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+    while (head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)){
+        struct io_uring_cqe* cqe = &cqes[head & *cq_mask];
+        UINT slot = cqe->user_data;
+        INT res = cqe->res;
+        ++head;
+        __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+        complete(slot, res);
+    }
+}
+
+static void uring_free(){
+    if (ring_fd < 0) return;
+    munmap(sqes, sqes_size);
+    if (cq_map != sq_map) munmap(cq_map, cq_map_size);
+    munmap(sq_map, sq_map_size);
+    close(ring_fd);
+    ring_fd = -1;
+    unsubmitted = 0;
+}
+
+#endif
+
+
+//// thread pool, requests and completions go through two rings guarded by one mutex
+
+typedef struct Request {
+    UINT slot;
+    INT fd;
+    off_t offset;
+    INT res;
+} Request;
+
+static pthread_t* workers = NULL;
+static UINT nworkers = 0;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t has_request = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t has_done = PTHREAD_COND_INITIALIZER;
+static Request* requests = NULL;    // submitted, not picked up yet
+static Request* done = NULL;        // finished, not completed yet
+static UINT req_head = 0, req_size = 0;
+static UINT done_head = 0, done_size = 0;
+static UINT stopping = 0;
+
+static void* worker(void* arg){
+    (void)arg;
+    pthread_mutex_lock(&lock);
+    while (1){
+        while (req_size == 0 && !stopping) pthread_cond_wait(&has_request, &lock);
+        if (req_size == 0) break;
+        Request r = requests[req_head];
+        req_head = (req_head + 1) % max_pending;
+        --req_size;
+        pthread_mutex_unlock(&lock);
+
+        r.res = pread(r.fd, buffer[r.slot].frame, cf->page_size, r.offset);
+
+        pthread_mutex_lock(&lock);
+        done[(done_head + done_size) % max_pending] = r;
+        ++done_size;
+        pthread_cond_signal(&has_done);
+    }
+    pthread_mutex_unlock(&lock);
+    return NULL;
+}
+
+static UINT threads_init(UINT entries){
+    max_pending = entries;
+    requests = malloc(sizeof(Request) * entries);
+    done = malloc(sizeof(Request) * entries);
+    req_head = req_size = done_head = done_size = 0;
+    stopping = 0;
+    nworkers = cf->io_threads;
+    workers = malloc(sizeof(pthread_t) * nworkers);
+    for (UINT i = 0; i < nworkers; ++i){
+        if (pthread_create(&workers[i], NULL, worker, NULL) != 0){
+            printf("cannot start prefetch thread\n");
+            exit(-1);
+        }
+    }
+    return 1;
+}
+
+static void threads_submit(UINT slot, INT fd, off_t offset){
+    pthread_mutex_lock(&lock);
+    Request r = { slot, fd, offset, 0 };
+    requests[(req_head + req_size) % max_pending] = r;
+    ++req_size;
+    pthread_cond_signal(&has_request);
+    pthread_mutex_unlock(&lock);
+}
+
+static void threads_poll(UINT block){
+    pthread_mutex_lock(&lock);
+    if (block) while (done_size == 0) pthread_cond_wait(&has_done, &lock);
+    while (done_size > 0){
+        Request r = done[done_head];
+        done_head = (done_head + 1) % max_pending;
+        --done_size;
+        pthread_mutex_unlock(&lock);
+        complete(r.slot, r.res);
+        pthread_mutex_lock(&lock);
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+static void threads_free(){
+    pthread_mutex_lock(&lock);
+    stopping = 1;
+    pthread_cond_broadcast(&has_request);
+    pthread_mutex_unlock(&lock);
+    for (UINT i = 0; i < nworkers; ++i) pthread_join(workers[i], NULL);
+    free(workers);
+    free(requests);
+    free(done);
+    workers = NULL;
+    requests = done = NULL;
+    nworkers = 0;
+}
+
+
+//// backend dispatch
+
+static void submit(UINT slot, INT fd, off_t offset){
+#ifdef HAVE_URING
+    if (backend == PREFETCH_URING){
+        uring_submit(slot, fd, offset);
+        return;
+    }
+#endif
+    threads_submit(slot, fd, offset);
+}
+
+// the reads submitted since the last call are started
+static void flush_reads(){
+#ifdef HAVE_URING
+    if (backend == PREFETCH_URING) uring_flush();
+#endif
+}
+
+static void poll_reads(UINT block){
+    if (npending == 0) return;
+#ifdef HAVE_URING
+    if (backend == PREFETCH_URING){
+        uring_poll(block);
+        return;
+    }
+#endif
+    threads_poll(block);
+}
+
+void init_prefetch(){
+    cf = get_conf();
+    backend = 0;
+    npending = 0;
+    ticks = 0;
+    for (UINT i = 0; i < NSTREAMS; ++i){
+        streams[i].oid = -1;
+        streams[i].used = 0;
+    }
+    if (cf->prefetch_depth == 0) return;
+
+    // every read in flight holds a slot, so buf_slots entries are enough
+    UINT entries = 1;
+    while (entries < cf->buf_slots && entries < 4096) entries <<= 1;
+#ifdef HAVE_URING
+    if (cf->prefetch_io != PREFETCH_THREADS && uring_init(entries)){
+        backend = PREFETCH_URING;
+        return;
+    }
+#endif
+    if (cf->prefetch_io == PREFETCH_URING) printf("io_uring is not available, using threads for prefetch\n");
+    threads_init(entries);
+    backend = PREFETCH_THREADS;
+}
+
+void free_prefetch(){
+    prefetch_drain();
+#ifdef HAVE_URING
+    if (backend == PREFETCH_URING) uring_free();
+#endif
+    if (backend == PREFETCH_THREADS) threads_free();
+    backend = 0;
+}
+
+const char* prefetch_backend(){
+    if (backend == PREFETCH_URING) return "io_uring";
+    if (backend == PREFETCH_THREADS) return "threads";
+    return "none";
+}
+
+void prefetch_wait(UINT slot){
+    while (buffer[slot].io) poll_reads(1);
+}
+
+void prefetch_drain(){
+    while (npending > 0) poll_reads(1);
+}
+
+// stream of oid, the least recently used one is taken over for a new file
+static Stream* find_stream(UINT oid){
+    Stream* victim = &streams[0];
+    for (UINT i = 0; i < NSTREAMS; ++i){
+        if (streams[i].oid == oid) return &streams[i];
+        if (streams[i].used < victim->used) victim = &streams[i];
+    }
+    victim->oid = oid;
+    victim->last_pid = UINT64_MAX - 1;
+    victim->ahead = 0;
+    return victim;
+}
+
+void prefetch_after(UINT oid, UINT64 pid, UINT64 page_id_init, AccessStrategy* strategy){
+    poll_reads(0);
+
+    Stream* st = find_stream(oid);
+    st->used = ++ticks;
+    UINT sequential = pid == st->last_pid + 1;
+    st->last_pid = pid;
+    if (!sequential) return;
+
+    // mapped table files are read ahead by the kernel, a window at a time
+    if (file_mapped(oid)){
+        if (st->ahead <= pid + cf->prefetch_depth / 2){
+            advise_pages(oid, pid + 1 - page_id_init, cf->prefetch_depth, MADV_WILLNEED);
+            st->ahead = pid + cf->prefetch_depth;
+        }
+        return;
+    }
+    if (backend == 0) return;
+
+    // a ring scan reads ahead into its own ring, which must keep room
+    // for the page being processed and the one it recycles next
+    // at most a quarter of the buffer is read ahead
+    UINT depth = cf->prefetch_depth;
+    if (depth > cf->buf_slots / 4) depth = cf->buf_slots / 4;
+    if (strategy != NULL){
+        if (strategy->size < 3) return;
+        if (depth > strategy->size - 2) depth = strategy->size - 2;
+    }
+
+    UINT64 first = st->ahead > pid ? st->ahead + 1 : pid + 1;
+    if (first > pid + depth) return;
+
+    // no free file entry: skip read-ahead rather than wait under the latch
+    INT fd = open_file(oid);
+    if (fd < 0) return;
+    struct stat sb;
+    fstat(fd, &sb);
+    UINT64 npages = sb.st_size / cf->page_size;
+
+    for (UINT64 p = first; p <= pid + depth && p - page_id_init < npages; ++p){
+        st->ahead = p;
+        if (pt_lookup(p, oid) != PT_EMPTY) continue;
+        // keep two slots free of pins for the scan itself
+        if (__atomic_load_n(&npinned, __ATOMIC_RELAXED) + 2 > cf->buf_slots || npending >= max_pending) break;
+
+        // the victim is dirty and its file cannot be opened while ours is
+        UINT slot = request_page_with(p, oid, strategy);
+        if (slot == NO_SLOT) break;
+        buffer[slot].io = 1;
+        buffer[slot].prefetched = 1;
+        buffer[slot].page_id_init = page_id_init;
+        page_loaded(slot);  // requests for the page wait for the read through Slot.io
+        ++npending;
+        log_read_page(p);   // log read page
+        open_file(oid);     // pinned above already, the fd stays open until the read completes
+        submit(slot, fd, (off_t)(p - page_id_init) * cf->page_size);
+    }
+    flush_reads();
+    unpin_file(oid);
+}
@@ -0,0 +1,27 @@
+#ifndef PREFETCH_H
+#define PREFETCH_H
+#include "ro.h"
+
+// read-ahead for sequential page access
+// get_page_with() reports every page it hands out; once a file is read in
+// pid order the next Conf.prefetch_depth pages are claimed in the buffer
+// (pinned, Slot.io set) and read asynchronously, through io_uring when the
+// kernel allows it and a pool of pread() threads otherwise. request_page()
+// waits for a page whose read is still in flight.
+
+void init_prefetch();
+void free_prefetch();
+
+// pid of oid was just requested, strategy is the scan's ring or NULL
+void prefetch_after(UINT oid, UINT64 pid, UINT64 page_id_init, AccessStrategy* strategy);
+
+// finish the read in flight for slot, the slot is unpinned afterwards
+void prefetch_wait(UINT slot);
+
+// finish every read in flight
+void prefetch_drain();
+
+// name of the backend in use, "none" when read-ahead is off
+const char* prefetch_backend();
+
+#endif
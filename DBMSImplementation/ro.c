@@ -2,184 +2,736 @@
 #include <stdlib.h>
 #include "ro.h"
 #include "db.h"
+#include "filter.h"
+#include "sort.h"
+#include "prefetch.h"
+#include "sched.h"
+#include "index.h"
+#include "zonemap.h"
+#include "bloom.h"
+#include "dml.h"
 #include <string.h>
 #include <assert.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
 
 static Conf* cf = NULL;
 static Database* db = NULL;
 Slot* buffer = NULL;
 File_Pointer* opened_files = NULL;
+UINT* free_files = NULL;    // unused opened_files entries
+UINT nfree_files = 0;
+UINT* file_table = NULL;    // oid -> opened_files entry
+UINT file_table_mask = 0;
+UINT file_lru_head = NO_SLOT;   // open files, most recently used first
+UINT file_lru_tail = NO_SLOT;
 UINT nvb = 0;
-UINT idx_cmp_use_only = 0;
+UINT* page_table = NULL;
+const Policy* policy = NULL;
+UINT nstrategies = 0;
+INT8* arena = NULL;     // page frames of all buffer slots
+UINT frame_size = 0;
+UINT ntemp_files = 0;
+UINT page_table_mask = 0;
+UINT npinned = 0;       // slots with pin != 0
+Mapping** mappings = NULL;  // pointers stay valid while the array grows
+UINT nmappings = 0;
+
+// buffer manager latch, sessions and sel() workers share the buffer,
+// mappings, policy and read-ahead through it. open files have their own
+// file_latch. recursive because the entry points call each other, e.g.
+// request_page_with() -> write_page_to_file() -> open_file(). pages are read
+// outside it, and CLS hits and releases only take the lock of a page table
+// stripe
+static pthread_mutex_t bm_latch;
+static pthread_mutex_t pt_locks[PT_LOCKS];
+static pthread_mutex_t load_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t file_latch = PTHREAD_MUTEX_INITIALIZER;  // open file management
+static pthread_cond_t file_unpinned = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t loaded = PTHREAD_COND_INITIALIZER;
+static __thread UINT latch_depth = 0;   // times this thread holds bm_latch
+
+static void latch(){
+    pthread_mutex_lock(&bm_latch);
+    ++latch_depth;
+}
 
-// cmp func for qsort
-int compare_tuples(const void *a, const void *b) {
-    Tuple* tup1 = (Tuple*)a;
-    Tuple* tup2 = (Tuple*)b;
-    Tuple t1 = *tup1;
-    Tuple t2 = *tup2;
-    return t1[idx_cmp_use_only] - t2[idx_cmp_use_only];
+static void unlatch(){
+    --latch_depth;
+    pthread_mutex_unlock(&bm_latch);
 }
 
-UINT request_page(UINT64 pid, UINT oid){    // clock sweep
-    UINT i;
-    for (i = 0; i < cf->buf_slots; i++){
-        if (buffer[i].pid == pid && buffer[i].oid == oid){ // optional: buffer[i].page_ptr != NULL &&
-            buffer[i].usage++;
-            buffer[i].pin = 1;
-            return i;
-        }
+static void wait_file_unpinned();
+
+// page table: chained hash map (oid, pid) -> buffer slot, the chains run
+// through Slot.pt_next. the latch is held to change it, and readers that do
+// not hold the latch take the lock of the bucket's stripe instead, so a hit
+// on a CLS buffer never waits for the latch
+
+static UINT hash_page(UINT oid, UINT64 pid){
+    UINT64 h = ((UINT64)oid << 40) ^ pid;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return (UINT)h & page_table_mask;
+}
+
+static pthread_mutex_t* pt_lock(UINT b){
+    return &pt_locks[b & (PT_LOCKS - 1)];
+}
+
+static UINT pt_find(UINT b, UINT64 pid, UINT oid){
+    for (UINT i = page_table[b]; i != NO_SLOT; i = buffer[i].pt_next){
+        if (buffer[i].pid == (INT64)pid && buffer[i].oid == (INT)oid) return i;
     }
+    return PT_EMPTY;
+}
 
-//    printf("request page pid %llu oid %ul not found in buffer\n", pid, oid);
+UINT pt_lookup(UINT64 pid, UINT oid){
+    return pt_find(hash_page(oid, pid), pid, oid);
+}
+
+static void pt_insert(UINT slot){
+    UINT b = hash_page(buffer[slot].oid, buffer[slot].pid);
+    pthread_mutex_lock(pt_lock(b));
+    buffer[slot].pt_next = page_table[b];
+    page_table[b] = slot;
+    pthread_mutex_unlock(pt_lock(b));
+}
 
-    while (1){  // deadlock may exist
+static void pt_unlink(UINT b, UINT slot){
+    UINT* p = &page_table[b];
+    while (*p != slot) p = &buffer[*p].pt_next;
+    *p = buffer[slot].pt_next;
+    buffer[slot].pt_next = NO_SLOT;
+}
 
-        if (buffer[nvb].pin == 0 && buffer[nvb].usage == 0){
+static void pt_remove(UINT slot){
+    UINT b = hash_page(buffer[slot].oid, buffer[slot].pid);
+    pthread_mutex_lock(pt_lock(b));
+    pt_unlink(b, slot);
+    pthread_mutex_unlock(pt_lock(b));
+}
 
-//            printf("request page pid %llu oid %ul not found in buffer, replace with nvb %ul\n", pid, oid, nvb);
+// pins are counted, a page pinned by several scans stays until the last release
 
-            UINT res_idx = nvb;
-            // read page from disk to buffer[nvb]
+static void pin_slot(UINT i){
+    if (__atomic_fetch_add(&buffer[i].pin, 1, __ATOMIC_ACQ_REL) == 0)
+        __atomic_add_fetch(&npinned, 1, __ATOMIC_RELAXED);
+}
 
-            // release the previous existing page in the very buffer slot
-            if (buffer[i].page_ptr == NULL) log_release_page(pid);  // log release page
+static void unpin_slot(UINT i){
+    UINT64 pin = __atomic_sub_fetch(&buffer[i].pin, 1, __ATOMIC_ACQ_REL);
+    assert(pin != UINT64_MAX);  // released more often than requested
+    if (pin == 0) __atomic_sub_fetch(&npinned, 1, __ATOMIC_RELAXED);
+}
 
-            if (buffer[i].page_ptr != NULL && buffer[i].page_ptr->data != NULL)
-                free(buffer[i].page_ptr->data);
-            if (buffer[i].page_ptr != NULL) free(buffer[i].page_ptr);
+// take slot i out of the page table if nobody pinned it, 0 otherwise.
+// hits outside the latch pin under the bucket lock, so a slot found
+// unpinned here cannot be pinned any more
+static UINT take_victim(UINT i){
+    if (buffer[i].oid == -1) return __atomic_load_n(&buffer[i].pin, __ATOMIC_ACQUIRE) == 0;
+    UINT b = hash_page(buffer[i].oid, buffer[i].pid);
+    pthread_mutex_lock(pt_lock(b));
+    UINT free = __atomic_load_n(&buffer[i].pin, __ATOMIC_ACQUIRE) == 0;
+    if (free) pt_unlink(b, i);
+    pthread_mutex_unlock(pt_lock(b));
+    return free;
+}
 
-            // need to read new page from disk
-            // page_ptr will be assigned outside this function after successful read
-            buffer[nvb].page_ptr = NULL;
-            buffer[nvb].oid = oid;
-            buffer[nvb].pid = pid;
-            buffer[nvb].pin = 1;
-            buffer[nvb].usage = 1;
-            nvb = (nvb + 1) % cf->buf_slots;
-            return res_idx;
-        }
-        else{
-            if (buffer[nvb].usage > 0) buffer[nvb].usage--;
-            nvb = (nvb + 1) % cf->buf_slots;
-        }
+// a slot being read is pinned and in the page table with page_ptr NULL and
+// loading set, other requests for the page wait for page_loaded()
+
+static void wait_loaded(UINT i){
+    if (!__atomic_load_n(&buffer[i].loading, __ATOMIC_ACQUIRE)) return;
+    pthread_mutex_lock(&load_lock);
+    while (buffer[i].loading) pthread_cond_wait(&loaded, &load_lock);
+    pthread_mutex_unlock(&load_lock);
+}
+
+void page_loaded(UINT i){
+    pthread_mutex_lock(&load_lock);
+    __atomic_store_n(&buffer[i].loading, 0, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&loaded);
+    pthread_mutex_unlock(&load_lock);
+}
+
+UINT request_page(UINT64 pid, UINT oid){
+    return request_page_with(pid, oid, NULL);
+}
+
+// bookkeeping of a hit on the pinned slot i, under the latch
+static void hit_slot(UINT i, AccessStrategy* strategy){
+    if (buffer[i].io) prefetch_wait(i);     // read ahead still in flight
+    if (buffer[i].prefetched){
+        buffer[i].prefetched = 0;
+        ++cf->prefetch_hits;
+    }
+    if (buffer[i].ring != 0 && (strategy == NULL || buffer[i].ring != strategy->id)){
+        // someone else wants a page of a ring, hand the slot back to the policy
+        buffer[i].ring = 0;
+        if (policy->miss != NULL) policy->miss(i);
     }
+    else if (buffer[i].ring == 0 && policy->hit != NULL) policy->hit(i);
 }
 
-void release_page(UINT64 pid, UINT oid){    // pin set to 0
-    UINT i;
-    for (i = 0; i < cf->buf_slots; i++){
-        if (buffer[i].pid == pid && buffer[i].oid == oid){
-            buffer[i].pin = 0;
-            return;
+// under the latch: pin the slot of the page, or claim a slot for it,
+// *hit tells which
+static UINT claim_page(UINT64 pid, UINT oid, AccessStrategy* strategy, UINT* hit){
+    UINT i = pt_lookup(pid, oid);
+    *hit = i != PT_EMPTY;
+    if (*hit){
+        pin_slot(i);
+        // a page still being read is waited for outside the latch
+        if (!buffer[i].loading) hit_slot(i, strategy);
+        return i;
+    }
+
+//    printf("request page pid %llu oid %ul not found in buffer\n", pid, oid);
+
+    // recycle the ring slot if the scan still owns it and nobody pinned it
+    i = NO_SLOT;
+    if (strategy != NULL){
+        UINT r = strategy->slots[strategy->cur];
+        if (r != NO_SLOT && buffer[r].ring == strategy->id && take_victim(r)) i = r;
+    }
+    while (i == NO_SLOT){
+        // reads ahead hold pins until they complete
+        if (__atomic_load_n(&npinned, __ATOMIC_RELAXED) >= cf->buf_slots) prefetch_drain();
+        i = policy->evict();
+        assert(i != NO_SLOT);   // all slots are pinned
+        // pinned by a hit since the policy looked at it
+        if (!take_victim(i)) i = NO_SLOT;
+    }
+
+    // a dirty page is written back before its frame is reused. when no file
+    // entry is free the slot goes back, the caller waits outside the latch
+    if (buffer[i].page_ptr != NULL && buffer[i].dirty && !write_page_to_file(&buffer[i])){
+        pt_insert(i);
+        if (buffer[i].ring == 0 && policy->miss != NULL) policy->miss(i);
+        return NO_SLOT;
+    }
+
+    if (buffer[i].prefetched){
+        buffer[i].prefetched = 0;
+        ++cf->prefetch_wasted;
+    }
+
+    // release the previous existing page in the very buffer slot, its frame is reused
+    if (buffer[i].page_ptr != NULL) log_release_page(buffer[i].pid);  // log release page
+
+    // need to read new page from disk
+    // page_ptr will be assigned outside this function after successful read
+    buffer[i].page_ptr = NULL;
+    buffer[i].oid = oid;
+    buffer[i].pid = pid;
+    buffer[i].loading = 1;
+    pin_slot(i);
+    pt_insert(i);
+
+    if (strategy != NULL){
+        // ring slots are kept out of the replacement policy until the scan ends
+        buffer[i].ring = strategy->id;
+        strategy->slots[strategy->cur] = i;
+        strategy->cur = (strategy->cur + 1) % strategy->size;
+    } else {
+        buffer[i].ring = 0;
+        if (policy->miss != NULL) policy->miss(i);
+    }
+    return i;
+}
+
+UINT request_page_with(UINT64 pid, UINT oid, AccessStrategy* strategy){
+    UINT i = PT_EMPTY;
+    if (policy->concurrent){
+        // hit without the latch: pin under the bucket lock
+        UINT b = hash_page(oid, pid);
+        pthread_mutex_lock(pt_lock(b));
+        i = pt_find(b, pid, oid);
+        if (i != PT_EMPTY) pin_slot(i);
+        pthread_mutex_unlock(pt_lock(b));
+    }
+    if (i != PT_EMPTY){
+        wait_loaded(i);
+        UINT ring = __atomic_load_n(&buffer[i].ring, __ATOMIC_RELAXED);
+        if (__atomic_load_n(&buffer[i].io, __ATOMIC_RELAXED) || __atomic_load_n(&buffer[i].prefetched, __ATOMIC_RELAXED)
+            || (ring != 0 && (strategy == NULL || ring != strategy->id))){
+            latch();
+            hit_slot(i, strategy);
+            unlatch();
         }
+        else if (ring == 0) policy->hit(i);
+        return i;
+    }
+
+    UINT hit;
+    while (1){
+        latch();
+        i = claim_page(pid, oid, strategy, &hit);
+        unlatch();
+        if (i != NO_SLOT || latch_depth > 0) break;
+        wait_file_unpinned();
     }
+    if (i == NO_SLOT) return NO_SLOT;
+    if (hit && buffer[i].loading){
+        wait_loaded(i);
+        latch();
+        hit_slot(i, strategy);
+        unlatch();
+    }
+    return i;
 }
 
-// file ptr management
+void release_page(UINT64 pid, UINT oid){    // pin count decremented
+    if (policy->concurrent){
+        UINT b = hash_page(oid, pid);
+        pthread_mutex_lock(pt_lock(b));
+        UINT i = pt_find(b, pid, oid);
+        if (i != PT_EMPTY) unpin_slot(i);
+        pthread_mutex_unlock(pt_lock(b));
+        return;
+    }
+    latch();
+    UINT i = pt_lookup(pid, oid);
+    if (i != PT_EMPTY){
+        unpin_slot(i);
+        if (buffer[i].ring == 0 && policy->unpin != NULL) policy->unpin(i);
+    }
+    unlatch();
+}
 
-void unpin_file(UINT oid){    // file open management
-    UINT i;
-    for (i = 0; i < cf->file_limit; ++i){
-        if (opened_files[i].oid == oid){
-            opened_files[i].pin = 0;
-            return;
-        }
+// slots a query may pin at a time. concurrent sessions split the buffer,
+// leaving an eighth for the rings of their scans
+UINT work_slots(){
+    if (cf->sessions <= 1) return cf->buf_slots;
+    return (cf->buf_slots - cf->buf_slots / 8) / cf->sessions;
+}
+
+// buffer access strategies
+// like PostgreSQL's BAS_BULKREAD, a sequential scan of a table larger than a
+// quarter of the buffer only recycles a small ring of slots, so it does not
+// push the hot pages of other tables out of the buffer
+
+AccessStrategy* get_access_strategy(UINT hint, UINT npages){
+    if (hint != ACCESS_SEQUENTIAL || npages <= work_slots() / 4) return NULL;
+
+    UINT size = work_slots() / 8;
+    if (size > RING_SLOTS) size = RING_SLOTS;
+    if (size == 0) return NULL;     // buffer too small to spare a ring
+
+    AccessStrategy* strategy = malloc(sizeof(AccessStrategy) + size * sizeof(UINT));
+    latch();
+    strategy->id = ++nstrategies;
+    unlatch();
+    strategy->size = size;
+    strategy->cur = 0;
+    for (UINT i = 0; i < size; ++i) strategy->slots[i] = NO_SLOT;
+    return strategy;
+}
+
+void free_access_strategy(AccessStrategy* strategy){
+    if (strategy == NULL) return;
+    // slots still owned by the ring become ordinary buffer pages
+    latch();
+    for (UINT i = 0; i < strategy->size; ++i){
+        UINT r = strategy->slots[i];
+        if (r == NO_SLOT || buffer[r].ring != strategy->id) continue;
+        buffer[r].ring = 0;
+        if (policy->miss != NULL) policy->miss(r);
     }
+    unlatch();
+    free(strategy);
 }
 
-void close_file(UINT oid){    // file open management
-    UINT i;
-    for (i = 0; i < cf->file_limit; ++i){
-        if (opened_files[i].oid == oid){
-
-            if (opened_files[i].fp != NULL) fclose(opened_files[i].fp);
-            opened_files[i].fp = NULL;
-            opened_files[i].oid = -1;
-            opened_files[i].pin = 0;
-            log_close_file(oid);    // log close file
-            return;
-        }
+// file ptr management
+// open files are found through a hash map oid -> opened_files entry and kept
+// in an LRU list, open_file() closes the least recently used unpinned file
+// once file_limit files are open. pins are counted, so every open_file()
+// needs its own unpin_file()
+
+static UINT hash_oid(UINT oid){
+    return (UINT)(((UINT64)oid * 0x9E3779B97F4A7C15ULL) >> 32) & file_table_mask;
+}
+
+static UINT ft_lookup(UINT oid){
+    UINT h = hash_oid(oid);
+    while (file_table[h] != NO_SLOT){
+        if (opened_files[file_table[h]].oid == oid) return file_table[h];
+        h = (h + 1) & file_table_mask;
     }
+    return NO_SLOT;
 }
 
-FILE* open_file(UINT oid){    // file open management
-    // return file pointer if already opened
-    UINT i;
-    for (i = 0; i < cf->file_limit; ++i){
-        if (opened_files[i].oid == oid && opened_files[i].fp != NULL){
-            opened_files[i].pin = 1;
-            return opened_files[i].fp;
+static void ft_insert(UINT oid, UINT e){
+    UINT h = hash_oid(oid);
+    while (file_table[h] != NO_SLOT) h = (h + 1) & file_table_mask;
+    file_table[h] = e;
+}
+
+// take oid out of the open file table. the entries after it in its probe
+// run move back into the hole unless that is before their home, so a
+// lookup never stops at a gap in front of its entry
+static void ft_remove(UINT oid){
+    UINT h = hash_oid(oid);
+    while (file_table[h] != NO_SLOT && opened_files[file_table[h]].oid != oid)
+        h = (h + 1) & file_table_mask;
+    if (file_table[h] == NO_SLOT) return;
+
+    UINT hole = h;
+    UINT next = (h + 1) & file_table_mask;
+    while (file_table[next] != NO_SLOT){
+        UINT home = hash_oid(opened_files[file_table[next]].oid);
+        if (((next - home) & file_table_mask) >= ((next - hole) & file_table_mask)){
+            file_table[hole] = file_table[next];
+            hole = next;
         }
+        next = (next + 1) & file_table_mask;
     }
+    file_table[hole] = NO_SLOT;
+}
 
-    // find an empty file_ptr slot & open file, return file pointer
-    for (i = 0; i < cf->file_limit; ++i){
-        if (opened_files[i].oid == -1){
-            char table_path[200];
-            sprintf(table_path,"%s/%u",db->path,oid);
+static void file_lru_remove(UINT e){
+    File_Pointer* f = &opened_files[e];
+    if (f->prev != NO_SLOT) opened_files[f->prev].next = f->next;
+    else file_lru_head = f->next;
+    if (f->next != NO_SLOT) opened_files[f->next].prev = f->prev;
+    else file_lru_tail = f->prev;
+    f->prev = f->next = NO_SLOT;
+}
 
-            opened_files[i].fp = fopen(table_path,"r");
-            assert(opened_files[i].fp != NULL);
-            opened_files[i].oid = oid;
-            opened_files[i].pin = 1;
+static void file_lru_push(UINT e){
+    File_Pointer* f = &opened_files[e];
+    f->prev = NO_SLOT;
+    f->next = file_lru_head;
+    if (file_lru_head != NO_SLOT) opened_files[file_lru_head].prev = e;
+    file_lru_head = e;
+    if (file_lru_tail == NO_SLOT) file_lru_tail = e;
+}
 
-            log_open_file(oid); // log open file
-            return opened_files[i].fp;
-        }
+void unpin_file(UINT oid){    // file open management
+    pthread_mutex_lock(&file_latch);
+    UINT e = ft_lookup(oid);
+    if (e != NO_SLOT){
+        assert(opened_files[e].pin > 0);
+        if (--opened_files[e].pin == 0) pthread_cond_broadcast(&file_unpinned);
     }
+    pthread_mutex_unlock(&file_latch);
+}
 
-    // if all slots are used, check if any file is not pinned
-    for (i = 0; i < cf->file_limit; ++i){
+// reads ahead keep their file pinned, so an unpinned fd has no read in flight
+static void close_entry(UINT e){
+    File_Pointer* f = &opened_files[e];
+    close(f->fd);
+    log_close_file(f->oid);    // log close file
+    ft_remove(f->oid);
+    file_lru_remove(e);
+    f->fd = -1;
+    f->oid = -1;
+    f->pin = 0;
+    free_files[nfree_files++] = e;
+}
 
-        if (opened_files[i].pin == 0){
+void close_file(UINT oid){    // file open management
+    pthread_mutex_lock(&file_latch);
+    UINT e = ft_lookup(oid);
+    if (e != NO_SLOT){
+        assert(opened_files[e].pin == 0);
+        close_entry(e);
+    }
+    pthread_mutex_unlock(&file_latch);
+}
 
-            // close the old file
-            if (opened_files[i].fp != NULL){
-                fclose(opened_files[i].fp);
-                log_close_file(oid);    // log close file
-            }
-            opened_files[i].fp = NULL;
-            opened_files[i].oid = -1;
-            opened_files[i].pin = 0;
+static INT claim_file(UINT oid){
+    // return file descriptor if already opened
+    UINT e = ft_lookup(oid);
+    if (e != NO_SLOT){
+        ++opened_files[e].pin;
+        file_lru_remove(e);
+        file_lru_push(e);
+        return opened_files[e].fd;
+    }
 
-            // reassign file pointer
-            char table_path[200];
-            sprintf(table_path,"%s/%u",db->path,oid);
+    // at the limit, close the least recently used file nobody has pinned
+    if (nfree_files == 0){
+        UINT victim = file_lru_tail;
+        while (victim != NO_SLOT && opened_files[victim].pin != 0) victim = opened_files[victim].prev;
+        if (victim == NO_SLOT) return -1;
+        close_entry(victim);
+    }
 
-            opened_files[i].fp = fopen(table_path,"r");
-            assert(opened_files[i].fp != NULL);
-            opened_files[i].oid = oid;
-            opened_files[i].pin = 1;
+    char table_path[200];
+    sprintf(table_path,"%s/%u",db->path,oid);
+    e = free_files[--nfree_files];
+    opened_files[e].fd = open(table_path, O_RDWR);
+    assert(opened_files[e].fd >= 0);
+    opened_files[e].oid = oid;
+    opened_files[e].pin = 1;
+    ft_insert(oid, e);
+    file_lru_push(e);
+
+    log_open_file(oid); // log open file
+    return opened_files[e].fd;
+}
 
-            log_open_file(oid); // log open file
-            return opened_files[i].fp;
-        }
+// wait up to a millisecond for unpin_file(), under file_latch
+static void timed_wait_unpinned(){
+    struct timespec until;
+    clock_gettime(CLOCK_REALTIME, &until);
+    until.tv_nsec += 1000000;
+    if (until.tv_nsec >= 1000000000){
+        until.tv_sec++;
+        until.tv_nsec -= 1000000000;
+    }
+    pthread_cond_timedwait(&file_unpinned, &file_latch, &until);
+}
+
+static void wait_file_unpinned(){
+    pthread_mutex_lock(&file_latch);
+    timed_wait_unpinned();
+    pthread_mutex_unlock(&file_latch);
+}
 
+INT open_file(UINT oid){    // file open management
+    pthread_mutex_lock(&file_latch);
+    INT fd;
+    while ((fd = claim_file(oid)) < 0){
+        // every open file is pinned: finish the reads ahead holding pins
+        pthread_mutex_unlock(&file_latch);
+        latch();
+        prefetch_drain();
+        unlatch();
+        pthread_mutex_lock(&file_latch);
+        if ((fd = claim_file(oid)) >= 0) break;
+        // a session holding a pin may need the latch to release it,
+        // so under the latch give up instead of waiting
+        if (latch_depth > 0) break;
+        timed_wait_unpinned();
     }
+    pthread_mutex_unlock(&file_latch);
+    return fd;
+}
 
-    // reached the limitation, return NULL
-    return NULL;
+// page id stored at the start of the file of oid
+UINT64 read_first_pid(UINT oid){
+    UINT64 pid = 0;
+    INT fd = open_file(oid);
+    assert(fd >= 0);
+    ssize_t n = pread(fd, &pid, sizeof(UINT64), 0);
+    assert(n == 0 || n == sizeof(UINT64));
+    unpin_file(oid);
+    return pid;
 }
 
+UINT file_mapped(UINT oid){
+    return cf->storage == STORAGE_MMAP && oid < INDEX_OID_BASE;
+}
+
+// mapping of a table file in storage=mmap mode, NULL otherwise
+static Mapping* get_mapping(UINT oid){
+    if (!file_mapped(oid)) return NULL;
+    latch();
+    for (UINT i = 0; i < nmappings; ++i){
+        if (mappings[i]->oid == oid){
+            unlatch();
+            return mappings[i];
+        }
+    }
+
+    // no free file entry under the latch, the page is read with pread()
+    INT fd = open_file(oid);
+    if (fd < 0){
+        unlatch();
+        return NULL;
+    }
+    struct stat sb;
+    fstat(fd, &sb);
+    mappings = realloc(mappings, sizeof(Mapping*) * (nmappings + 1));
+    Mapping* m = malloc(sizeof(Mapping));
+    mappings[nmappings++] = m;
+    m->oid = oid;
+    m->size = sb.st_size;
+    m->addr = NULL;
+    m->sequential = 0;
+    if (m->size > 0){
+        m->addr = mmap(NULL, m->size, PROT_READ, MAP_SHARED, fd, 0);
+        assert(m->addr != MAP_FAILED);
+    }
+    unpin_file(oid);
+    unlatch();
+    return m;
+}
 
-Page* read_page_from_file(UINT oid, UINT64 pid, UINT64 page_id_init){
-    Page* page;
-    FILE* table_fp = open_file(oid);
-    assert(table_fp != NULL);
+UINT advise_pages(UINT oid, UINT64 first, UINT64 n, INT advice){    // under the latch
+    Mapping* m = get_mapping(oid);
+    if (m == NULL) return 0;
+    size_t offset = first * cf->page_size;
+    if (offset >= m->size) return 1;
+    size_t len = n * cf->page_size;
+    if (len > m->size - offset) len = m->size - offset;
+    madvise(m->addr + offset, len, advice);
+    return 1;
+}
 
-    page = malloc(sizeof(Page));
-    page->data = malloc(cf->page_size-sizeof(UINT64));
+// read a page into the frame of the slot, one pread() per page
+// mapped table pages are not copied, the page points into the mapping
+Page* read_page_from_file(UINT oid, UINT64 pid, UINT64 page_id_init, Slot* slot){
+    Page* page = &slot->page;
+    off_t offset = (off_t)(pid-page_id_init) * cf->page_size;
+    slot->page_id_init = page_id_init;
+    slot->dirty = 0;
+
+    Mapping* m = get_mapping(oid);
+    if (m != NULL && (size_t)offset + cf->page_size <= m->size){
+        INT8* p = m->addr + offset;
+        memcpy(&page->pid, p, sizeof(UINT64));
+        page->data = (INT*)(p + sizeof(UINT64));
+        slot->mapped = 1;
+        log_read_page(pid); // log read page
+        return page;
+    }
 
-    fseek(table_fp, (pid-page_id_init) * cf->page_size, SEEK_SET);
-    fread(&page->pid, sizeof(UINT64), 1, table_fp);
-    fread(page->data, sizeof(INT), (cf->page_size-sizeof(UINT64))/sizeof(INT), table_fp);
+    INT fd = open_file(oid);
+    assert(fd >= 0);
+    ssize_t n = pread(fd, slot->frame, cf->page_size, offset);
+    assert(n >= (ssize_t)sizeof(UINT64));
+    if (n < (ssize_t)cf->page_size) memset(slot->frame + n, 0, cf->page_size - n);
+    memcpy(&page->pid, slot->frame, sizeof(UINT64));
+    page->data = (INT*)(slot->frame + sizeof(UINT64));
+    slot->mapped = 0;
     unpin_file(oid);
 
     log_read_page(pid); // log read page
     return page;
 }
 
+// request a page and load it from disk on a miss, the page stays pinned
+Page* get_page(UINT oid, UINT64 pid, UINT64 page_id_init){
+    return get_page_with(oid, pid, page_id_init, NULL);
+}
+
+Page* get_page_with(UINT oid, UINT64 pid, UINT64 page_id_init, AccessStrategy* strategy){
+    // a slot claimed for the page comes back with page_ptr NULL. only a
+    // caller under the latch gets NO_SLOT, and that must not get pages
+    UINT slot = request_page_with(pid, oid, strategy);
+    assert(slot != NO_SLOT);
+    if (buffer[slot].page_ptr == NULL){
+        buffer[slot].page_ptr = read_page_from_file(oid, pid, page_id_init, &buffer[slot]);
+        // a ring scan reads the whole mapping in order
+        if (strategy != NULL && buffer[slot].mapped){
+            Mapping* m = get_mapping(oid);
+            latch();
+            if (!m->sequential) madvise(m->addr, m->size, MADV_SEQUENTIAL);
+            m->sequential = 1;
+            unlatch();
+        }
+        page_loaded(slot);
+    }
+    if (cf->prefetch_depth > 0){
+        latch();
+        prefetch_after(oid, pid, page_id_init, strategy);
+        unlatch();
+    }
+    return buffer[slot].page_ptr;
+}
+
+// write the frame of a dirty slot back to its file
+UINT write_page_to_file(Slot* slot){
+    INT fd = open_file(slot->oid);
+    if (fd < 0) return 0;
+
+    off_t offset = (off_t)(slot->pid - slot->page_id_init) * cf->page_size;
+    ssize_t n = pwrite(fd, slot->frame, cf->page_size, offset);
+    assert(n == (ssize_t)cf->page_size);
+    unpin_file(slot->oid);
+    slot->dirty = 0;
+
+    log_write_page(slot->pid);  // log write page
+    return 1;
+}
+
+// a zeroed page that does not exist on disk yet, pinned and dirty
+Page* new_page(UINT oid, UINT64 pid, UINT64 page_id_init){
+    UINT i = request_page(pid, oid);
+    assert(i != NO_SLOT);   // not called under the latch
+    Slot* slot = &buffer[i];
+    memset(slot->frame, 0, cf->page_size);
+    memcpy(slot->frame, &pid, sizeof(UINT64));
+    slot->page.pid = pid;
+    slot->page.data = (INT*)(slot->frame + sizeof(UINT64));
+    slot->mapped = 0;
+    slot->page_id_init = page_id_init;
+    slot->page_ptr = &slot->page;
+    slot->dirty = 1;
+    if (slot->loading) page_loaded(i);
+    return slot->page_ptr;
+}
+
+void mark_dirty(UINT64 pid, UINT oid){
+    latch();
+    UINT i = pt_lookup(pid, oid);
+    if (i != PT_EMPTY){
+        if (buffer[i].mapped){
+            // the mapping is read-only, continue on a copy in the frame
+            memcpy(buffer[i].frame, (INT8*)buffer[i].page.data - sizeof(UINT64), cf->page_size);
+            buffer[i].page.data = (INT*)(buffer[i].frame + sizeof(UINT64));
+            buffer[i].mapped = 0;
+        }
+        buffer[i].dirty = 1;
+    }
+    unlatch();
+}
+
+// drop every buffered page of a file without writing it back
+void discard_pages(UINT oid){
+    latch();
+    prefetch_drain();
+    for (UINT i = 0; i < cf->buf_slots; ++i){
+        if (buffer[i].oid != (INT)oid) continue;
+        assert(buffer[i].pin == 0);
+        if (buffer[i].prefetched){
+            buffer[i].prefetched = 0;
+            ++cf->prefetch_wasted;
+        }
+        if (buffer[i].ring != 0){
+            buffer[i].ring = 0;
+            if (policy->miss != NULL) policy->miss(i);
+        }
+        pt_remove(i);
+        if (buffer[i].page_ptr != NULL) log_release_page(buffer[i].pid);  // log release page
+        buffer[i].page_ptr = NULL;
+        buffer[i].oid = -1;
+        buffer[i].pid = -1;
+        buffer[i].dirty = 0;
+        if (policy->drop != NULL) policy->drop(i);
+    }
+    unlatch();
+}
+
+// temp files of operators, named by oids no table uses
+
+UINT create_temp_file(){
+    UINT oid = TEMP_OID_BASE + __atomic_fetch_add(&ntemp_files, 1, __ATOMIC_RELAXED);
+    char table_path[200];
+    sprintf(table_path,"%s/%u",db->path,oid);
+    INT fd = open(table_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    assert(fd >= 0);
+    close(fd);
+    return oid;
+}
+
+void drop_temp_file(UINT oid){
+    discard_pages(oid);
+    close_file(oid);
+    char table_path[200];
+    sprintf(table_path,"%s/%u",db->path,oid);
+    unlink(table_path);
+}
+
 
 
 void init(){
@@ -196,7 +748,21 @@ void init(){
         exit(-1);
     }
 
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&bm_latch, &attr);
+    pthread_mutexattr_destroy(&attr);
+
     // initialize buffer here.
+    // every slot owns a fixed frame in one page aligned arena, frames are
+    // padded to 8 bytes so the tuple data after the page id stays aligned
+    frame_size = (cf->page_size + sizeof(UINT64) - 1) & ~(sizeof(UINT64) - 1);
+    size_t arena_size = ((size_t)frame_size * cf->buf_slots + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    int err = posix_memalign((void**)&arena, ARENA_ALIGN, arena_size);
+    assert(err == 0);
+    memset(arena, 0, arena_size);
+
     buffer = malloc(sizeof(Slot) * cf->buf_slots);
     for (i = 0; i < cf->buf_slots; i++){
         buffer[i].oid = -1;
@@ -204,15 +770,62 @@ void init(){
         buffer[i].pin = 0;
         buffer[i].usage = 0;
         buffer[i].page_ptr = NULL;
+        buffer[i].frame = arena + (size_t)frame_size * i;
+        buffer[i].page.pid = -1;
+        buffer[i].page.data = (INT*)(buffer[i].frame + sizeof(UINT64));
+        buffer[i].prev = NO_SLOT;
+        buffer[i].next = NO_SLOT;
+        buffer[i].queue = 0;
+        buffer[i].ring = 0;
+        buffer[i].dirty = 0;
+        buffer[i].page_id_init = 0;
+        buffer[i].io = 0;
+        buffer[i].prefetched = 0;
+        buffer[i].mapped = 0;
+        buffer[i].loading = 0;
+        buffer[i].pt_next = NO_SLOT;
+        memset(buffer[i].hist, 0, sizeof(buffer[i].hist));
+        buffer[i].heap = NO_SLOT;
+    }
+    nvb = 0;
+    npinned = 0;
+
+    policy = init_policy(cf->buf_policy);
+    if (policy == NULL){
+        printf("Unknown buffer replacement policy %s.\n", cf->buf_policy);
+        exit(-1);
     }
 
+    // page table, twice as many buckets as slots so chains stay short
+    UINT pt_size = 1;
+    while (pt_size < 2 * cf->buf_slots) pt_size <<= 1;
+    page_table = malloc(sizeof(UINT) * pt_size);
+    for (i = 0; i < pt_size; i++) page_table[i] = NO_SLOT;
+    page_table_mask = pt_size - 1;
+    for (i = 0; i < PT_LOCKS; i++) pthread_mutex_init(&pt_locks[i], NULL);
+
+    init_prefetch();
+    load_zone_maps();
+
     // open file management
+    assert(cf->file_limit > 0);
     opened_files = malloc(sizeof(File_Pointer) * cf->file_limit);
-    for (i = 0; i < cf->file_limit; ++i) {
-        opened_files[i].fp = NULL;
-        opened_files[i].oid = -1;
-        opened_files[i].pin = 0;
+    free_files = malloc(sizeof(UINT) * cf->file_limit);
+    nfree_files = 0;
+    for (i = cf->file_limit; i > 0; --i) {
+        opened_files[i-1].fd = -1;
+        opened_files[i-1].oid = -1;
+        opened_files[i-1].pin = 0;
+        opened_files[i-1].prev = NO_SLOT;
+        opened_files[i-1].next = NO_SLOT;
+        free_files[nfree_files++] = i-1;    // entry 0 is handed out first
     }
+    UINT ft_size = 1;
+    while (ft_size < 2 * cf->file_limit) ft_size <<= 1;
+    file_table = malloc(sizeof(UINT) * ft_size);
+    for (i = 0; i < ft_size; i++) file_table[i] = NO_SLOT;
+    file_table_mask = ft_size - 1;
+    file_lru_head = file_lru_tail = NO_SLOT;
 
     printf("init() is invoked.\n");
 }
@@ -225,13 +838,24 @@ void release(){
 
     UINT i;
 
+    // finish the reads ahead before the frames and files go away
+    free_prefetch();
+    free_indexes();
+
+    for (i = 0; i < nmappings; ++i){
+        if (mappings[i]->addr != NULL) munmap(mappings[i]->addr, mappings[i]->size);
+        free(mappings[i]);
+    }
+    free(mappings);
+    mappings = NULL;
+    nmappings = 0;
+
     // release buffer & pages inside buffer
     if (buffer != NULL){
         for (i = 0; i < cf->buf_slots; ++i) {
             if (buffer[i].page_ptr != NULL) {
-                if (buffer[i].page_ptr != NULL && buffer[i].page_ptr->data != NULL)
-                    free(buffer[i].page_ptr->data);
-                if (buffer[i].page_ptr != NULL) free(buffer[i].page_ptr);
+                if (buffer[i].dirty) write_page_to_file(&buffer[i]);
+                log_release_page(buffer[i].pid);    // log release page
 
                 // reinitialize buffer slot (optional)
                 buffer[i].page_ptr = NULL;
@@ -239,37 +863,105 @@ void release(){
                 buffer[i].pin = 0;
                 buffer[i].usage = 0;
                 buffer[i].oid = -1;
-
-                log_release_page(buffer[i].pid);    // log release page
             }
         }
         free(buffer);
+        buffer = NULL;
     }
 
+    // release the page frames
+    if (arena != NULL){
+        free(arena);
+        arena = NULL;
+    }
+
+    if (page_table != NULL){
+        free(page_table);
+        page_table = NULL;
+    }
+    free_policy();
+
 
     // release file_open management
     if (opened_files != NULL){
-        for (i = 0; i < cf->file_limit; ++i) {
-            if (opened_files[i].fp != NULL) {
-                fclose(opened_files[i].fp);
-                log_close_file(opened_files[i].oid);  // log close file
-
-                // reinitialize file_open slot (optional)
-                opened_files[i].fp = NULL;
-                opened_files[i].oid = -1;
-            }
-        }
+        while (file_lru_head != NO_SLOT) close_entry(file_lru_head);
         free(opened_files);
+        free(free_files);
+        free(file_table);
+        opened_files = NULL;
+        free_files = NULL;
+        file_table = NULL;
     }
 
+    // the dirty pages are on disk, finish the tables that were changed
+    finish_writes();
+    free_zone_maps();
+
+    pthread_mutex_destroy(&bm_latch);
+    for (i = 0; i < PT_LOCKS; i++) pthread_mutex_destroy(&pt_locks[i]);
+
     printf("release() is invoked.\n");
 }
 
-int cmp_func (const void * a, const void * b) {
-   return ( *(INT*)a - *(INT*)b );
+typedef struct SelTask {   // pages [first, last) of a sel() scan
+    UINT oid;
+    UINT64 page_id_init;
+    UINT first;
+    UINT last;
+    UINT npages;            // of the whole table
+    UINT nattrs;
+    UINT ntuples_per_page;
+    UINT ntuples_last_page;
+    UINT idx;
+    UINT op;
+    INT val;
+    INT val2;
+    const ZoneMap* zm;      // NULL to read every page
+    _Table* result;         // selected tuples of the range
+} SelTask;
+
+static void* sel_scan(void* arg){
+    SelTask* task = arg;
+    UINT nattrs = task->nattrs;
+
+    // full scan, keep it from flushing the buffer
+    AccessStrategy* strategy = get_access_strategy(ACCESS_SEQUENTIAL, task->npages);
+
+    // match bitmap of a page
+    UINT64 match[FILTER_WORDS(task->ntuples_per_page)];
+    UINT skipped = 0;
+
+    // loop through the pages of the range
+    for (UINT i = task->first; i < task->last; ++i){
+        // leave pages the zone map rules out on disk
+        if (!zone_match(task->zm, i, task->idx, task->op, task->val, task->val2)){
+            ++skipped;
+            continue;
+        }
+        UINT64 pid = task->page_id_init + i;
+        // read from file if the page is not buffered
+        Page* cur_page = get_page_with(task->oid, pid, task->page_id_init, strategy);
+        UINT ntuples_of_cur_page = i == task->npages-1 ? task->ntuples_last_page : task->ntuples_per_page;
+
+        // choose the tuples that satisfy the condition in current page
+        filter_page(cur_page->data, ntuples_of_cur_page, nattrs, task->idx, task->op, task->val, task->val2, match);
+        for (UINT j = 0; j < FILTER_WORDS(ntuples_of_cur_page); ++j){
+            for (UINT64 w = match[j]; w != 0; w &= w - 1){
+                // copy the tuple to result table
+                UINT k = j * 64 + __builtin_ctzll(w);
+                memcpy(append_tuple(task->result), cur_page->data + k*nattrs, sizeof(INT)*nattrs);
+            }
+        }
+
+        // release the page
+        release_page(pid, task->oid);
+    }
+    free_access_strategy(strategy);
+    zone_skipped(skipped);
+    return NULL;
 }
 
-_Table* sel(const UINT idx, const INT cond_val, const char* table_name){
+_Table* sel(const UINT idx, const UINT op, const INT cond_val, const INT cond_val2, const char* table_name){
     
     printf("sel() is invoked.\n");
 
@@ -285,7 +977,6 @@ _Table* sel(const UINT idx, const INT cond_val, const char* table_name){
     // replace all code with your implementation
 
     Table t;    // the chosen table
-    UINT ntuples = 0;   // number of tuples in the chosen table
     UINT nattrs = 0;    // number of attributes in the chosen table
     UINT npages = 0;    // number of pages in the chosen table
     UINT ntuples_per_page = 0;  // number of tuples per page
@@ -293,15 +984,10 @@ _Table* sel(const UINT idx, const INT cond_val, const char* table_name){
 
     // loop variables
     UINT i = 0;
-    UINT j = 0;
-    UINT k = 0;
 
-    FILE* table_fp = NULL;  // file pointer to the chosen table
     UINT64 page_id_init = 0;    // first page id of the table
     INT table_found = 0;    // flag to check if table is found
 
-    UINT ntuples_res = 0;   // number of tuples in result table
-    Tuple* tuples_cur_table = NULL;  // selected tuples in current table
     _Table* result = NULL;  // result table
 
     // find the table
@@ -320,9 +1006,12 @@ _Table* sel(const UINT idx, const INT cond_val, const char* table_name){
     if (ntuples_last_page == 0) ntuples_last_page = ntuples_per_page;
     nattrs = t.nattrs;
     assert(idx < nattrs);   // check if idx is valid
-    ntuples = t.ntuples;
     npages = (t.ntuples + ntuples_per_page - 1) / ntuples_per_page;
 
+    // an index on the attribute may read fewer pages than the scan
+    result = index_sel(&t, idx, op, cond_val, cond_val2);
+    if (result != NULL) return result;
+
 //    // check if all pages of the table are already in the buffer
 //    // if so, there will be no need to load them by calling open_file() function
 //    UINT count_page_in_buffer = 0;
@@ -346,1046 +1035,884 @@ _Table* sel(const UINT idx, const INT cond_val, const char* table_name){
 //    }
 
     // get the first page_id
-    table_fp = open_file(t.oid);
-    assert(table_fp != NULL);
-    fseek(table_fp, 0, SEEK_SET);
-    fread(&page_id_init,sizeof(UINT64),1,table_fp);
-    unpin_file(t.oid);
-
-    // allocate space for tuples in result table
-    tuples_cur_table = malloc(ntuples*sizeof(Tuple));
-
-
-    // loop through all pages
-    for (i = 0; i < npages; ++i){
-        // try reading page from buffer
-        UINT ntuples_of_cur_page = 0;
-        UINT cur_page_slot = request_page(page_id_init+i,t.oid);
-        Page* cur_page = buffer[cur_page_slot].page_ptr;
-
-        // if the page unloaded then read it from file
-        if (cur_page==NULL){
-            cur_page = read_page_from_file(t.oid, page_id_init+i, page_id_init);
-            buffer[cur_page_slot].page_ptr = cur_page;
-        }
-
-        if (i == npages-1){
-            ntuples_of_cur_page = ntuples_last_page;
-        } else {
-            ntuples_of_cur_page = ntuples_per_page;
-        }
-
-        // choose the tuples that satisfy the condition in current page
-        for (j = 0; j < ntuples_of_cur_page*nattrs; j+=nattrs){
-            if (cur_page->data[j+idx] == cond_val){
-                // copy the tuple to result table
-                Tuple tup = malloc(sizeof(INT)*nattrs);
-                for (k = 0; k < nattrs; ++k){
-                    tup[k] = cur_page->data[j+k];
-                }
-                tuples_cur_table[ntuples_res] = tup;
-                ++ntuples_res;
-            }
-        }
-
-        // release the page
-        release_page( page_id_init+i,t.oid);
+    page_id_init = read_first_pid(t.oid);
+
+    // split the pages among the workers, each pins a page and keeps a ring
+    // at a time, so a small buffer gets fewer of them
+    UINT nworkers = cf->threads;
+    UINT work = work_slots();
+    UINT ring = work / 8 < RING_SLOTS ? work / 8 : RING_SLOTS;
+    if (nworkers > work / (ring + 2)) nworkers = work / (ring + 2);
+    if (nworkers > npages) nworkers = npages;
+    if (nworkers == 0) nworkers = 1;
+
+    SelTask tasks[nworkers];
+    pthread_t threads[nworkers];
+    for (i = 0; i < nworkers; ++i){
+        SelTask* task = &tasks[i];
+        task->oid = t.oid;
+        task->page_id_init = page_id_init;
+        task->first = (UINT64)npages * i / nworkers;
+        task->last = (UINT64)npages * (i + 1) / nworkers;
+        task->npages = npages;
+        task->nattrs = nattrs;
+        task->ntuples_per_page = ntuples_per_page;
+        task->ntuples_last_page = ntuples_last_page;
+        task->idx = idx;
+        task->op = op;
+        task->val = cond_val;
+        task->val2 = cond_val2;
+        task->zm = zone_map(t.oid);
+        task->result = new_result(nattrs);
     }
-
-    // close the file
-    unpin_file(t.oid);
-
-    result = malloc(sizeof(_Table)+ntuples_res*sizeof(Tuple));
-    result->nattrs = nattrs;
-    result->ntuples = ntuples_res;
-
-//    puts("show result table:\n");
-
-    // copy the tuples to result table
-    for (i = 0; i < ntuples_res; ++i){
-        result->tuples[i] = tuples_cur_table[i];
-
-
-        //print
-//        for (j = 0; j < nattrs; ++j){
-//            printf("%d ", tuples_cur_table[i][j]);
-//        }
-//        printf("\n");
-
-
+    // the calling thread scans the first range itself
+    for (i = 1; i < nworkers; ++i){
+        INT err = pthread_create(&threads[i], NULL, sel_scan, &tasks[i]);
+        assert(err == 0);
     }
+    sel_scan(&tasks[0]);
+    for (i = 1; i < nworkers; ++i) pthread_join(threads[i], NULL);
 
-//    puts("select() is finished.\n");
-
-    if (tuples_cur_table != NULL) free(tuples_cur_table); // release the shell space
-    // do not release the tuples in tuples_cur_table because they are using to result table
+    // selected tuples in page order
+    result = tasks[0].result;
+    for (i = 1; i < nworkers; ++i) concat_result(result, tasks[i].result);
 
+//    puts("select() is finished.\n");
 
     return result;
 }
 
-_Table* join(const UINT idx1, const char* table1_name, const UINT idx2, const char* table2_name){
-
-    printf("join() is invoked.\n");
-    // write your code to join two tables
-    // invoke log_read_page() every time a page is read from the hard drive.
-    // invoke log_release_page() every time a page is released from the memory.
-
-    // invoke log_open_file() every time a page is read from the hard drive.
-    // invoke log_close_file() every time a page is released from the memory.
-
-    Table r,s;    // the chosen table
-    INT table_found_r = 0;    // flag to check if R table is found
-    INT table_found_s = 0;    // flag to check if S table is found
-
-    UINT ntuples_r = 0;
-    UINT ntuples_s = 0;
-
-    UINT nattrs_r = 0;
-    UINT nattrs_s = 0;
-
-    UINT npages_r = 0;
-    UINT npages_s = 0;
-
-    UINT ntuples_per_page_r = 0;
-    UINT ntuples_per_page_s = 0;
-    UINT ntuples_last_page_r = 0;
-    UINT ntuples_last_page_s = 0;
-
-    // loop variables
-    UINT i = 0;
-    UINT j = 0;
-    UINT k = 0;
-    UINT l = 0;
-    UINT m = 0;
-
-    FILE* table_fp_r = NULL;  // file pointer to the R table
-    FILE* table_fp_s = NULL;  // file pointer to the S table
-
-    UINT64 page_id_init_r = 0;    // first page id of the R table
-    UINT64 page_id_init_s = 0;    // first page id of the S table
-
-    // result table
-    UINT nattrs_res = 0;    // number of attributes in result table
-    UINT ntuples_res = 0;   // number of tuples in result table
-    _Table* result = NULL;  // result table
-    Tuple* tuples_cur_table = NULL;  // selected tuples in current table (release after copying to result table)
-
-    // find the table
-    for (i = 0; i < db->ntables; ++i){
-        if (strcmp(db->tables[i].name, table1_name) == 0){
-            r = db->tables[i];
-            ++table_found_r;
-        }
-        if (strcmp(db->tables[i].name, table2_name) == 0){
-            s = db->tables[i];
-            ++table_found_s;
-        }
+// find a table of the database by name, NULL if there is none
+Table* find_table(const char* table_name){
+    for (UINT i = 0; i < db->ntables; ++i){
+        if (strcmp(db->tables[i].name, table_name) == 0) return &db->tables[i];
     }
-    assert(table_found_r != 0 && table_found_s != 0);
-
-    // get the number of tuples and attributes of R table
-    ntuples_r = r.ntuples;
-    nattrs_r = r.nattrs;
-    ntuples_per_page_r = (cf->page_size - sizeof(UINT64)) / (nattrs_r * sizeof(INT));
-    ntuples_last_page_r = ntuples_r % ntuples_per_page_r;
-    if (ntuples_last_page_r == 0) ntuples_last_page_r = ntuples_per_page_r;
-    npages_r = (r.ntuples + ntuples_per_page_r - 1) / ntuples_per_page_r;
+    return NULL;
+}
 
-    // get the number of tuples and attributes of S table
-    ntuples_s = s.ntuples;
-    nattrs_s = s.nattrs;
-    ntuples_per_page_s = (cf->page_size - sizeof(UINT64)) / (nattrs_s * sizeof(INT));
-    ntuples_last_page_s = ntuples_s % ntuples_per_page_s;
-    if (ntuples_last_page_s == 0) ntuples_last_page_s = ntuples_per_page_s;
-    npages_s = (s.ntuples + ntuples_per_page_s - 1) / ntuples_per_page_s;
+// page layout of a table file
+Rel open_rel(const Table* t){
+    Rel rel;
+    rel.oid = t->oid;
+    rel.nattrs = t->nattrs;
+    rel.ntuples = t->ntuples;
+    rel.ntuples_per_page = (cf->page_size - sizeof(UINT64)) / sizeof(INT) / t->nattrs;
+    rel.npages = (t->ntuples + rel.ntuples_per_page - 1) / rel.ntuples_per_page;
+    rel.page_id_init = 0;
+    rel.tail = NULL;
 
-    printf("ntuples_r = %d, nattrs_r = %d, ntuples_per_page_r = %d, ntuples_last_page_r = %d, npages_r = %d\n",
-           ntuples_r, nattrs_r, ntuples_per_page_r, ntuples_last_page_r, npages_r);
-    printf("ntuples_s = %d, nattrs_s = %d, ntuples_per_page_s = %d, ntuples_last_page_s = %d, npages_s = %d\n",
-           ntuples_s, nattrs_s, ntuples_per_page_s, ntuples_last_page_s, npages_s);
+    // get the first page_id
+    if (rel.npages > 0) rel.page_id_init = read_first_pid(t->oid);
+    return rel;
+}
 
-    assert(idx1 < nattrs_r && idx2 < nattrs_s);
+// number of tuples in the i-th page of rel
+UINT rel_page_ntuples(const Rel* rel, UINT i){
+    if (i + 1 < rel->npages) return rel->ntuples_per_page;
+    return rel->ntuples - (rel->npages - 1) * rel->ntuples_per_page;
+}
 
-    // get the first page_id of R table
-    table_fp_r = open_file(r.oid);
-    assert(table_fp_r != NULL);
-    fseek(table_fp_r,0,SEEK_SET);
-    fread(&page_id_init_r,sizeof(UINT64),1,table_fp_r);
-    unpin_file(r.oid);
+// empty temp file with the page layout of tables with nattrs attributes
+Rel create_temp_rel(UINT nattrs){
+    Rel rel;
+    rel.oid = create_temp_file();
+    rel.nattrs = nattrs;
+    rel.ntuples = 0;
+    rel.ntuples_per_page = (cf->page_size - sizeof(UINT64)) / sizeof(INT) / nattrs;
+    rel.npages = 0;
+    rel.page_id_init = 0;
+    rel.tail = NULL;
+    return rel;
+}
 
-    // get the first page_id of S table
-    table_fp_s = open_file(s.oid);
-    assert(table_fp_s != NULL);
-    fseek(table_fp_s,0,SEEK_SET);
-    fread(&page_id_init_s,sizeof(UINT64),1,table_fp_s);
-    unpin_file(s.oid);
+// space for one more tuple at the end of rel, the last page stays pinned
+// until the next page is started or rel_finish() is called
+INT* rel_append(Rel* rel){
+    UINT nin_tail = rel->ntuples - (rel->npages > 0 ? (rel->npages - 1) * rel->ntuples_per_page : 0);
+    if (rel->tail == NULL || nin_tail == rel->ntuples_per_page){
+        if (rel->tail != NULL) release_page(rel->tail->pid, rel->oid);
+        rel->tail = new_page(rel->oid, rel->page_id_init + rel->npages, rel->page_id_init);
+        ++rel->npages;
+        nin_tail = 0;
+    }
+    ++rel->ntuples;
+    return rel->tail->data + nin_tail * rel->nattrs;
+}
 
-    // initialize result table
-    nattrs_res = nattrs_r + nattrs_s;
-    tuples_cur_table = malloc(sizeof(Tuple) * (ntuples_r * ntuples_s)); // join at most ntuples_r * ntuples_s
+void rel_finish(Rel* rel){
+    if (rel->tail != NULL) release_page(rel->tail->pid, rel->oid);
+    rel->tail = NULL;
+}
 
-//    puts("join() is init.\n");
+void drop_rel(Rel* rel){
+    rel_finish(rel);
+    drop_temp_file(rel->oid);
+}
 
-    if (cf->buf_slots < npages_r + npages_s){
+// position c at tuple pos of page page, the page stays pinned while c is on it
+void cursor_open(RelCursor* c, Rel* rel, UINT page, UINT pos){
+    c->rel = rel;
+    c->page = page;
+    c->pos = pos;
+    c->cur = NULL;
+    if (page < rel->npages && pos < rel_page_ntuples(rel, page))
+        c->cur = get_page(rel->oid, rel->page_id_init + page, rel->page_id_init);
+}
 
-        //// nested loop join
+// tuple under the cursor, NULL past the end
+const INT* cursor_tuple(const RelCursor* c){
+    if (c->cur == NULL) return NULL;
+    return c->cur->data + c->pos * c->rel->nattrs;
+}
 
-        puts("join() is nested loop join.\n");
+void cursor_next(RelCursor* c){
+    if (c->cur == NULL) return;
+    if (++c->pos < rel_page_ntuples(c->rel, c->page)) return;
+    release_page(c->cur->pid, c->rel->oid);
+    c->cur = NULL;
+    c->pos = 0;
+    if (++c->page < c->rel->npages)
+        c->cur = get_page(c->rel->oid, c->rel->page_id_init + c->page, c->rel->page_id_init);
+}
 
+void cursor_close(RelCursor* c){
+    if (c->cur != NULL) release_page(c->cur->pid, c->rel->oid);
+    c->cur = NULL;
+}
 
-        // choose the smaller table as outer loop
-        if (npages_r <= npages_s){   // set table r outside
 
-            puts("join() is nested loop join, set table r outside.\n");
+//// join
 
-            // buffer assignment
-            UINT buf_slot_outer = cf->buf_slots-1;
-            if (buf_slot_outer > npages_r) buf_slot_outer = npages_r;
-            UINT buf_slot_inner = cf->buf_slots - buf_slot_outer;
+// result tuples of a join, R attributes first
+typedef struct JoinOut {
+    _Table* result;
+    UINT nattrs_r;
+    UINT nattrs_s;
+} JoinOut;
 
-//            printf("buf_slot_outer = %d, buf_slot_inner = %d\n", buf_slot_outer, buf_slot_inner);
+static void emit(JoinOut* out, const INT* tup_r, const INT* tup_s){
+    INT* tup = append_tuple(out->result);
+    memcpy(tup, tup_r, sizeof(INT) * out->nattrs_r);
+    memcpy(tup + out->nattrs_r, tup_s, sizeof(INT) * out->nattrs_s);
+}
 
-            UINT count_in_buffer = 0;   // at most == buf_slot_outer
-            UINT count_out_buffer = 0;  // at most == buf_slot_inner
+static UINT64 div_ceil(UINT64 a, UINT64 b){
+    return (a + b - 1) / b;
+}
 
-            UINT is_in_buffer[npages_r];
-            for(i=0;i<npages_r;++i) is_in_buffer[i] = 0;
-            UINT inner_in_buffer[npages_s];
-            for(i=0;i<npages_s;++i) inner_in_buffer[i] = 0;
+// estimated page I/O of each strategy, JOIN_NO_COST if it cannot run
 
+static UINT64 cost_nested_loop(const Rel* r, const Rel* s){
+    UINT64 outer = r->npages <= s->npages ? r->npages : s->npages;
+    UINT64 inner = r->npages <= s->npages ? s->npages : r->npages;
+    if (work_slots() < 2) return JOIN_NO_COST;
+    return outer + div_ceil(outer, work_slots() - 1) * inner;
+}
 
-            // check if any page in R,S that are in buffer
-            for (i=0;i<cf->buf_slots;++i) {
+static UINT64 cost_sort_merge(const Rel* r, const Rel* s){
+    // sort both into temp files, then merge them in one pass
+    if (work_slots() < 3) return JOIN_NO_COST;
+    return cost_external_sort(r->npages) + cost_external_sort(s->npages) + r->npages + s->npages;
+}
 
-                if ( buffer[i].oid == r.oid && buffer[i].pid >= page_id_init_r && buffer[i].pid < page_id_init_r + npages_r && buffer[i].page_ptr != NULL) {
-                    if (count_out_buffer<buf_slot_outer) {
-                        is_in_buffer[buffer[i].pid - page_id_init_r] = 1;
-                        buffer[i].pin = 1;
-                        ++count_out_buffer;
-//                        printf("exist out table:buffer[%d].oid = %d, buffer[%d].pid = %lld, buffer[%d].page_ptr = %p",i,buffer[i].oid,i,buffer[i].pid,i,buffer[i].page_ptr);
-                    }   // reserve at lease one page for inner loop
-                    else{
-                        buffer[i].pin = 0;
-                    }
-                }
+// partitions for a Grace hash join that builds on nbuild pages
+static UINT hash_join_partitions(UINT nbuild){
+    UINT nparts = div_ceil(nbuild, work_slots() - 1);
+    nparts += nparts / 4;   // room for skew
+    if (nparts < 2) nparts = 2;
+    if (nparts > work_slots() - 1) nparts = work_slots() - 1;
+    return nparts;
+}
 
-                if ( buffer[i].oid == s.oid && buffer[i].pid >= page_id_init_s && buffer[i].pid < page_id_init_s + npages_s && buffer[i].page_ptr != NULL) {
-                    if (count_in_buffer<buf_slot_inner) {
-                        inner_in_buffer[buffer[i].pid - page_id_init_s] = 1;
-                        buffer[i].pin = 1;
-                        ++count_in_buffer;
-//                        printf("exist in table:buffer[%d].oid = %d, buffer[%d].pid = %lld, buffer[%d].page_ptr = %p",i,buffer[i].oid,i,buffer[i].pid,i,buffer[i].page_ptr);
-                    }
-                    else{
-                        buffer[i].pin = 0;
-                    }
-                }
+static UINT64 cost_hash(const Rel* r, const Rel* s){
+    if (work_slots() < 3) return JOIN_NO_COST;
+    UINT64 nbuild = r->npages <= s->npages ? r->npages : s->npages;
+    UINT64 nprobe = r->npages <= s->npages ? s->npages : r->npages;
+    UINT nparts = hash_join_partitions(nbuild);
+    // read both and write the partitions, their last pages are partly full
+    UINT64 cost = 2 * (nbuild + nprobe) + 2 * (UINT64)nparts;
+    // each build partition is read once, its probe partition once per chunk
+    UINT64 part_build = div_ceil(nbuild, nparts) + 1;
+    UINT64 part_probe = div_ceil(nprobe, nparts) + 1;
+    cost += nparts * (part_build + div_ceil(part_build, work_slots() - 1) * part_probe);
+    return cost;
+}
 
+// block nested loop join
+// the smaller table is kept in the buffer as the outer block,
+// one slot is left for streaming the pages of the inner table.
+// with zone maps, outer pages outside the key range of the inner table and
+// inner pages outside the key range of the block are not read
+static void nested_loop_join(Rel* r, const UINT idx1, Rel* s, const UINT idx2, JoinOut* out){
+    UINT i, j, k, l, m;
+    UINT outer_is_r = r->npages <= s->npages;
+    Rel* outer = outer_is_r ? r : s;
+    Rel* inner = outer_is_r ? s : r;
+    UINT outer_idx = outer_is_r ? idx1 : idx2;
+    UINT inner_idx = outer_is_r ? idx2 : idx1;
+    const ZoneMap* zm_outer = zone_map(outer->oid);
+    const ZoneMap* zm_inner = zone_map(inner->oid);
+    INT inner_lo, inner_hi;
+    zone_table_bounds(zm_inner, inner_idx, &inner_lo, &inner_hi);
+    UINT skipped = 0;
+
+    UINT buf_slot_outer = work_slots() - 1;
+    if (buf_slot_outer > outer->npages) buf_slot_outer = outer->npages;
+    if (buf_slot_outer == 0) return;
+
+    Page* block[buf_slot_outer];
+    UINT block_page[buf_slot_outer];    // outer page of each block entry
+
+    for (i = 0; i < outer->npages; ){
+        // load and pin the outer block
+        UINT nblock = 0;
+        INT block_lo = INT32_MAX, block_hi = INT32_MIN;
+        for (; i < outer->npages && nblock < buf_slot_outer; ++i){
+            if (!zone_overlaps(zm_outer, i, outer_idx, inner_lo, inner_hi)){
+                ++skipped;
+                continue;
             }
+            INT lo, hi;
+            zone_page_bounds(zm_outer, i, outer_idx, &lo, &hi);
+            if (lo < block_lo) block_lo = lo;
+            if (hi > block_hi) block_hi = hi;
+            block_page[nblock] = i;
+            block[nblock++] = get_page(outer->oid, outer->page_id_init + i, outer->page_id_init);
+        }
+        if (nblock == 0) break;
 
-//            printf("count_in_buffer = %d, count_out_buffer = %d\n",count_in_buffer,count_out_buffer);
-
-            // full the outer buffer as much as possible
-            i = 0;
-            k = 0;
-            while (i<buf_slot_outer-count_out_buffer){
-                k = i;
-                for (j = 0; j < npages_r; ++j) {
-                    if (is_in_buffer[j] == 0) {
-                        UINT cur_page_slot_r = request_page(page_id_init_r + j,r.oid);
-                        Page *cur_page_r = buffer[cur_page_slot_r].page_ptr;
-                        if (cur_page_r == NULL) {
-                            cur_page_r = read_page_from_file(r.oid, page_id_init_r + i, page_id_init_r);
-                            assert(cur_page_r != NULL);
-                            buffer[cur_page_slot_r].page_ptr = cur_page_r;
-                        }
-                        is_in_buffer[j] = 1;
-                        ++i;
-                        break;
-                    }
-                }
-                if (k == i) break;
+        for (j = 0; j < inner->npages; ++j){
+            if (!zone_overlaps(zm_inner, j, inner_idx, block_lo, block_hi)){
+                ++skipped;
+                continue;
             }
-
-            // full the inner buffer as much as possible
-            i = 0;
-            k = 0;
-            while (i < buf_slot_inner-count_in_buffer ){
-                k = i;
-                for (j = 0; j < npages_s; ++j) {
-                    if (inner_in_buffer[j] == 0) {
-                        UINT cur_page_slot_s = request_page(page_id_init_s + j,s.oid);
-                        Page *cur_page_s = buffer[cur_page_slot_s].page_ptr;
-                        if (cur_page_s == NULL) {
-                            cur_page_s = read_page_from_file(s.oid, page_id_init_s + i, page_id_init_s);
-                            assert(cur_page_s != NULL);
-                            buffer[cur_page_slot_s].page_ptr = cur_page_s;
-                        }
-                        inner_in_buffer[j] = 1;
-                        ++i;
-                        break;
+            Page* inner_page = get_page(inner->oid, inner->page_id_init + j, inner->page_id_init);
+
+            for (k = 0; k < nblock; ++k){
+                // tuples of R are always iterated first so the output order
+                // does not depend on which side is the outer block
+                Page* page_r = outer_is_r ? block[k] : inner_page;
+                Page* page_s = outer_is_r ? inner_page : block[k];
+                UINT ntuples_of_cur_page_r = rel_page_ntuples(r, outer_is_r ? block_page[k] : j);
+                UINT ntuples_of_cur_page_s = rel_page_ntuples(s, outer_is_r ? j : block_page[k]);
+
+                for (l = 0; l < ntuples_of_cur_page_r * r->nattrs; l += r->nattrs){
+                    INT r_i = page_r->data[l + idx1];
+                    for (m = 0; m < ntuples_of_cur_page_s * s->nattrs; m += s->nattrs){
+                        if (r_i == page_s->data[m + idx2]) emit(out, page_r->data + l, page_s->data + m);
                     }
                 }
-                if (k == i) break;
             }
 
+            release_page(inner->page_id_init + j, inner->oid);
+        }
 
-            // log
-//            INT count_pin_out = 0;
-//            INT count_pin_in = 0;
-//            for (i=0;i<cf->buf_slots;++i) {
-//                if (buffer[i].oid == r.oid && buffer[i].pid >= page_id_init_r &&
-//                    buffer[i].pid < page_id_init_r + npages_r && buffer[i].page_ptr != NULL) {
-//                    count_pin_out ++;
-//                }
-//                if (buffer[i].oid == s.oid && buffer[i].pid >= page_id_init_s &&
-//                    buffer[i].pid < page_id_init_s + npages_s && buffer[i].page_ptr != NULL) {
-//                    count_pin_in ++;
-//                }
-//            }
-//            printf("count_pin_out = %d\n",count_pin_out);
-//            printf("count_pin_in = %d\n",count_pin_in);
-
-
-            INT outer_loop_count = 0;
-            INT inner_loop_count = 0;
-
-            i = 0;
-            j = 0;
-            k = 0;
-            l = 0;
-
-            while (outer_loop_count < npages_r){
-
-                while (inner_loop_count < npages_s){  // set table s inside
-
-                    for (k = 0; k < cf->buf_slots; ++k){
-                        // inner loop
-                        if (buffer[k].oid == s.oid && buffer[k].pid >= page_id_init_s &&
-                            buffer[k].pid < page_id_init_s + npages_s && buffer[k].page_ptr != NULL) {
-                            if (inner_in_buffer[buffer[k].pid - page_id_init_s] == -1){
-                                continue;
-                            }
-
-                            inner_loop_count ++;
-
-                            printf("\n inner_loop_count = %lld\n",buffer[k].pid);
-
-                            // try reading page from buffer
-                            UINT ntuples_of_cur_page_s = 0;
-                            UINT cur_page_slot_s = request_page(buffer[k].pid, s.oid);
-                            Page *cur_page_s = buffer[cur_page_slot_s].page_ptr;
-
-                            // if the page unloaded then read it from file
-                            if (cur_page_s == NULL) {
-                                cur_page_s = read_page_from_file(s.oid, buffer[k].pid, page_id_init_s);
-                                buffer[cur_page_slot_s].page_ptr = cur_page_s;
-                            }
-
-                            if (k == npages_s - 1) {
-                                ntuples_of_cur_page_s = ntuples_last_page_s;
-                            } else {
-                                ntuples_of_cur_page_s = ntuples_per_page_s;
-                            }
-
-                            // for each pair of tuples in R and S, check if they match
-                            // once they match, add the result to the result table
-                            puts ("cur_page_s");
-                            for (j = 0; j < ntuples_of_cur_page_s * nattrs_s; j += nattrs_s) {
-                                for (l = 0; l < nattrs_s; ++l) {
-                                    printf("%d ", cur_page_s->data[j + l]);
-                                }
-                                printf("\n");
-                            }
-                            printf("\n");
-
-                            for (i = 0; i < cf->buf_slots; ++i) {
-                                // outer loop
-                                if (buffer[i].oid == r.oid && buffer[i].pid >= page_id_init_r &&
-                                    buffer[i].pid < page_id_init_r + npages_r && buffer[i].page_ptr != NULL) {
-                                    if (is_in_buffer[buffer[i].pid - page_id_init_r] == -1){
-                                        continue;
-                                    }
-
-                                    outer_loop_count++;
-
-                                    printf("outer_loop_count = %lld\n",buffer[i].pid);
-
-                                    UINT ntuples_of_cur_page_r = 0;
-                                    UINT cur_page_slot_r = request_page(buffer[i].pid, r.oid);
-                                    Page *cur_page_r = buffer[cur_page_slot_r].page_ptr;
-
-                                    // if the page unloaded then read it from file
-                                    if (cur_page_r == NULL) {
-                                        printf("error");
-                                        cur_page_r = read_page_from_file(r.oid, buffer[i].pid, page_id_init_r);
-                                        buffer[cur_page_slot_r].page_ptr = cur_page_r;
-                                    }
-
-                                    if (i == npages_r - 1) {
-                                        ntuples_of_cur_page_r = ntuples_last_page_r;
-                                    } else {
-                                        ntuples_of_cur_page_r = ntuples_per_page_r;
-                                    }
-
-                                    // start matching
-
-                                    // print out the page
-                                    puts ("cur_page_r");
-                                    for (j = 0; j < ntuples_of_cur_page_r * nattrs_r; j += nattrs_r) {
-                                        for (l = 0; l < nattrs_r; ++l) {
-                                            printf("%d ", cur_page_r->data[j + l]);
-                                        }
-                                        printf("\n");
-                                    }
-
-                                    for (j =0; j < ntuples_of_cur_page_r * nattrs_r; j+= nattrs_r){
-                                        INT r_i = cur_page_r->data[j + idx1];
-                                        for (l = 0; l < ntuples_of_cur_page_s * nattrs_s; l += nattrs_s) {
-                                            INT s_i = cur_page_s->data[l + idx2];
-                                            if (r_i == s_i) {
-                                                // add the result to the result table
-                                                Tuple tup = malloc(sizeof(INT) * nattrs_res);
-                                                for (m = 0; m < nattrs_r; ++m) {
-                                                    tup[m] = cur_page_r->data[j + m];
-                                                }
-                                                for (m = 0; m < nattrs_s; ++m) {
-                                                    tup[nattrs_r + m] = cur_page_s->data[l + m];
-                                                }
-                                                tuples_cur_table[ntuples_res] = tup;
-                                                ++ntuples_res;
-                                            }
-                                        }
-
-                                    }
-                                }
-                            }
-                            // release page s
-                            release_page(cur_page_s->pid, s.oid);
-                            inner_in_buffer[cur_page_s->pid - page_id_init_s] = -1;
-                        }
-                    }
-
-//                    // release inner pages
-//                    for (k = 0; k < cf->buf_slots; ++k){
-//                        // try release page from buffer
-//                        if (buffer[k].oid == s.oid && buffer[k].pid >= page_id_init_s &&
-//                            buffer[k].pid < page_id_init_s + npages_s && buffer[k].page_ptr != NULL) {
-//                            release_page(buffer[k].pid, s.oid);
-//                            inner_in_buffer[buffer[k].pid - page_id_init_s] = -1;
-//                        }
-//                    }
-
-                    if (inner_loop_count < npages_s) {
-
-                        INT count = 0;
-                        for (k = 0; k < npages_s && count < buf_slot_inner; ++k) {
-                            if (inner_in_buffer[k] == 0) {
-                                UINT cur_page_slot_s = request_page(page_id_init_s + k, s.oid);
-                                Page *cur_page_s = buffer[cur_page_slot_s].page_ptr;
-                                if (cur_page_s == NULL) {
-                                    cur_page_s = read_page_from_file(s.oid, page_id_init_s + k, page_id_init_s);
-                                    buffer[cur_page_slot_s].page_ptr = cur_page_s;
-                                }
-                                inner_in_buffer[k] = 1;
-                                count++;
-                            }
-                        }
-                    }
-
-                }
-
-
-                // release outer pages
-                for (i = 0; i < cf->buf_slots; ++i) {
-                    // try release page from buffer
-                    if (buffer[i].oid == r.oid && buffer[i].pid >= page_id_init_r &&
-                        buffer[i].pid < page_id_init_r + npages_r && buffer[i].page_ptr != NULL) {
-                        release_page(buffer[i].pid, r.oid);   // release page r
-                        is_in_buffer[buffer[i].pid - page_id_init_r] = -1;
-                    }
-                }
+        // unpin the outer block
+        for (k = 0; k < nblock; ++k)
+            release_page(outer->page_id_init + block_page[k], outer->oid);
+    }
+    zone_skipped(skipped);
+}
 
-                // reload pages
-                if (outer_loop_count < npages_r) {
-                    INT count = 0;
-                    for (i = 0; i < npages_r && count < buf_slot_outer; ++i) {
-                        if (is_in_buffer[i] == 0) {
-                            UINT cur_page_slot_r = request_page(page_id_init_r + i, r.oid);
-                            Page *cur_page_r = buffer[cur_page_slot_r].page_ptr;
-                            if (cur_page_r == NULL) {
-                                cur_page_r = read_page_from_file(r.oid, page_id_init_r + i, page_id_init_r);
-                                buffer[cur_page_slot_r].page_ptr = cur_page_r;
-                            }
-                            is_in_buffer[i] = 1;
-                            count++;
-                        }
-                    }
+// sort-merge join
+// both tables are sorted by external_sort(), then merged. for a key present
+// on both sides the S tuples with the key are rescanned from the first one
+// for every R tuple with the key, the pages are usually still buffered
+static void sort_merge_join(Rel* r, const UINT idx1, Rel* s, const UINT idx2, JoinOut* out){
+    Rel sorted_r = external_sort(r, idx1);
+    Rel sorted_s = external_sort(s, idx2);
+    RelCursor cur_r, cur_s;
+    cursor_open(&cur_r, &sorted_r, 0, 0);
+    cursor_open(&cur_s, &sorted_s, 0, 0);
+
+    // merge the two sorted tables
+    // algorithm according to Fundamentals of Database Systems, 6th edition, p. 556
+    const INT* tup_r = cursor_tuple(&cur_r);
+    const INT* tup_s = cursor_tuple(&cur_s);
+    while (tup_r != NULL && tup_s != NULL){
+        if (tup_r[idx1] < tup_s[idx2]){
+            cursor_next(&cur_r);
+        } else if (tup_r[idx1] > tup_s[idx2]){
+            cursor_next(&cur_s);
+        } else{
+            INT key = tup_r[idx1];
+            UINT mark_page = cur_s.page;
+            UINT mark_pos = cur_s.pos;
+            while (1){
+                // join with every tuple of S with the same value
+                for (; tup_s != NULL && tup_s[idx2] == key; tup_s = cursor_tuple(&cur_s)){
+                    emit(out, tup_r, tup_s);
+                    cursor_next(&cur_s);
                 }
-
+                cursor_next(&cur_r);
+                tup_r = cursor_tuple(&cur_r);
+                if (tup_r == NULL || tup_r[idx1] != key) break;
+                cursor_close(&cur_s);
+                cursor_open(&cur_s, &sorted_s, mark_page, mark_pos);
+                tup_s = cursor_tuple(&cur_s);
             }
+        }
+        tup_r = cursor_tuple(&cur_r);
+        tup_s = cursor_tuple(&cur_s);
+    }
 
+    cursor_close(&cur_r);
+    cursor_close(&cur_s);
+    drop_rel(&sorted_r);
+    drop_rel(&sorted_s);
+}
 
-//            puts("result of join() init");
-
-            result = malloc(sizeof(_Table)+sizeof(Tuple)*ntuples_res);
-            result->ntuples = ntuples_res;
-            result->nattrs = nattrs_res;
-            for (i=0;i<ntuples_res;++i){
-                result->tuples[i] = tuples_cur_table[i];
-            }
-            if (tuples_cur_table != NULL)
-                free(tuples_cur_table);
-
-            unpin_file(r.oid);
-            unpin_file(s.oid);
-
-            return result;
-
-
-
-        } else {    // set table s outside
-
-            puts("join() is nested loop join, set table s outside.\n");
-
-            // buffer assignment
-            UINT buf_slot_outer = cf->buf_slots-1;
-            if (buf_slot_outer > npages_s) buf_slot_outer = npages_s;
-            UINT buf_slot_inner = cf->buf_slots - buf_slot_outer;
-
-//            printf("buf_slot_outer = %d, buf_slot_inner = %d\n", buf_slot_outer, buf_slot_inner);
-
-            UINT count_in_buffer = 0;   // at most == buf_slot_outer
-            UINT count_out_buffer = 0;  // at most == buf_slot_inner
-
-            UINT is_in_buffer[npages_s];
-            for(i=0;i<npages_s;++i) is_in_buffer[i] = 0;
-            UINT inner_in_buffer[npages_r];
-            for(i=0;i<npages_r;++i) inner_in_buffer[i] = 0;
-
-            // check if pages in R,S that are in buffer
-            for (i=0;i<cf->buf_slots;++i) {
-
-                if ( buffer[i].oid == r.oid && buffer[i].pid >= page_id_init_r && buffer[i].pid < page_id_init_r + npages_r && buffer[i].page_ptr != NULL) {
-                    if (count_in_buffer<buf_slot_inner) {
-                        inner_in_buffer[buffer[i].pid - page_id_init_r] = 1;
-                        buffer[i].pin = 1;
-                        ++count_in_buffer;
-//                        printf("exist in table:buffer[%d].oid = %d, buffer[%d].pid = %lld, buffer[%d].page_ptr = %p",i,buffer[i].oid,i,buffer[i].pid,i,buffer[i].page_ptr);
-                    }
-                    else{
-                        buffer[i].pin = 0;
-                    }
-                }
-
-                if ( buffer[i].oid == s.oid && buffer[i].pid >= page_id_init_s && buffer[i].pid < page_id_init_s + npages_s && buffer[i].page_ptr != NULL) {
-                    if (count_out_buffer<buf_slot_outer) {
-                        is_in_buffer[buffer[i].pid - page_id_init_s] = 1;
-                        buffer[i].pin = 1;
-                        ++count_out_buffer;
-//                        printf("exist out table:buffer[%d].oid = %d, buffer[%d].pid = %lld, buffer[%d].page_ptr = %p",i,buffer[i].oid,i,buffer[i].pid,i,buffer[i].page_ptr);
-                    }   // reserve at lease one page for inner loop
-                    else{
-                        buffer[i].pin = 0;
-                    }
-                }
+static UINT hash_key(INT key){
+    return (UINT)(((UINT64)(UINT)key * 0x9E3779B97F4A7C15ULL) >> 32);
+}
 
-            }
+// split rel into nparts temp files by the hash of attribute idx, tuples
+// outside [lo, hi] cannot match and pages the zone map puts outside are not read
+static void partition_rel(Rel* rel, const UINT idx, Rel* parts, UINT nparts, INT lo, INT hi){
+    for (UINT p = 0; p < nparts; ++p) parts[p] = create_temp_rel(rel->nattrs);
+
+    const ZoneMap* zm = zone_map(rel->oid);
+    UINT skipped = 0;
+    AccessStrategy* strategy = get_access_strategy(ACCESS_SEQUENTIAL, rel->npages);
+    for (UINT i = 0; i < rel->npages; ++i){
+        if (!zone_overlaps(zm, i, idx, lo, hi)){
+            ++skipped;
+            continue;
+        }
+        Page* page = get_page_with(rel->oid, rel->page_id_init + i, rel->page_id_init, strategy);
+        UINT ntuples_of_cur_page = rel_page_ntuples(rel, i);
+        for (UINT j = 0; j < ntuples_of_cur_page; ++j){
+            const INT* tup = page->data + j * rel->nattrs;
+            UINT p = hash_key(tup[idx]) % nparts;
+            memcpy(rel_append(&parts[p]), tup, sizeof(INT) * rel->nattrs);
+        }
+        release_page(rel->page_id_init + i, rel->oid);
+    }
+    free_access_strategy(strategy);
+    zone_skipped(skipped);
 
-            // full the outer buffer as much as possible
-            i = 0;
-            k = 0;
-            while (i<buf_slot_outer-count_out_buffer){
-                k = i;
-                for (j = 0; j < npages_s; ++j) {
-                    if (is_in_buffer[j] == 0) {
-                        UINT cur_page_slot_s = request_page(page_id_init_s + j,s.oid);
-                        Page *cur_page_s = buffer[cur_page_slot_s].page_ptr;
-                        if (cur_page_s == NULL) {
-                            cur_page_s = read_page_from_file(s.oid, page_id_init_s + i, page_id_init_s);
-                            assert(cur_page_s != NULL);
-                            buffer[cur_page_slot_s].page_ptr = cur_page_s;
-                        }
-                        is_in_buffer[j] = 1;
-                        ++i;
-                        break;
-                    }
-                }
-                if (k == i) break;
-            }
+    for (UINT p = 0; p < nparts; ++p) rel_finish(&parts[p]);
+}
 
-            // full the inner buffer as much as possible
-            i = 0;
-            k = 0;
-            while (i < buf_slot_inner-count_in_buffer){
-                k = i;
-                for (j = 0; j < npages_r; ++j) {
-                    if (inner_in_buffer[j] == 0) {
-                        UINT cur_page_slot_r = request_page(page_id_init_r + j,r.oid);
-                        Page *cur_page_r = buffer[cur_page_slot_r].page_ptr;
-                        if (cur_page_r == NULL) {
-                            cur_page_r = read_page_from_file(r.oid, page_id_init_r + i, page_id_init_r);
-                            assert(cur_page_r != NULL);
-                            buffer[cur_page_slot_r].page_ptr = cur_page_r;
-                        }
-                        inner_in_buffer[j] = 1;
-                        ++i;
-                        break;
-                    }
+// Grace hash join
+// both tables are partitioned into temp files, then each partition of the
+// smaller table is loaded into an in-memory hash table and probed with the
+// matching partition of the other. A build partition larger than the buffer
+// is processed in chunks, rescanning the probe partition once per chunk.
+static void hash_join(Rel* r, const UINT idx1, Rel* s, const UINT idx2, JoinOut* out){
+    UINT build_is_r = r->npages <= s->npages;
+    UINT nparts = hash_join_partitions(build_is_r ? r->npages : s->npages);
+    Rel parts_r[nparts];
+    Rel parts_s[nparts];
+
+    // with zone maps, each side skips the pages outside the other's key range
+    INT lo_r, hi_r, lo_s, hi_s;
+    zone_table_bounds(zone_map(r->oid), idx1, &lo_r, &hi_r);
+    zone_table_bounds(zone_map(s->oid), idx2, &lo_s, &hi_s);
+    partition_rel(r, idx1, parts_r, nparts, lo_s, hi_s);
+    partition_rel(s, idx2, parts_s, nparts, lo_r, hi_r);
+
+    UINT chunk = work_slots() - 1;     // one slot for the probe pages
+    Page* block[chunk];
+
+    for (UINT p = 0; p < nparts; ++p){
+        Rel* build = build_is_r ? &parts_r[p] : &parts_s[p];
+        Rel* probe = build_is_r ? &parts_s[p] : &parts_r[p];
+        UINT build_idx = build_is_r ? idx1 : idx2;
+        UINT probe_idx = build_is_r ? idx2 : idx1;
+        if (build->ntuples == 0 || probe->ntuples == 0) continue;
+
+        for (UINT first = 0; first < build->npages; first += chunk){
+            UINT nblock = build->npages - first;
+            if (nblock > chunk) nblock = chunk;
+
+            // hash table over the tuples of the pinned build pages
+            UINT ntuples = 0;
+            for (UINT k = 0; k < nblock; ++k) ntuples += rel_page_ntuples(build, first + k);
+            UINT nbuckets = 1;
+            while (nbuckets < 2 * ntuples) nbuckets <<= 1;
+            UINT* heads = malloc(sizeof(UINT) * nbuckets);
+            UINT* next = malloc(sizeof(UINT) * ntuples);
+            INT** rows = malloc(sizeof(INT*) * ntuples);
+            for (UINT b = 0; b < nbuckets; ++b) heads[b] = NO_SLOT;
+
+            UINT n = 0;
+            for (UINT k = 0; k < nblock; ++k){
+                block[k] = get_page(build->oid, build->page_id_init + first + k, build->page_id_init);
+                UINT ntuples_of_cur_page = rel_page_ntuples(build, first + k);
+                for (UINT j = 0; j < ntuples_of_cur_page; ++j){
+                    rows[n] = block[k]->data + j * build->nattrs;
+                    UINT b = hash_key(rows[n][build_idx]) & (nbuckets - 1);
+                    next[n] = heads[b];
+                    heads[b] = n;
+                    ++n;
                 }
-                if (k == i) break;
             }
 
-
-            INT outer_loop_count = 0;
-            INT inner_loop_count = 0;
-
-            i = 0;
-            j = 0;
-            k = 0;
-            l = 0;
-
-            while(outer_loop_count<npages_s){
-
-                while(inner_loop_count<npages_r){
-                    for (k = 0; k < cf->buf_slots; ++k){
-                        // inner loop
-                        if (buffer[k].oid == r.oid && buffer[k].pid >= page_id_init_r &&
-                            buffer[k].pid < page_id_init_r + npages_r && buffer[k].page_ptr != NULL) {
-                            if (inner_in_buffer[buffer[k].pid - page_id_init_r] == -1){
-                                continue;
-                            }
-
-                            inner_loop_count ++;
-
-                            printf("\n inner_loop_count = %lld\n",buffer[k].pid);
-
-                            // try reading page from buffer
-                            UINT ntuples_of_cur_page_r = 0;
-                            UINT cur_page_slot_r = request_page(buffer[k].pid, r.oid);
-                            Page *cur_page_r = buffer[cur_page_slot_r].page_ptr;
-
-                            // if the page unloaded then read it from file
-                            if (cur_page_r == NULL) {
-                                cur_page_r = read_page_from_file(r.oid, buffer[k].pid, page_id_init_r);
-                                buffer[cur_page_slot_r].page_ptr = cur_page_r;
-                            }
-
-                            if (k == npages_r - 1) {
-                                ntuples_of_cur_page_r = ntuples_last_page_r;
-                            } else {
-                                ntuples_of_cur_page_r = ntuples_per_page_r;
-                            }
-
-                            // print the page
-                            puts ("cur_page_r");
-                            for (j = 0; j < ntuples_of_cur_page_r * nattrs_r; j += nattrs_r) {
-                                for (l = 0; l < nattrs_r; ++l) {
-                                    printf("%d ", cur_page_r->data[j + l]);
-                                }
-                                printf("\n");
-                            }
-                            printf("\n");
-
-                            for (i = 0; i < cf->buf_slots; ++i) {
-                                // outer loop
-                                if (buffer[i].oid == s.oid && buffer[i].pid >= page_id_init_s &&
-                                    buffer[i].pid < page_id_init_s + npages_s && buffer[i].page_ptr != NULL) {
-                                    if (is_in_buffer[buffer[i].pid - page_id_init_s] == -1){
-                                        continue;
-                                    }
-
-                                    outer_loop_count++;
-
-                                    printf("outer_loop_count = %lld\n",buffer[i].pid);
-
-                                    UINT ntuples_of_cur_page_s = 0;
-                                    UINT cur_page_slot_s = request_page(buffer[i].pid, s.oid);
-                                    Page *cur_page_s = buffer[cur_page_slot_s].page_ptr;
-
-                                    // if the page unloaded then read it from file
-                                    if (cur_page_s == NULL) {
-                                        printf("error");
-                                        cur_page_s = read_page_from_file(s.oid, buffer[i].pid, page_id_init_s);
-                                        buffer[cur_page_slot_s].page_ptr = cur_page_s;
-                                    }
-
-                                    if (i == npages_s - 1) {
-                                        ntuples_of_cur_page_s = ntuples_last_page_s;
-                                    } else {
-                                        ntuples_of_cur_page_s = ntuples_per_page_s;
-                                    }
-
-                                    // start matching
-
-                                    // print out the page
-                                    puts ("cur_page_s");
-                                    for (j = 0; j < ntuples_of_cur_page_s * nattrs_s; j += nattrs_s) {
-                                        for (l = 0; l < nattrs_s; ++l) {
-                                            printf("%d ", cur_page_s->data[j + l]);
-                                        }
-                                        printf("\n");
-                                    }
-
-                                    for (j =0; j < ntuples_of_cur_page_r * nattrs_r; j+= nattrs_r){
-                                        INT r_i = cur_page_r->data[j + idx1];
-                                        for (l = 0; l < ntuples_of_cur_page_s * nattrs_s; l += nattrs_s) {
-                                            INT s_i = cur_page_s->data[l + idx2];
-                                            if (r_i == s_i) {
-                                                // add the result to the result table
-                                                Tuple tup = malloc(sizeof(INT) * nattrs_res);
-                                                for (m = 0; m < nattrs_r; ++m) {
-                                                    tup[m] = cur_page_r->data[j + m];
-                                                }
-                                                for (m = 0; m < nattrs_s; ++m) {
-                                                    tup[nattrs_r + m] = cur_page_s->data[l + m];
-                                                }
-                                                tuples_cur_table[ntuples_res] = tup;
-                                                ++ntuples_res;
-                                            }
-                                        }
-
-                                    }
-                                }
-                            }
-                            // release page s
-                            release_page(cur_page_r->pid, r.oid);
-                            inner_in_buffer[cur_page_r->pid - page_id_init_r] = -1;
-                        }
-                    }
-
-                    if (inner_loop_count < npages_r) {
-
-                        INT count = 0;
-                        for (k = 0; k < npages_r && count < buf_slot_inner; ++k) {
-                            if (inner_in_buffer[k] == 0) {
-                                UINT cur_page_slot_r = request_page(page_id_init_r + k, r.oid);
-                                Page *cur_page_r = buffer[cur_page_slot_r].page_ptr;
-                                if (cur_page_r == NULL) {
-                                    cur_page_r = read_page_from_file(r.oid, page_id_init_r + k, page_id_init_r);
-                                    buffer[cur_page_slot_r].page_ptr = cur_page_r;
-                                }
-                                inner_in_buffer[k] = 1;
-                                count++;
-                            }
-                        }
-                    }
-
-                }
-
-                // release outer pages
-                for (i = 0; i < cf->buf_slots; ++i) {
-                    // try release page from buffer
-                    if (buffer[i].oid == s.oid && buffer[i].pid >= page_id_init_s &&
-                        buffer[i].pid < page_id_init_s + npages_s && buffer[i].page_ptr != NULL) {
-                        release_page(buffer[i].pid, s.oid);   // release page r
-                        is_in_buffer[buffer[i].pid - page_id_init_s] = -1;
+            // probe
+            for (UINT i = 0; i < probe->npages; ++i){
+                Page* page = get_page(probe->oid, probe->page_id_init + i, probe->page_id_init);
+                UINT ntuples_of_cur_page = rel_page_ntuples(probe, i);
+                for (UINT j = 0; j < ntuples_of_cur_page; ++j){
+                    const INT* tup = page->data + j * probe->nattrs;
+                    INT key = tup[probe_idx];
+                    for (UINT e = heads[hash_key(key) & (nbuckets - 1)]; e != NO_SLOT; e = next[e]){
+                        if (rows[e][build_idx] != key) continue;
+                        if (build_is_r) emit(out, rows[e], tup);
+                        else emit(out, tup, rows[e]);
                     }
                 }
-
-                // reload pages
-                if (outer_loop_count < npages_s) {
-                    INT count = 0;
-                    for (i = 0; i < npages_s && count < buf_slot_outer; ++i) {
-                        if (is_in_buffer[i] == 0) {
-                            UINT cur_page_slot_s = request_page(page_id_init_s + i, s.oid);
-                            Page *cur_page_s = buffer[cur_page_slot_s].page_ptr;
-                            if (cur_page_s == NULL) {
-                                cur_page_s = read_page_from_file(s.oid, page_id_init_s + i, page_id_init_s);
-                                buffer[cur_page_slot_s].page_ptr = cur_page_s;
-                            }
-                            is_in_buffer[i] = 1;
-                            count++;
-                        }
-                    }
-                }
-
+                release_page(probe->page_id_init + i, probe->oid);
             }
 
-
-            result = malloc(sizeof(_Table)+sizeof(Tuple)*ntuples_res);
-            result->ntuples = ntuples_res;
-            result->nattrs = nattrs_res;
-            for (i=0;i<ntuples_res;++i){
-                result->tuples[i] = tuples_cur_table[i];
-            }
-            if (tuples_cur_table != NULL)
-                free(tuples_cur_table);
-
-            unpin_file(r.oid);
-            unpin_file(s.oid);
-
-            return result;
-
-
+            for (UINT k = 0; k < nblock; ++k)
+                release_page(build->page_id_init + first + k, build->oid);
+            free(heads);
+            free(next);
+            free(rows);
         }
+    }
 
+    for (UINT p = 0; p < nparts; ++p){
+        drop_rel(&parts_r[p]);
+        drop_rel(&parts_s[p]);
+    }
+}
 
-    } else {
-
-        //// sort-merge join
-
-        puts("sort-merge join");
-
-        // initialize the sorted table
-        INT ntuples_res_r = 0;  // for number of tuples check
-        INT ntuples_res_s = 0;  // for number of tuples check
-
-        Tuple * tuples_r = malloc(sizeof(Tuple)*ntuples_r);
-        Tuple * tuples_s = malloc(sizeof(Tuple)*ntuples_s);
+// parallel Grace hash join, threads=N
+// the same partitions as hash_join(), with every phase cut into morsels of
+// MORSEL_PAGES pages for parallel_for(). while partitioning, each worker
+// stages tuples in a page sized buffer per partition and appends the buffer
+// to the shared partition file under the partition's lock. the partitions
+// are then joined one after the other: all workers insert the pinned build
+// chunk into one hash table with atomic bucket heads, then probe it with
+// morsels of the probe partition, so a partition swollen by skewed keys is
+// spread over all of them. each worker emits into its own result.
+
+typedef struct HashPart {   // partition file shared by the workers
+    Rel rel;
+    pthread_mutex_t lock;
+} HashPart;
+
+typedef struct PartitionJob {
+    Rel* rel;
+    UINT idx;
+    const ZoneMap* zm;
+    INT lo;                 // key range of the other table
+    INT hi;
+    UINT skipped;
+    HashPart* parts;
+    UINT nparts;
+    INT* staged;            // nworkers x nparts buffers of cap tuples
+    UINT* nstaged;
+    UINT cap;
+} PartitionJob;
+
+typedef struct ProbeJob {   // one build chunk of a partition
+    Rel* build;
+    Rel* probe;
+    UINT build_idx;
+    UINT probe_idx;
+    UINT build_is_r;
+    UINT first;             // first build page of the chunk
+    UINT nblock;
+    UINT* base;             // hash table row of the first tuple of each build page
+    UINT* heads;
+    UINT* next;
+    INT** rows;
+    UINT nbuckets;
+    JoinOut* outs;          // one per worker
+} ProbeJob;
+
+// append the staged tuples of worker w for partition p
+static void flush_staged(PartitionJob* job, UINT w, UINT p){
+    UINT k = w * job->nparts + p;
+    UINT nattrs = job->rel->nattrs;
+    const INT* buf = job->staged + (size_t)k * job->cap * nattrs;
+    HashPart* part = &job->parts[p];
+    pthread_mutex_lock(&part->lock);
+    for (UINT t = 0; t < job->nstaged[k]; ++t)
+        memcpy(rel_append(&part->rel), buf + (size_t)t * nattrs, sizeof(INT) * nattrs);
+    pthread_mutex_unlock(&part->lock);
+    job->nstaged[k] = 0;
+}
 
-        for (i=0;i<ntuples_r;++i){
-            tuples_r[i] = NULL;
+static void partition_morsel(void* arg, UINT morsel, UINT w){
+    PartitionJob* job = arg;
+    Rel* rel = job->rel;
+    UINT last = (morsel + 1) * MORSEL_PAGES;
+    if (last > rel->npages) last = rel->npages;
+    for (UINT i = morsel * MORSEL_PAGES; i < last; ++i){
+        if (!zone_overlaps(job->zm, i, job->idx, job->lo, job->hi)){
+            __atomic_add_fetch(&job->skipped, 1, __ATOMIC_RELAXED);
+            continue;
         }
-        for (i=0;i<ntuples_s;++i){
-            tuples_s[i] = NULL;
+        Page* page = get_page(rel->oid, rel->page_id_init + i, rel->page_id_init);
+        UINT ntuples_of_cur_page = rel_page_ntuples(rel, i);
+        for (UINT j = 0; j < ntuples_of_cur_page; ++j){
+            const INT* tup = page->data + j * rel->nattrs;
+            UINT p = hash_key(tup[job->idx]) % job->nparts;
+            UINT k = w * job->nparts + p;
+            INT* buf = job->staged + ((size_t)k * job->cap + job->nstaged[k]) * rel->nattrs;
+            memcpy(buf, tup, sizeof(INT) * rel->nattrs);
+            if (++job->nstaged[k] == job->cap) flush_staged(job, w, p);
         }
+        release_page(rel->page_id_init + i, rel->oid);
+    }
+}
 
-        // read all tuples from table r
-
-        puts("start to read all tuples from table r");
-
-        for (i=0;i<npages_r;++i){
-            // try reading page from buffer
-            UINT ntuples_of_cur_page_r = 0;
-            UINT cur_page_slot_r = request_page(page_id_init_r+i,r.oid);
-            Page *cur_page_r = buffer[cur_page_slot_r].page_ptr;
-
-//            printf("read page %lld of oid: %d from buffer\n", page_id_init_r+i, r.oid);
-
-            // if the page unloaded then read it from file
-            if (cur_page_r == NULL){
-                cur_page_r = read_page_from_file(r.oid, page_id_init_r+i, page_id_init_r);
-                buffer[cur_page_slot_r].page_ptr = cur_page_r;
-            }
-
-            if (cur_page_r == NULL)
-                puts("cur_page_r is NULL!!!!!!");
-
-//            puts("read page from file done ");
+static void partition_rel_parallel(Rel* rel, const UINT idx, HashPart* parts, UINT nparts, UINT nworkers, INT lo, INT hi){
+    PartitionJob job = { rel, idx, zone_map(rel->oid), lo, hi, 0, parts, nparts, NULL, NULL, rel->ntuples_per_page };
+    for (UINT p = 0; p < nparts; ++p){
+        parts[p].rel = create_temp_rel(rel->nattrs);
+        pthread_mutex_init(&parts[p].lock, NULL);
+    }
+    job.staged = malloc(sizeof(INT) * (size_t)nworkers * nparts * job.cap * rel->nattrs);
+    job.nstaged = calloc((size_t)nworkers * nparts, sizeof(UINT));
 
-            if (i == npages_r-1){
-                ntuples_of_cur_page_r = ntuples_last_page_r;
-            } else{
-                ntuples_of_cur_page_r = ntuples_per_page_r;
-            }
+    parallel_for(nworkers, div_ceil(rel->npages, MORSEL_PAGES), partition_morsel, &job);
+    zone_skipped(job.skipped);
 
-//            puts("start to copy tuples from page r");
+    for (UINT w = 0; w < nworkers; ++w){
+        for (UINT p = 0; p < nparts; ++p) flush_staged(&job, w, p);
+    }
+    for (UINT p = 0; p < nparts; ++p) rel_finish(&parts[p].rel);
+    free(job.staged);
+    free(job.nstaged);
+}
 
-            for (j=0; j < ntuples_of_cur_page_r*nattrs_r; j+=nattrs_r){  // for each tuple in the page
+// pin build pages of the chunk and link their tuples into the hash table
+static void build_morsel(void* arg, UINT morsel, UINT w){
+    ProbeJob* job = arg;
+    Rel* build = job->build;
+    UINT last = (morsel + 1) * MORSEL_PAGES;
+    if (last > job->nblock) last = job->nblock;
+    for (UINT k = morsel * MORSEL_PAGES; k < last; ++k){
+        UINT i = job->first + k;
+        Page* page = get_page(build->oid, build->page_id_init + i, build->page_id_init);
+        UINT ntuples_of_cur_page = rel_page_ntuples(build, i);
+        for (UINT j = 0; j < ntuples_of_cur_page; ++j){
+            UINT n = job->base[k] + j;
+            job->rows[n] = page->data + j * build->nattrs;
+            UINT b = hash_key(job->rows[n][job->build_idx]) & (job->nbuckets - 1);
+            job->next[n] = __atomic_exchange_n(&job->heads[b], n, __ATOMIC_RELAXED);
+        }
+    }
+}
 
-                Tuple tup = malloc(sizeof(INT)*nattrs_r);
-                for (k=0;k<nattrs_r;++k){   // for each attribute in the tuple
-                    tup[k] = cur_page_r->data[j+k];
-                }
-                tuples_r[ntuples_res_r] = tup;
-                ++ntuples_res_r;
+static void probe_morsel(void* arg, UINT morsel, UINT w){
+    ProbeJob* job = arg;
+    Rel* probe = job->probe;
+    JoinOut* out = &job->outs[w];
+    UINT last = (morsel + 1) * MORSEL_PAGES;
+    if (last > probe->npages) last = probe->npages;
+    for (UINT i = morsel * MORSEL_PAGES; i < last; ++i){
+        Page* page = get_page(probe->oid, probe->page_id_init + i, probe->page_id_init);
+        UINT ntuples_of_cur_page = rel_page_ntuples(probe, i);
+        for (UINT j = 0; j < ntuples_of_cur_page; ++j){
+            const INT* tup = page->data + j * probe->nattrs;
+            INT key = tup[job->probe_idx];
+            for (UINT e = job->heads[hash_key(key) & (job->nbuckets - 1)]; e != NO_SLOT; e = job->next[e]){
+                if (job->rows[e][job->build_idx] != key) continue;
+                if (job->build_is_r) emit(out, job->rows[e], tup);
+                else emit(out, tup, job->rows[e]);
             }
-
-//            puts("copy tuples from page done");
-
-            release_page(cur_page_r->pid,r.oid);
         }
+        release_page(probe->page_id_init + i, probe->oid);
+    }
+}
 
-        if (ntuples_res_r != ntuples_r)
-            printf("Error: ntuples_res_r %d != ntuples_r %d\n", ntuples_res_r, ntuples_r);
-
-
-        puts("\nstart to read all tuples from table s\n");
-
-
-        for (i=0;i<npages_s;++i){
-
-//            printf("the %dth page of s\n", i);
-            // try reading page from buffer
-            UINT ntuples_of_cur_page_s = 0;
-            UINT cur_page_slot_s = request_page(page_id_init_s+i,s.oid);
-            Page *cur_page_s = buffer[cur_page_slot_s].page_ptr;
+// workers of a parallel hash join, at least half the slots stay for the
+// partition tails and the build chunk
+static UINT join_workers(){
+    UINT nworkers = cf->threads;
+    if (nworkers > work_slots() / 2) nworkers = work_slots() / 2;
+    return nworkers;
+}
 
-            // if the page unloaded then read it from file
-            if (cur_page_s == NULL){
-                cur_page_s = read_page_from_file(s.oid, page_id_init_s+i, page_id_init_s);
-                buffer[cur_page_slot_s].page_ptr = cur_page_s;
-            }
+static void parallel_hash_join(Rel* r, const UINT idx1, Rel* s, const UINT idx2, JoinOut* out, UINT nworkers){
+    UINT build_is_r = r->npages <= s->npages;
+    // every worker pins one input page besides the partition tails
+    // or the build chunk
+    UINT nparts = hash_join_partitions(build_is_r ? r->npages : s->npages);
+    if (nparts > work_slots() - nworkers) nparts = work_slots() - nworkers;
+    HashPart parts_r[nparts];
+    HashPart parts_s[nparts];
+    UINT steals = 0;
+
+    INT lo_r, hi_r, lo_s, hi_s;
+    zone_table_bounds(zone_map(r->oid), idx1, &lo_r, &hi_r);
+    zone_table_bounds(zone_map(s->oid), idx2, &lo_s, &hi_s);
+    partition_rel_parallel(r, idx1, parts_r, nparts, nworkers, lo_s, hi_s);
+    partition_rel_parallel(s, idx2, parts_s, nparts, nworkers, lo_r, hi_r);
+
+    JoinOut outs[nworkers];
+    for (UINT w = 0; w < nworkers; ++w){
+        outs[w] = *out;
+        outs[w].result = new_result(out->nattrs_r + out->nattrs_s);
+    }
 
-            if (i == npages_s-1){
-                ntuples_of_cur_page_s = ntuples_last_page_s;
-            } else{
-                ntuples_of_cur_page_s = ntuples_per_page_s;
+    UINT chunk = work_slots() - nworkers;
+    for (UINT p = 0; p < nparts; ++p){
+        ProbeJob job;
+        job.build = build_is_r ? &parts_r[p].rel : &parts_s[p].rel;
+        job.probe = build_is_r ? &parts_s[p].rel : &parts_r[p].rel;
+        job.build_idx = build_is_r ? idx1 : idx2;
+        job.probe_idx = build_is_r ? idx2 : idx1;
+        job.build_is_r = build_is_r;
+        job.outs = outs;
+        if (job.build->ntuples == 0 || job.probe->ntuples == 0) continue;
+
+        UINT base[chunk];
+        job.base = base;
+        for (job.first = 0; job.first < job.build->npages; job.first += chunk){
+            job.nblock = job.build->npages - job.first;
+            if (job.nblock > chunk) job.nblock = chunk;
+
+            UINT ntuples = 0;
+            for (UINT k = 0; k < job.nblock; ++k){
+                base[k] = ntuples;
+                ntuples += rel_page_ntuples(job.build, job.first + k);
             }
+            job.nbuckets = 1;
+            while (job.nbuckets < 2 * ntuples) job.nbuckets <<= 1;
+            job.heads = malloc(sizeof(UINT) * job.nbuckets);
+            job.next = malloc(sizeof(UINT) * ntuples);
+            job.rows = malloc(sizeof(INT*) * ntuples);
+            for (UINT b = 0; b < job.nbuckets; ++b) job.heads[b] = NO_SLOT;
+
+            steals += parallel_for(nworkers, div_ceil(job.nblock, MORSEL_PAGES), build_morsel, &job);
+            steals += parallel_for(nworkers, div_ceil(job.probe->npages, MORSEL_PAGES), probe_morsel, &job);
+
+            for (UINT k = 0; k < job.nblock; ++k)
+                release_page(job.build->page_id_init + job.first + k, job.build->oid);
+            free(job.heads);
+            free(job.next);
+            free(job.rows);
+        }
+    }
 
-//            puts("start to copy tuples from page s");
+    for (UINT w = 0; w < nworkers; ++w) concat_result(out->result, outs[w].result);
+    for (UINT p = 0; p < nparts; ++p){
+        drop_rel(&parts_r[p].rel);
+        drop_rel(&parts_s[p].rel);
+        pthread_mutex_destroy(&parts_r[p].lock);
+        pthread_mutex_destroy(&parts_s[p].lock);
+    }
+    printf("hash join: %u workers, %u partitions, %u steals\n", nworkers, nparts, steals);
+}
 
-            for (j=0; j < ntuples_of_cur_page_s*nattrs_s; j+=nattrs_s){  // for each tuple in the page
-                Tuple tup = malloc(sizeof(INT)*nattrs_s);
-                for (k=0;k<nattrs_s;++k){   // for each attribute in the tuple
-                    tup[k] = cur_page_s->data[j+k];
+// index nested loop join
+// every tuple of the outer table looks its key up in an index on the join
+// attribute of the inner table and fetches the matching inner tuples, the
+// pages of the inner table a key matches are read once per outer tuple
+static void index_nested_loop_join(Rel* r, const UINT idx1, Rel* s, const UINT idx2, const Index* ix, UINT outer_is_r, JoinOut* out){
+    Rel* outer = outer_is_r ? r : s;
+    Rel* inner = outer_is_r ? s : r;
+    UINT outer_idx = outer_is_r ? idx1 : idx2;
+    KeyRef* refs = NULL;
+    UINT size = 0;
+    // with zone maps, outer pages outside the keys of the index are not read
+    const ZoneMap* zm = zone_map(outer->oid);
+    UINT skipped = 0;
+
+    AccessStrategy* strategy = get_access_strategy(ACCESS_SEQUENTIAL, outer->npages);
+    for (UINT i = 0; i < outer->npages; ++i){
+        if (!zone_overlaps(zm, i, outer_idx, ix->min_key, ix->max_key)){
+            ++skipped;
+            continue;
+        }
+        Page* page = get_page_with(outer->oid, outer->page_id_init + i, outer->page_id_init, strategy);
+        UINT ntuples_of_cur_page = rel_page_ntuples(outer, i);
+        for (UINT j = 0; j < ntuples_of_cur_page; ++j){
+            const INT* tup = page->data + j * outer->nattrs;
+            UINT n = index_lookup(ix, tup[outer_idx], tup[outer_idx], &refs, &size);
+            // equal keys are in tuple order, so the matches of a page are together
+            for (UINT k = 0; k < n; ){
+                UINT p = refs[k].key / inner->ntuples_per_page;
+                Page* inner_page = get_page(inner->oid, inner->page_id_init + p, inner->page_id_init);
+                for (; k < n && refs[k].key / inner->ntuples_per_page == p; ++k){
+                    const INT* match = inner_page->data + (refs[k].key % inner->ntuples_per_page) * inner->nattrs;
+                    if (outer_is_r) emit(out, tup, match);
+                    else emit(out, match, tup);
                 }
-                tuples_s[ntuples_res_s] = tup;
-                ++ntuples_res_s;
+                release_page(inner->page_id_init + p, inner->oid);
             }
-
-            release_page(cur_page_s->pid,s.oid);
         }
+        release_page(outer->page_id_init + i, outer->oid);
+    }
+    free_access_strategy(strategy);
+    zone_skipped(skipped);
+    free(refs);
+}
 
-        if (ntuples_res_s != ntuples_s)
-            printf("Error: ntuples_res_s %d != ntuples_s %d\n", ntuples_res_s, ntuples_s);
-
-
-        puts("sort-merge join init done");
-
-        //// sort the tables first
-
-        // sort the tuples in r according to idx1
-        idx_cmp_use_only = idx1;
-        qsort(tuples_r, ntuples_r, sizeof(Tuple), compare_tuples);
-        // sort the tuples in s according to idx2
-        idx_cmp_use_only = idx2;
-        qsort(tuples_s, ntuples_s, sizeof(Tuple), compare_tuples);
-
-
-//        puts("sort-merge join sort done");
-
-        // merge the two sorted tables
-
-        // algorithm according to Fundamentals of Database Systems, 6th edition, p. 556
-
-//        puts("R");
-//        for (i=0;i<ntuples_r;++i){
-//            for (j=0;j<nattrs_r;++j){
-//                printf("%d ", tuples_r[i][j]);
-//            }
-//            puts("");
-//        }
-//
-//        puts("S");
-//        for (i=0;i<ntuples_s;++i){
-//            for (j=0;j<nattrs_s;++j){
-//                printf("%d ", tuples_s[i][j]);
-//            }
-//            puts("");
-//        }
-
-        i = 0;
-        j = 0;
-        k = 0;
-        l = 0;
-
-        while (i < ntuples_r && j < ntuples_s){
-            if (tuples_r[i][idx1] < tuples_s[j][idx2]){
-                ++i;
-            } else if (tuples_r[i][idx1] > tuples_s[j][idx2]){
-                ++j;
-            } else{
+// one probe of ix per tuple of outer, the inner table has ntuples
+static UINT64 cost_index_probes(const Rel* outer, const Index* ix, UINT ntuples){
+    double matches = ix->ndistinct > 0 ? (double)ntuples / ix->ndistinct : 0;
+    return outer->npages + (UINT64)(outer->ntuples * (index_probe_cost(ix, matches) + matches));
+}
 
-//                printf("\n match: i: %d, j: %d\n\n", i, j);
+// the cheapest index on either join attribute for an index nested loop
+// join, the other table is the outer one. JOIN_NO_COST if there is none
+static UINT64 cost_index_nested_loop(const Rel* r, const UINT idx1, const Rel* s, const UINT idx2, const Index** best, UINT* outer_is_r){
+    UINT64 cost = JOIN_NO_COST;
+    *best = NULL;
+    *outer_is_r = 1;
+    // the outer page, an index page and an inner page
+    if (work_slots() < 3) return cost;
+    for (UINT type = INDEX_BTREE; type <= INDEX_HASH; ++type){
+        const Index* on_s = find_index(s->oid, idx2, type);
+        const Index* on_r = find_index(r->oid, idx1, type);
+        UINT64 c;
+        if (on_s != NULL && (c = cost_index_probes(r, on_s, s->ntuples)) < cost){
+            cost = c;
+            *best = on_s;
+            *outer_is_r = 1;
+        }
+        if (on_r != NULL && (c = cost_index_probes(s, on_r, r->ntuples)) < cost){
+            cost = c;
+            *best = on_r;
+            *outer_is_r = 0;
+        }
+    }
+    return cost;
+}
 
-                // join the two tuples
-                Tuple tup = malloc(sizeof(INT)*(nattrs_res));
-                for (m=0;m<nattrs_r;++m){
-                    tup[m] = tuples_r[i][m];
-                }
-                for (m=0;m<nattrs_s;++m){
-                    tup[nattrs_r+m] = tuples_s[j][m];
-                }
-                tuples_cur_table[ntuples_res] = tup;
-                ++ntuples_res;
-
-                // match the same value in R
-                l = j+1;
-                while (l < ntuples_s && tuples_r[i][idx1] == tuples_s[l][idx2]){
-                    // join the two tuples
-                    Tuple tup2 = malloc(sizeof(INT)*(nattrs_res));
-                    for (m=0;m<nattrs_r;++m){
-                        tup2[m] = tuples_r[i][m];
-                    }
-                    for (m=0;m<nattrs_s;++m){
-                        tup2[nattrs_r+m] = tuples_s[l][m];
-                    }
-                    tuples_cur_table[ntuples_res] = tup2;
-                    ++ntuples_res;
-                    // index increase
-                    ++l;
-                }
-                // maybe ++i instead of k = i+1
-                ++i;
+static const char* join_names[] = { "auto", "nested loop", "sort-merge", "hash", "index nested loop" };
+
+// semi-join reduction: a blocked Bloom filter on the join keys of build,
+// sized for the pages a join may pin, then the tuples of probe whose key may
+// be in it copied to a temp file. returns 0, and drops the copy, when it has
+// as many pages as probe, otherwise *reduced holds the candidates
+static UINT bloom_reduce(Rel* build, const UINT build_idx, Rel* probe, const UINT probe_idx, Rel* reduced){
+    Bloom bf;
+    bloom_init(&bf, build->ntuples, work_slots() * cf->page_size);
+    INT lo = INT32_MAX, hi = INT32_MIN;
+    AccessStrategy* strategy = get_access_strategy(ACCESS_SEQUENTIAL, build->npages);
+    for (UINT i = 0; i < build->npages; ++i){
+        Page* page = get_page_with(build->oid, build->page_id_init + i, build->page_id_init, strategy);
+        UINT ntuples_of_cur_page = rel_page_ntuples(build, i);
+        for (UINT j = 0; j < ntuples_of_cur_page; ++j){
+            INT key = page->data[j * build->nattrs + build_idx];
+            bloom_add(&bf, key);
+            if (key < lo) lo = key;
+            if (key > hi) hi = key;
+        }
+        release_page(build->page_id_init + i, build->oid);
+    }
+    free_access_strategy(strategy);
+
+    // the zone map rules out pages outside the keys of build without reading them
+    const ZoneMap* zm = zone_map(probe->oid);
+    UINT64 match[FILTER_WORDS(probe->ntuples_per_page)];
+    UINT npruned = 0, skipped = 0;
+    *reduced = create_temp_rel(probe->nattrs);
+    strategy = get_access_strategy(ACCESS_SEQUENTIAL, probe->npages);
+    for (UINT i = 0; i < probe->npages; ++i){
+        if (!zone_overlaps(zm, i, probe_idx, lo, hi)){
+            ++skipped;
+            ++npruned;
+            continue;
+        }
+        Page* page = get_page_with(probe->oid, probe->page_id_init + i, probe->page_id_init, strategy);
+        UINT ntuples_of_cur_page = rel_page_ntuples(probe, i);
+        if (bloom_page(&bf, page->data, ntuples_of_cur_page, probe->nattrs, probe_idx, match) == 0) ++npruned;
+        for (UINT j = 0; j < FILTER_WORDS(ntuples_of_cur_page); ++j){
+            for (UINT64 w = match[j]; w != 0; w &= w - 1){
+                UINT k = j * 64 + __builtin_ctzll(w);
+                memcpy(rel_append(reduced), page->data + k * probe->nattrs, sizeof(INT) * probe->nattrs);
             }
-//            // match the same value in S
-//            k = i+1;
-//            while(k < ntuples_r && tuples_r[k][idx1] == tuples_s[j][idx2]){
-//
-//                // join the two tuples
-//                Tuple tup2 = malloc(sizeof(INT)*(nattrs_res));
-//                for (m=0;m<nattrs_r;++m){
-//                    tup2[m] = tuples_r[k][m];
-//                }
-//                for (m=0;m<nattrs_s;++m){
-//                    tup2[nattrs_r+m] = tuples_s[j][m];
-//                }
-//                tuples_cur_table[ntuples_res] = tup2;
-//                ++ntuples_res;
-//                // index increase
-//                ++k;
-//
-//            }
-//            // set i, j
-//            i = k;
-//            j = l;
         }
+        release_page(probe->page_id_init + i, probe->oid);
+    }
+    free_access_strategy(strategy);
+    rel_finish(reduced);
+    zone_skipped(skipped);
 
-        // write the result to file
-        result = malloc(sizeof(_Table) + sizeof(Tuple) * ntuples_res);
-        result->ntuples = ntuples_res;
-        result->nattrs = nattrs_res;
-
-//        puts("show result");
-
-
-        for (i = 0; i < ntuples_res; ++i) {
-            result->tuples[i] = tuples_cur_table[i];
-
+    printf("bloom filter: %u bits, %u hashes, %u of %u pages and %u of %u tuples pruned\n",
+        bf.nblocks * BLOOM_BLOCK_WORDS * 64, bf.k, npruned, probe->npages, probe->ntuples - reduced->ntuples, probe->ntuples);
+    bloom_free(&bf);
 
-//            for (j = 0; j < nattrs_res; ++j) {
-//                printf("%d ", tuples_cur_table[i][j]);
-//            }
-//            printf("\n");
+    if (reduced->npages < probe->npages) return 1;
+    drop_rel(reduced);
+    return 0;
+}
 
+// strategy with the fewest estimated page I/Os, ties go to the one listed
+// first, unless Conf.join_algo forces one that can run
+static UINT choose_join(Rel* r, const UINT idx1, Rel* s, const UINT idx2, const Index** ix, UINT* ix_outer_is_r, UINT64* cost){
+    UINT64 costs[JOIN_INDEX + 1];
+    costs[JOIN_AUTO] = JOIN_NO_COST;
+    costs[JOIN_NESTED_LOOP] = cost_nested_loop(r, s);
+    costs[JOIN_SORT_MERGE] = cost_sort_merge(r, s);
+    costs[JOIN_HASH] = cost_hash(r, s);
+    costs[JOIN_INDEX] = cost_index_nested_loop(r, idx1, s, idx2, ix, ix_outer_is_r);
+
+    UINT algo = cf->join_algo;
+    if (algo == JOIN_AUTO || costs[algo] == JOIN_NO_COST){
+        algo = JOIN_NESTED_LOOP;
+        for (UINT a = JOIN_NESTED_LOOP; a <= JOIN_INDEX; ++a){
+            if (costs[a] < costs[algo]) algo = a;
         }
+    }
+    assert(costs[algo] != JOIN_NO_COST);
+    *cost = costs[algo];
+    return algo;
+}
 
-//        puts("show result done");
-//
-
-        puts("sort-merge join done && start to free");
+_Table* join(const UINT idx1, const char* table1_name, const UINT idx2, const char* table2_name){
 
-        // release tuples_r and tuples_s & tuples inside them
-        for (i = 0; i < ntuples_r; ++i) {
-            if (tuples_r[i] != NULL) free(tuples_r[i]);
-        }
-        if (tuples_r != NULL) free(tuples_r);
+    printf("join() is invoked.\n");
+    // invoke log_read_page() every time a page is read from the hard drive.
+    // invoke log_release_page() every time a page is released from the memory.
 
-//        puts("sort-merge join free tuples_r done");
+    // invoke log_open_file() every time a page is read from the hard drive.
+    // invoke log_close_file() every time a page is released from the memory.
 
-        for (i = 0; i < ntuples_s; ++i) {
-            if (tuples_s[i] != NULL) free(tuples_s[i]);
+    Table* t_r = find_table(table1_name);
+    Table* t_s = find_table(table2_name);
+    assert(t_r != NULL && t_s != NULL);
+    assert(idx1 < t_r->nattrs && idx2 < t_s->nattrs);
+
+    Rel r = open_rel(t_r);
+    Rel s = open_rel(t_s);
+
+    printf("ntuples_r = %u, nattrs_r = %u, npages_r = %u\n", r.ntuples, r.nattrs, r.npages);
+    printf("ntuples_s = %u, nattrs_s = %u, npages_s = %u\n", s.ntuples, s.nattrs, s.npages);
+
+    const Index* ix;
+    UINT ix_outer_is_r;
+    UINT64 cost;
+    UINT algo = choose_join(&r, idx1, &s, idx2, &ix, &ix_outer_is_r, &cost);
+
+    // with bloom=on the table with more tuples is replaced by those that may
+    // match the other and the strategy chosen again. an index nested loop
+    // join already reads only those, and in a self-join on one attribute
+    // every tuple matches
+    Rel* probe = NULL;
+    Rel reduced;
+    if (cf->bloom && algo != JOIN_INDEX && !(t_r == t_s && idx1 == idx2)){
+        UINT build_is_r = r.ntuples <= s.ntuples;
+        probe = build_is_r ? &s : &r;
+        if (bloom_reduce(build_is_r ? &r : &s, build_is_r ? idx1 : idx2, probe, build_is_r ? idx2 : idx1, &reduced)){
+            Rel table = *probe;
+            *probe = reduced;
+            reduced = table;
+            algo = choose_join(&r, idx1, &s, idx2, &ix, &ix_outer_is_r, &cost);
         }
-        if (tuples_s != NULL) free(tuples_s);
-
-//        puts("sort-merge join free tuples_s done");
-
-        // release the shell tuples_cur_table
-        if (tuples_cur_table != NULL) free(tuples_cur_table);
-
-//        puts("sort-merge join free tuples_cur_table done");
-
-        unpin_file(r.oid);
-        unpin_file(s.oid);
-
-//        puts("sort-merge join free done && return");
+        else probe = NULL;
+    }
+    printf("join() is %s join, estimated page I/O %llu.\n", join_names[algo], (unsigned long long)cost);
 
-        return result;
+    JoinOut out = { new_result(r.nattrs + s.nattrs), r.nattrs, s.nattrs };
+    if (algo == JOIN_NESTED_LOOP) nested_loop_join(&r, idx1, &s, idx2, &out);
+    else if (algo == JOIN_SORT_MERGE) sort_merge_join(&r, idx1, &s, idx2, &out);
+    else if (algo == JOIN_INDEX) index_nested_loop_join(&r, idx1, &s, idx2, ix, ix_outer_is_r, &out);
+    else if (join_workers() > 1) parallel_hash_join(&r, idx1, &s, idx2, &out, join_workers());
+    else hash_join(&r, idx1, &s, idx2, &out);
+    if (probe != NULL) drop_rel(probe);
 
-    }
+    printf("%s join: read_io %u, write_io %u\n", join_names[algo], cf->read_io, cf->write_io);
 
-//    return NULL;
-}
\ No newline at end of file
+    return out.result;
+}
@@ -1,9 +1,25 @@
 #ifndef RO_H
 #define RO_H
 #include "db.h"
+#include "filter.h"
 
 #define INT64 int64_t
 
+#define PT_EMPTY UINT32_MAX   // free entry in the page table
+#define NO_SLOT UINT32_MAX    // no buffer slot
+#define LRU_K 2               // K of the LRU-K policy
+#define RING_SLOTS 32         // max slots recycled by a sequential scan
+#define ARENA_ALIGN 4096      // alignment of the page frame arena
+#define TEMP_OID_BASE 0x40000000  // oids of temp files written by operators
+#define INDEX_OID_BASE 0x20000000 // oids of index files
+#define JOIN_NO_COST UINT64_MAX   // join strategy cannot run
+#define PT_LOCKS 64               // lock stripes of the page table
+#define MORSEL_PAGES 4            // pages per morsel of a parallel operator
+
+// access pattern hints for get_access_strategy()
+#define ACCESS_RANDOM 0
+#define ACCESS_SEQUENTIAL 1
+
 typedef struct Page {   // page data structure
     UINT64 pid;
     INT* data;
@@ -14,35 +30,149 @@ typedef struct Slot {   // buffer slot
     INT64 pid;
     UINT64 pin;
     UINT64 usage;
-    Page* page_ptr;
+    Page* page_ptr;         // &page once a page is loaded, NULL otherwise
+    INT8* frame;            // fixed page frame of the slot in the arena
+    Page page;              // view of the frame, data points into it
+    UINT64 page_id_init;    // first page id of the file, to locate the page
+    UINT dirty;             // frame differs from the page on disk
+    UINT io;                // read ahead in flight into the frame
+    UINT prefetched;        // read ahead and not requested since
+    UINT mapped;            // page.data points into a file mapping, not the frame
+    UINT loading;           // claimed, page_ptr is set by whoever claimed it
+    UINT pt_next;           // next slot in the page table chain
+    // replacement policy state
+    UINT prev;              // neighbours in the policy's slot list
+    UINT next;
+    UINT queue;             // 2Q queue the slot is in
+    UINT ring;              // id of the access strategy owning the slot, 0 if none
+    UINT64 hist[LRU_K];     // LRU-K reference times, most recent first
+    UINT heap;              // position in the LRU-K heap, NO_SLOT if not in it
 } Slot;
 
+typedef struct AccessStrategy {   // ring of slots recycled by one scan
+    UINT id;
+    UINT size;
+    UINT cur;
+    UINT slots[];
+} AccessStrategy;
+
+typedef struct Policy {   // buffer replacement policy, hooks may be NULL
+    const char* name;
+    void (*hit)(UINT slot);     // requested page found in the slot
+    void (*miss)(UINT slot);    // requested page assigned to the slot
+    UINT (*evict)();            // unpinned slot to reuse, NO_SLOT if all are pinned
+    void (*unpin)(UINT slot);   // page in the slot released
+    void (*drop)(UINT slot);    // slot emptied, reuse it first
+    UINT concurrent;            // hit may run without the latch, no unpin hook
+} Policy;
+
+typedef struct Rel {   // page layout of a table or temp file
+    UINT oid;
+    UINT nattrs;
+    UINT ntuples;
+    UINT npages;
+    UINT ntuples_per_page;
+    UINT64 page_id_init;
+    Page* tail;             // pinned last page while appending
+} Rel;
+
+typedef struct RelCursor {   // position of a scan over a Rel
+    Rel* rel;
+    UINT page;
+    UINT pos;
+    Page* cur;              // pinned current page, NULL past the end
+} RelCursor;
+
+typedef struct Mapping {   // read-only mapping of a table file, storage=mmap
+    INT64 oid;
+    INT8* addr;
+    size_t size;
+    UINT sequential;        // MADV_SEQUENTIAL applied
+} Mapping;
+
 typedef struct File_Pointer {   // file limitation management
-    FILE* fp;
+    INT fd;                 // -1 if the entry is free
     INT64 oid;
-    UINT64 pin;
+    UINT64 pin;             // open_file() calls not matched by unpin_file() yet
+    UINT prev;              // neighbours in the LRU list of open files
+    UINT next;
 } File_Pointer;
 
 // Inner functions
 // buffer management
-//UINT request_page(UINT64 pid, UINT oid);
-//void release_page(UINT64 pid, UINT oid);
+UINT request_page(UINT64 pid, UINT oid);
+// strategy may be NULL, then it is the same as request_page(). under the
+// latch NO_SLOT when the victim is dirty and no file entry is free for it
+UINT request_page_with(UINT64 pid, UINT oid, AccessStrategy* strategy);
+void release_page(UINT64 pid, UINT oid);
+// slots one query may pin, the buffer divided among the sessions
+UINT work_slots();
+// ring for a scan of npages pages, NULL if the normal buffer should be used
+AccessStrategy* get_access_strategy(UINT hint, UINT npages);
+void free_access_strategy(AccessStrategy* strategy);
+// a miss returns the slot pinned with page_ptr NULL, the caller loads the
+// page and calls page_loaded(), other requests for it wait until then
+void page_loaded(UINT slot);
+// slot holding (oid, pid), PT_EMPTY if the page is not buffered, under the latch
+UINT pt_lookup(UINT64 pid, UINT oid);
+
+// replacement policies (policy.c), selected by Conf.buf_policy
+const Policy* init_policy(const char* name);
+void free_policy();
+
+// file descriptor of oid, pinned until unpin_file(), waits while every entry
+// is pinned. under the latch it finishes the reads ahead and is -1 instead
+INT open_file(UINT oid);
+void unpin_file(UINT oid);
+void close_file(UINT oid);
+UINT64 read_first_pid(UINT oid);
+
+// storage=mmap: table files are mapped once and stay mapped until release(),
+// temp files and pages beyond the mapped size use the frames as usual
+UINT file_mapped(UINT oid);
+// madvise() the n pages from page offset first, 0 if oid is not mapped
+UINT advise_pages(UINT oid, UINT64 first, UINT64 n, INT advice);
+
+// read page from disk into the frame of slot
+Page* read_page_from_file(UINT oid, UINT64 pid, UINT64 page_id_init, Slot* slot);
+// request_page() + read on a miss, the returned page is pinned. not to be
+// called under the latch, where request_page() may return NO_SLOT
+Page* get_page(UINT oid, UINT64 pid, UINT64 page_id_init);
+Page* get_page_with(UINT oid, UINT64 pid, UINT64 page_id_init, AccessStrategy* strategy);
 
-// open file management
-//FILE* open_file(UINT oid);
-//void close_file(UINT oid);
+// write path, dirty pages are written back when evicted or at release()
+// 0 without writing when open_file() is -1
+UINT write_page_to_file(Slot* slot);
+// pinned zero page for a page not on disk yet, not under the latch either
+Page* new_page(UINT oid, UINT64 pid, UINT64 page_id_init);
+void mark_dirty(UINT64 pid, UINT oid);
+void discard_pages(UINT oid);
+UINT create_temp_file();
+void drop_temp_file(UINT oid);
 
-// read page from disk
-//Page* read_page_from_file(UINT oid, UINT64 pid, UINT64 page_id_init);
+// tables and temp files
+Table* find_table(const char* table_name);
+Rel open_rel(const Table* t);
+UINT rel_page_ntuples(const Rel* rel, UINT i);
+Rel create_temp_rel(UINT nattrs);
+INT* rel_append(Rel* rel);
+void rel_finish(Rel* rel);
+void drop_rel(Rel* rel);
+void cursor_open(RelCursor* c, Rel* rel, UINT page, UINT pos);
+const INT* cursor_tuple(const RelCursor* c);
+void cursor_next(RelCursor* c);
+void cursor_close(RelCursor* c);
 
 void init();
 void release();
 
-// equality test for one attribute
+// comparison on one attribute
 // idx: index of the attribute for comparison, 0 <= idx < nattrs
-// cond_val: the compared value
+// op: OP_EQ, OP_NE, OP_LT, OP_LE, OP_GT, OP_GE or OP_BETWEEN (filter.h)
+// cond_val: the compared value, the lower bound for OP_BETWEEN
+// cond_val2: the upper bound for OP_BETWEEN, ignored otherwise
 // table_name: table name
-_Table* sel(const UINT idx, const INT cond_val, const char* table_name);
+_Table* sel(const UINT idx, const UINT op, const INT cond_val, const INT cond_val2, const char* table_name);
 
 _Table* join(const UINT idx1, const char* table1_name, const UINT idx2, const char* table2_name);
 #endif
\ No newline at end of file
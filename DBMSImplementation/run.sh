@@ -1,19 +1,59 @@
+# usage: ./run.sh [buffer_replacement_policy]    default CLS
 rm ./data/*
 make
 # binary_file page_size buffer_slots max_opened_files buffer_replacement_policy database_folder input_data queries output_log
 
 test_folder='test'
+policy=${1:-CLS}
 
-./main 64 6 3 CLS ./data ./$test_folder/test1/data_1.txt ./$test_folder/test1/query_1.txt ./$test_folder/test1/log_1.txt
+./main 64 6 3 $policy ./data ./$test_folder/test1/data_1.txt ./$test_folder/test1/query_1.txt ./$test_folder/test1/log_1.txt
 
 # selection only test
-./main 50 3 3 CLS ./data ./$test_folder/test2/data_2.txt ./$test_folder/test2/query_2.txt ./$test_folder/test2/log_2.txt 
+./main 50 3 3 $policy ./data ./$test_folder/test2/data_2.txt ./$test_folder/test2/query_2.txt ./$test_folder/test2/log_2.txt 
 
 # join only test （for enough buffers）
-./main 50 14 2 CLS ./data ./$test_folder/test3/data_3.txt ./$test_folder/test3/query_3.txt ./$test_folder/test3/log_3.txt 
+./main 50 14 2 $policy ./data ./$test_folder/test3/data_3.txt ./$test_folder/test3/query_3.txt ./$test_folder/test3/log_3.txt 
 
 # join only test  
-./main 50 5 2 CLS ./data ./$test_folder/test4/data_4.txt ./$test_folder/test4/query_4.txt ./$test_folder/test4/log_4.txt 
+./main 50 5 2 $policy ./data ./$test_folder/test4/data_4.txt ./$test_folder/test4/query_4.txt ./$test_folder/test4/log_4.txt 
 
 # mixed test 
-./main 40 3 3 CLS ./data ./$test_folder/test5/data_5.txt ./$test_folder/test5/query_5.txt ./$test_folder/test5/log_5.txt 
\ No newline at end of file
+./main 40 3 3 $policy ./data ./$test_folder/test5/data_5.txt ./$test_folder/test5/query_5.txt ./$test_folder/test5/log_5.txt 
+
+# sequential scan test
+./main 64 16 3 $policy ./data ./$test_folder/test6/data_6.txt ./$test_folder/test6/query_6.txt ./$test_folder/test6/log_6.txt
+
+# range and inequality selection test
+./main 48 4 2 $policy ./data ./$test_folder/test7/data_7.txt ./$test_folder/test7/query_7.txt ./$test_folder/test7/log_7.txt
+
+# hash join test
+./main 40 4 2 $policy ./data ./$test_folder/test8/data_8.txt ./$test_folder/test8/query_8.txt ./$test_folder/test8/log_8.txt
+
+# hash join with sessions and read-ahead sharing one open file, evictions write pages of other files back
+./main 40 24 1 $policy ./data ./$test_folder/test8/data_8.txt ./$test_folder/test8/query_8.txt ./$test_folder/test8/log_8_sessions.txt sessions=3 prefetch=4
+
+# external sort-merge join test
+./main 48 5 2 $policy ./data ./$test_folder/test9/data_9.txt ./$test_folder/test9/query_9.txt ./$test_folder/test9/log_9.txt join=sm
+
+# index selection test
+./main 48 5 2 $policy ./data ./$test_folder/test10/data_10.txt ./$test_folder/test10/query_10.txt ./$test_folder/test10/log_10.txt
+
+# index nested loop join test
+./main 48 5 2 $policy ./data ./$test_folder/test11/data_11.txt ./$test_folder/test11/query_11.txt ./$test_folder/test11/log_11.txt
+
+# zone map test
+./main 48 5 2 $policy ./data ./$test_folder/test12/data_12.txt ./$test_folder/test12/query_12.txt ./$test_folder/test12/log_12.txt zonemaps=on
+
+# bloom filter semi-join test
+./main 48 5 2 $policy ./data ./$test_folder/test13/data_13.txt ./$test_folder/test13/query_13.txt ./$test_folder/test13/log_13.txt bloom=on
+
+# catalog test, the second run opens the database the first one loaded
+./main 48 5 2 $policy ./data ./$test_folder/test14/data_14.txt ./$test_folder/test14/query_14.txt ./$test_folder/test14/log_14.txt
+./main 48 5 2 $policy ./data ./$test_folder/test14/data_14.txt ./$test_folder/test14/query_14.txt ./$test_folder/test14/log_14_open.txt startup=open
+
+# write path test, the second run reads the tables the first one changed
+./main 48 5 2 $policy ./data ./$test_folder/test15/data_15.txt ./$test_folder/test15/query_15.txt ./$test_folder/test15/log_15.txt
+./main 48 5 2 $policy ./data ./$test_folder/test15/data_15.txt ./$test_folder/test15/query_15_open.txt ./$test_folder/test15/log_15_open.txt startup=open
+
+# index maintenance test
+./main 48 5 2 $policy ./data ./$test_folder/test16/data_16.txt ./$test_folder/test16/query_16.txt ./$test_folder/test16/log_16.txt
@@ -0,0 +1,120 @@
+// work-stealing pool for parallel operators
+// a share is a range of morsel numbers under its own lock. the owner takes
+// morsels one at a time from the front, thieves split off the back half,
+// so a steal moves many morsels at once and the owner is rarely disturbed
+
+#include <stdlib.h>
+#include <assert.h>
+#include <pthread.h>
+#include "sched.h"
+
+typedef struct Share {   // morsels [lo, hi) left to one worker
+    pthread_mutex_t lock;
+    UINT lo;
+    UINT hi;
+} Share;
+
+typedef struct Pool {
+    Share* shares;
+    UINT nworkers;
+    MorselFn fn;
+    void* arg;
+    UINT steals;
+} Pool;
+
+typedef struct Worker {
+    Pool* pool;
+    UINT id;
+} Worker;
+
+// next morsel of share s, 0 if it is empty
+static UINT take(Share* s, UINT* morsel){
+    UINT found = 0;
+    pthread_mutex_lock(&s->lock);
+    if (s->lo < s->hi){
+        *morsel = s->lo++;
+        found = 1;
+    }
+    pthread_mutex_unlock(&s->lock);
+    return found;
+}
+
+// move the back half of the largest other share to worker self,
+// 0 once every share is empty
+static UINT steal(Pool* pool, UINT self){
+    while (1){
+        // the sizes are read without the locks, the victim is rechecked below
+        UINT victim = self;
+        UINT most = 0;
+        for (UINT w = 0; w < pool->nworkers; ++w){
+            Share* s = &pool->shares[w];
+            UINT left = __atomic_load_n(&s->hi, __ATOMIC_RELAXED) - __atomic_load_n(&s->lo, __ATOMIC_RELAXED);
+            if (w != self && (INT)left > (INT)most){
+                victim = w;
+                most = left;
+            }
+        }
+        if (victim == self) return 0;
+
+        Share* s = &pool->shares[victim];
+        pthread_mutex_lock(&s->lock);
+        UINT left = s->hi - s->lo;
+        if (left == 0){
+            // drained in the meantime, look again
+            pthread_mutex_unlock(&s->lock);
+            continue;
+        }
+        UINT hi = s->hi;
+        s->hi -= (left + 1) / 2;
+        UINT lo = s->hi;
+        pthread_mutex_unlock(&s->lock);
+
+        Share* own = &pool->shares[self];
+        pthread_mutex_lock(&own->lock);
+        own->lo = lo;
+        own->hi = hi;
+        pthread_mutex_unlock(&own->lock);
+        __atomic_add_fetch(&pool->steals, 1, __ATOMIC_RELAXED);
+        return 1;
+    }
+}
+
+static void* work(void* arg){
+    Worker* w = arg;
+    Pool* pool = w->pool;
+    UINT morsel;
+    do {
+        while (take(&pool->shares[w->id], &morsel)) pool->fn(pool->arg, morsel, w->id);
+    } while (steal(pool, w->id));
+    return NULL;
+}
+
+UINT parallel_for(UINT nworkers, UINT n, MorselFn fn, void* arg){
+    if (nworkers > n) nworkers = n;
+    if (nworkers <= 1){
+        for (UINT m = 0; m < n; ++m) fn(arg, m, 0);
+        return 0;
+    }
+
+    Share shares[nworkers];
+    Worker workers[nworkers];
+    pthread_t threads[nworkers];
+    Pool pool = { shares, nworkers, fn, arg, 0 };
+    for (UINT w = 0; w < nworkers; ++w){
+        pthread_mutex_init(&shares[w].lock, NULL);
+        shares[w].lo = (UINT64)n * w / nworkers;
+        shares[w].hi = (UINT64)n * (w + 1) / nworkers;
+        workers[w].pool = &pool;
+        workers[w].id = w;
+    }
+
+    for (UINT w = 1; w < nworkers; ++w){
+        INT err = pthread_create(&threads[w], NULL, work, &workers[w]);
+        assert(err == 0);
+    }
+    work(&workers[0]);
+    for (UINT w = 1; w < nworkers; ++w) pthread_join(threads[w], NULL);
+
+    for (UINT w = 0; w < nworkers; ++w) pthread_mutex_destroy(&shares[w].lock);
+    return pool.steals;
+}
@@ -0,0 +1,17 @@
+#ifndef SCHED_H
+#define SCHED_H
+#include "db.h"
+
+// morsel-driven scheduling on a work-stealing pool
+// parallel_for() runs fn once for every morsel 0..n-1 on nworkers threads,
+// the calling thread is worker 0. every worker starts with a contiguous
+// share of the morsels and takes them from its front. a worker whose share
+// is used up steals the back half of the largest share left, so workers
+// that drew cheap morsels take over from the ones stuck on skewed ones.
+// returns after every morsel is done, with the number of steals
+
+typedef void (*MorselFn)(void* arg, UINT morsel, UINT worker);
+
+UINT parallel_for(UINT nworkers, UINT n, MorselFn fn, void* arg);
+
+#endif
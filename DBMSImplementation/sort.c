@@ -0,0 +1,229 @@
+// external merge sort through the buffer pool
+// every page of a run is a temp file page created with new_page(), so the
+// runs are written back (and counted in write_io) when they are evicted
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "sort.h"
+
+static Conf* cf = NULL;
+
+#define RADIX_BITS 8
+#define RADIX_SIZE (1 << RADIX_BITS)
+#define RADIX_SMALL 32      // insertion sort below this
+
+static UINT64 div_ceil(UINT64 a, UINT64 b){
+    return (a + b - 1) / b;
+}
+
+static void insertion_sort(KeyRef* refs, UINT n){
+    for (UINT i = 1; i < n; ++i){
+        KeyRef x = refs[i];
+        UINT j = i;
+        for (; j > 0 && refs[j-1].key > x.key; --j) refs[j] = refs[j-1];
+        refs[j] = x;
+    }
+}
+
+void radix_sort(KeyRef* refs, KeyRef* tmp, UINT n){
+    if (n <= RADIX_SMALL){
+        insertion_sort(refs, n);
+        return;
+    }
+
+    // histograms of all four digits in one pass
+    UINT count[4][RADIX_SIZE];
+    memset(count, 0, sizeof(count));
+    for (UINT i = 0; i < n; ++i){
+        UINT k = refs[i].key;
+        ++count[0][k & 0xff];
+        ++count[1][(k >> 8) & 0xff];
+        ++count[2][(k >> 16) & 0xff];
+        ++count[3][k >> 24];
+    }
+
+    KeyRef* src = refs;
+    KeyRef* dst = tmp;
+    for (UINT d = 0; d < 4; ++d){
+        UINT shift = d * RADIX_BITS;
+        // every key has the same digit, the pass would not move anything
+        if (count[d][(src[0].key >> shift) & 0xff] == n) continue;
+
+        UINT offset = 0;
+        for (UINT b = 0; b < RADIX_SIZE; ++b){
+            UINT c = count[d][b];
+            count[d][b] = offset;
+            offset += c;
+        }
+        for (UINT i = 0; i < n; ++i)
+            dst[count[d][(src[i].key >> shift) & 0xff]++] = src[i];
+
+        KeyRef* t = src;
+        src = dst;
+        dst = t;
+    }
+    if (src != refs) memcpy(refs, src, sizeof(KeyRef) * n);
+}
+
+// sort each buf_slots-1 pages of rel in memory and write them out as a run,
+// only (key, position) pairs are sorted, the tuples are copied once into the run
+// one slot stays free for the pinned tail page of the run
+static UINT generate_runs(Rel* rel, UINT idx, Rel* runs){
+    UINT chunk = work_slots() - 1;
+    Page* block[chunk];
+    KeyRef* refs = malloc(sizeof(KeyRef) * chunk * rel->ntuples_per_page);
+    KeyRef* tmp = malloc(sizeof(KeyRef) * chunk * rel->ntuples_per_page);
+    UINT nruns = 0;
+
+    for (UINT first = 0; first < rel->npages; first += chunk){
+        UINT nblock = rel->npages - first;
+        if (nblock > chunk) nblock = chunk;
+
+        UINT n = 0;
+        for (UINT k = 0; k < nblock; ++k){
+            block[k] = get_page(rel->oid, rel->page_id_init + first + k, rel->page_id_init);
+            UINT ntuples_of_cur_page = rel_page_ntuples(rel, first + k);
+            for (UINT j = 0; j < ntuples_of_cur_page; ++j){
+                refs[n].key = radix_key(block[k]->data[j * rel->nattrs + idx]);
+                refs[n].ref = k * rel->ntuples_per_page + j;
+                ++n;
+            }
+        }
+        radix_sort(refs, tmp, n);
+
+        Rel* run = &runs[nruns++];
+        *run = create_temp_rel(rel->nattrs);
+        for (UINT j = 0; j < n; ++j){
+            const INT* tup = block[refs[j].ref / rel->ntuples_per_page]->data
+                           + (refs[j].ref % rel->ntuples_per_page) * rel->nattrs;
+            memcpy(rel_append(run), tup, sizeof(INT) * rel->nattrs);
+        }
+        rel_finish(run);
+
+        for (UINT k = 0; k < nblock; ++k)
+            release_page(rel->page_id_init + first + k, rel->oid);
+    }
+
+    free(refs);
+    free(tmp);
+    return nruns;
+}
+
+
+//// k-way merge with a loser tree
+// node[0] is the cursor holding the smallest tuple, node[1..k-1] hold the
+// losers of the matches on the way up, so replacing the winner only replays
+// the log2(k) matches on its path
+
+typedef struct LoserTree {
+    UINT k;
+    UINT idx;
+    RelCursor* cursors;
+    UINT* node;
+} LoserTree;
+
+// cursor a comes before cursor b, k is a sentinel smaller than everything
+// and exhausted cursors are larger than everything, ties go to the earlier run
+static UINT lt_before(const LoserTree* lt, UINT a, UINT b){
+    if (a == lt->k) return 1;
+    if (b == lt->k) return 0;
+    const INT* ta = cursor_tuple(&lt->cursors[a]);
+    const INT* tb = cursor_tuple(&lt->cursors[b]);
+    if (tb == NULL) return ta != NULL || a < b;
+    if (ta == NULL) return 0;
+    if (ta[lt->idx] != tb[lt->idx]) return ta[lt->idx] < tb[lt->idx];
+    return a < b;
+}
+
+// replay the matches from leaf s to the root
+static void lt_adjust(LoserTree* lt, UINT s){
+    for (UINT t = (s + lt->k) / 2; t > 0; t /= 2){
+        if (lt_before(lt, lt->node[t], s)){
+            UINT winner = lt->node[t];
+            lt->node[t] = s;
+            s = winner;
+        }
+    }
+    lt->node[0] = s;
+}
+
+static void lt_init(LoserTree* lt){
+    for (UINT i = 0; i < lt->k; ++i) lt->node[i] = lt->k;
+    for (UINT i = lt->k; i > 0; --i) lt_adjust(lt, i - 1);
+}
+
+// merge runs[0..k-1] into one new run, the inputs are dropped
+static Rel merge_runs(Rel* runs, UINT k, UINT idx){
+    RelCursor cursors[k];
+    UINT node[k];
+    LoserTree lt = { k, idx, cursors, node };
+    Rel out = create_temp_rel(runs[0].nattrs);
+
+    for (UINT i = 0; i < k; ++i) cursor_open(&cursors[i], &runs[i], 0, 0);
+    lt_init(&lt);
+    while (1){
+        UINT w = lt.node[0];
+        const INT* tup = cursor_tuple(&cursors[w]);
+        if (tup == NULL) break;
+        memcpy(rel_append(&out), tup, sizeof(INT) * out.nattrs);
+        cursor_next(&cursors[w]);
+        lt_adjust(&lt, w);
+    }
+    rel_finish(&out);
+
+    for (UINT i = 0; i < k; ++i){
+        cursor_close(&cursors[i]);
+        drop_rel(&runs[i]);
+    }
+    return out;
+}
+
+Rel external_sort(Rel* rel, UINT idx){
+    cf = get_conf();
+    assert(work_slots() >= 3);
+    assert(idx < rel->nattrs);
+    if (rel->npages == 0) return create_temp_rel(rel->nattrs);
+
+    // one input page per run and the tail page of the output
+    UINT fan_in = work_slots() - 1;
+    Rel* runs = malloc(sizeof(Rel) * div_ceil(rel->npages, fan_in));
+    UINT nruns = generate_runs(rel, idx, runs);
+
+    while (nruns > 1){
+        UINT nmerged = 0;
+        for (UINT first = 0; first < nruns; first += fan_in){
+            UINT k = nruns - first;
+            if (k > fan_in) k = fan_in;
+            // a lone last run goes on to the next pass as it is
+            if (k == 1) runs[nmerged++] = runs[first];
+            else runs[nmerged++] = merge_runs(&runs[first], k, idx);
+        }
+        nruns = nmerged;
+    }
+
+    Rel sorted = runs[0];
+    free(runs);
+    return sorted;
+}
+
+UINT64 cost_external_sort(UINT npages){
+    cf = get_conf();
+    if (npages == 0) return 0;
+    UINT64 fan_in = work_slots() - 1;
+    // read the input, write the runs, the last page of each may be partly full
+    UINT64 nruns = div_ceil(npages, fan_in);
+    UINT64 cost = 2 * (UINT64)npages + nruns;
+    // every merge pass reads and writes everything once more, but for a lone
+    // last run, which is carried over. a run holds span input pages
+    UINT64 span = fan_in;
+    while (nruns > 1){
+        UINT64 carried = nruns % fan_in == 1 ? npages - (nruns - 1) * span : 0;
+        UINT64 merged = div_ceil(nruns, fan_in) - (carried > 0);
+        cost += 2 * (npages - carried + merged);
+        nruns = div_ceil(nruns, fan_in);
+        span *= fan_in;
+    }
+    return cost;
+}
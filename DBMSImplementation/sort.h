@@ -0,0 +1,30 @@
+#ifndef SORT_H
+#define SORT_H
+#include "ro.h"
+
+// a sort key and a reference to its tuple, e.g. its position in a page block
+typedef struct KeyRef {
+    UINT key;   // radix_key() of the attribute
+    UINT ref;
+} KeyRef;
+
+// INT key as an unsigned key with the same order (sign bit flipped)
+static inline UINT radix_key(INT key){
+    return (UINT)key ^ 0x80000000u;
+}
+
+// stable LSD radix sort of refs[0..n-1] by key, tmp needs room for n entries
+// no global state, so separate sorts may run concurrently
+void radix_sort(KeyRef* refs, KeyRef* tmp, UINT n);
+
+// external merge sort of the tuples of rel on attribute idx
+// runs of buf_slots-1 pages are sorted in memory and written to temp files,
+// then merged buf_slots-1 at a time with a loser tree until one run is left.
+// equal keys keep their input order. needs at least 3 buffer slots.
+// returns a temp rel, free it with drop_rel()
+Rel external_sort(Rel* rel, UINT idx);
+
+// estimated page I/O of external_sort() on npages pages
+UINT64 cost_external_sort(UINT npages);
+
+#endif
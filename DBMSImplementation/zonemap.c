@@ -0,0 +1,176 @@
+// per-page min/max of every attribute, kept in memory for all tables
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <sys/stat.h>
+#include "zonemap.h"
+
+static Conf* cf = NULL;
+static ZoneMap* zone_maps = NULL;
+static UINT nzone_maps = 0;
+
+// tables whose sidecar is missing or does not fit the table get no zone map
+void load_zone_maps(){
+    cf = get_conf();
+    Database* db = get_db();
+    zone_maps = malloc(sizeof(ZoneMap) * (db->ntables + 1));
+    nzone_maps = 0;
+    for (UINT i = 0; i < db->ntables; ++i){
+        const Table* t = &db->tables[i];
+        UINT ntuples_per_page = (cf->page_size - sizeof(UINT64)) / sizeof(INT) / t->nattrs;
+        UINT npages = (t->ntuples + ntuples_per_page - 1) / ntuples_per_page;
+        size_t n = (size_t)npages * t->nattrs * 2;
+
+        char path[200];
+        sprintf(path, "%s/%u.zm", db->path, t->oid);
+        struct stat st;
+        if (stat(path, &st) != 0 || (size_t)st.st_size != n * sizeof(INT)) continue;
+        FILE* fp = fopen(path, "rb");
+        if (fp == NULL) continue;
+
+        ZoneMap* zm = &zone_maps[nzone_maps];
+        zm->oid = t->oid;
+        zm->nattrs = t->nattrs;
+        zm->npages = npages;
+        zm->pages = malloc(sizeof(INT) * (n + 1));
+        zm->table = malloc(sizeof(INT) * 2 * t->nattrs);
+        zm->changed = 0;
+        size_t nread = fread(zm->pages, sizeof(INT), n, fp);
+        fclose(fp);
+        if (nread != n){
+            free(zm->pages);
+            free(zm->table);
+            continue;
+        }
+        for (UINT a = 0; a < t->nattrs; ++a){
+            zm->table[2 * a] = INT32_MAX;
+            zm->table[2 * a + 1] = INT32_MIN;
+            for (UINT p = 0; p < npages; ++p){
+                const INT* b = zm->pages + 2 * ((size_t)p * t->nattrs + a);
+                if (b[0] < zm->table[2 * a]) zm->table[2 * a] = b[0];
+                if (b[1] > zm->table[2 * a + 1]) zm->table[2 * a + 1] = b[1];
+            }
+        }
+        ++nzone_maps;
+    }
+}
+
+void free_zone_maps(){
+    for (UINT i = 0; i < nzone_maps; ++i){
+        free(zone_maps[i].pages);
+        free(zone_maps[i].table);
+    }
+    free(zone_maps);
+    zone_maps = NULL;
+    nzone_maps = 0;
+}
+
+void save_zone_maps(){
+    for (UINT i = 0; i < nzone_maps; ++i){
+        ZoneMap* zm = &zone_maps[i];
+        if (!zm->changed) continue;
+        char path[200];
+        sprintf(path, "%s/%u.zm", get_db()->path, zm->oid);
+        FILE* fp = fopen(path, "wb");
+        if (fp == NULL){
+            perror("Fail to write a zone map");
+            continue;
+        }
+        fwrite(zm->pages, sizeof(INT), (size_t)zm->npages * zm->nattrs * 2, fp);
+        fclose(fp);
+        zm->changed = 0;
+    }
+}
+
+static ZoneMap* find_zone_map(UINT oid){
+    for (UINT i = 0; i < nzone_maps; ++i){
+        if (zone_maps[i].oid == oid) return &zone_maps[i];
+    }
+    return NULL;
+}
+
+const ZoneMap* zone_map(UINT oid){
+    if (cf == NULL || !cf->zonemaps) return NULL;
+    return find_zone_map(oid);
+}
+
+void zone_map_update(UINT oid, UINT page, const INT* data, UINT ntuples){
+    ZoneMap* zm = find_zone_map(oid);
+    if (zm == NULL) return;
+    assert(page <= zm->npages);
+    if (page == zm->npages){
+        zm->pages = realloc(zm->pages, sizeof(INT) * ((size_t)(page + 1) * zm->nattrs * 2 + 1));
+        ++zm->npages;
+    }
+    INT* b = zm->pages + 2 * (size_t)page * zm->nattrs;
+    for (UINT a = 0; a < zm->nattrs; ++a){
+        b[2 * a] = INT32_MAX;
+        b[2 * a + 1] = INT32_MIN;
+    }
+    for (UINT j = 0; j < ntuples; ++j){
+        const INT* tup = data + (size_t)j * zm->nattrs;
+        for (UINT a = 0; a < zm->nattrs; ++a){
+            if (tup[a] < b[2 * a]) b[2 * a] = tup[a];
+            if (tup[a] > b[2 * a + 1]) b[2 * a + 1] = tup[a];
+        }
+    }
+    for (UINT a = 0; a < zm->nattrs; ++a){
+        if (b[2 * a] < zm->table[2 * a]) zm->table[2 * a] = b[2 * a];
+        if (b[2 * a + 1] > zm->table[2 * a + 1]) zm->table[2 * a + 1] = b[2 * a + 1];
+    }
+    zm->changed = 1;
+}
+
+void zone_map_truncate(UINT oid, UINT npages){
+    ZoneMap* zm = find_zone_map(oid);
+    if (zm == NULL || npages >= zm->npages) return;
+    zm->npages = npages;
+    zm->changed = 1;
+}
+
+void zone_page_bounds(const ZoneMap* zm, UINT page, UINT idx, INT* lo, INT* hi){
+    if (zm == NULL){
+        *lo = INT32_MIN;
+        *hi = INT32_MAX;
+        return;
+    }
+    assert(page < zm->npages && idx < zm->nattrs);
+    const INT* b = zm->pages + 2 * ((size_t)page * zm->nattrs + idx);
+    *lo = b[0];
+    *hi = b[1];
+}
+
+void zone_table_bounds(const ZoneMap* zm, UINT idx, INT* lo, INT* hi){
+    if (zm == NULL){
+        *lo = INT32_MIN;
+        *hi = INT32_MAX;
+        return;
+    }
+    assert(idx < zm->nattrs);
+    *lo = zm->table[2 * idx];
+    *hi = zm->table[2 * idx + 1];
+}
+
+UINT zone_overlaps(const ZoneMap* zm, UINT page, UINT idx, INT lo, INT hi){
+    INT min, max;
+    zone_page_bounds(zm, page, idx, &min, &max);
+    return min <= hi && max >= lo;
+}
+
+UINT zone_match(const ZoneMap* zm, UINT page, UINT idx, UINT op, INT val, INT val2){
+    if (zm == NULL) return 1;
+    INT lo, hi;
+    UINT negate;
+    if (!filter_range(op, val, val2, &lo, &hi, &negate)) return 0;
+    if (!negate) return zone_overlaps(zm, page, idx, lo, hi);
+    // != only rules out a page holding nothing but val
+    INT min, max;
+    zone_page_bounds(zm, page, idx, &min, &max);
+    return !(min == lo && max == hi);
+}
+
+void zone_skipped(UINT npages){
+    if (npages > 0) __atomic_add_fetch(&cf->pages_skipped, npages, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,52 @@
+#ifndef ZONEMAP_H
+#define ZONEMAP_H
+#include "ro.h"
+
+// zone maps
+// init_db() writes "<oid>.zm" next to every table file, the (min, max) pair
+// of each attribute of every page, 2 * nattrs INTs per page in page order.
+// init() loads them. with zonemaps=on, scans leave pages whose pairs rule
+// out a match on disk instead of requesting them from the buffer, and the
+// skipped pages are counted in Conf.pages_skipped. inserts, deletes and
+// updates keep the pairs of the pages they change, whether zone maps are
+// used or not, and release() writes the changed sidecars back
+
+typedef struct ZoneMap {
+    UINT oid;
+    UINT nattrs;
+    UINT npages;
+    INT* pages;             // (min, max) of attribute a of page p at 2 * (p * nattrs + a)
+    INT* table;             // (min, max) of attribute a over the table at 2 * a
+    UINT changed;           // sidecar out of date
+} ZoneMap;
+
+void load_zone_maps();
+void free_zone_maps();
+// write the sidecars of the changed zone maps
+void save_zone_maps();
+
+// zone map of table oid, NULL with zonemaps=off and for files without one
+const ZoneMap* zone_map(UINT oid);
+
+// bounds of attribute idx on a page or the whole table,
+// INT32_MIN and INT32_MAX when zm is NULL
+void zone_page_bounds(const ZoneMap* zm, UINT page, UINT idx, INT* lo, INT* hi);
+void zone_table_bounds(const ZoneMap* zm, UINT idx, INT* lo, INT* hi);
+
+// 0 if no tuple of page can have attribute idx in [lo, hi], 1 if zm is NULL
+UINT zone_overlaps(const ZoneMap* zm, UINT page, UINT idx, INT lo, INT hi);
+
+// 0 if no tuple of page can satisfy attribute idx <op> val, 1 if zm is NULL
+UINT zone_match(const ZoneMap* zm, UINT page, UINT idx, UINT op, INT val, INT val2);
+
+// pairs of page of table oid from its ntuples tuples, page may be the one
+// after the last. the table pairs only widen, so they may stay looser
+// than the pages after a delete or update. nothing for a table without one
+void zone_map_update(UINT oid, UINT page, const INT* data, UINT ntuples);
+// table oid now has npages pages
+void zone_map_truncate(UINT oid, UINT npages);
+
+// add npages to Conf.pages_skipped, scans may run concurrently
+void zone_skipped(UINT npages);
+
+#endif